@@ -0,0 +1,119 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// SSE loads over buffers from dm::mainAlloc, dm::stackAlloc and dm::staticAlloc, requested with natural, cache line
+// and page alignment. Aligned loads run on the returned pointers. For reference, unaligned loads run 4 bytes past
+// them, which splits a load across cache lines every now and then.
+
+#include "bench.h"
+#include <smmintrin.h>
+
+enum
+{
+    NumBuffers  = 1024,
+    BufferSize  = 1040, // Not a multiple of the cache line, buffers that are only naturally aligned drift across lines.
+    NumFloats   = (BufferSize-16)/sizeof(float),
+    Rounds      = 128,
+    Repeats     = 5,
+};
+
+static const size_t s_aligns[] = { DM_NATURAL_ALIGNMENT, 32, 64, 4096 };
+
+static float* s_buffers[NumBuffers];
+
+template <bool Aligned>
+static float sum(uint32_t _offset)
+{
+    // Four accumulators, so that loads rather than the add latency set the pace.
+    __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+    for (uint32_t round = 0; round < Rounds; ++round)
+    {
+        for (uint32_t ii = 0; ii < NumBuffers; ++ii)
+        {
+            const float* data = s_buffers[ii] + _offset;
+            for (uint32_t jj = 0; jj < NumFloats; jj += 16)
+            {
+                for (uint32_t kk = 0; kk < 4; ++kk)
+                {
+                    acc[kk] = _mm_add_ps(acc[kk], Aligned ? _mm_load_ps(&data[jj+kk*4]) : _mm_loadu_ps(&data[jj+kk*4]));
+                }
+            }
+        }
+    }
+
+    float out[4];
+    _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(acc[0], acc[1]), _mm_add_ps(acc[2], acc[3])));
+    return out[0] + out[1] + out[2] + out[3];
+}
+
+static void run(const char* _name, bx::AllocatorI* _alloc, size_t _align)
+{
+    uint32_t lineAligned = 0;
+    for (uint32_t ii = 0; ii < NumBuffers; ++ii)
+    {
+        s_buffers[ii] = (float*)BX_ALIGNED_ALLOC(_alloc, BufferSize, _align);
+        for (uint32_t jj = 0; jj < BufferSize/sizeof(float); ++jj)
+        {
+            s_buffers[ii][jj] = float(jj&7);
+        }
+
+        lineAligned += (0 == (uintptr_t(s_buffers[ii])&63));
+    }
+
+    const double ops = double(Rounds)*NumBuffers*(NumFloats/4);
+
+    // Best of a few alternating runs.
+    double aligned   = 1e9;
+    double unaligned = 1e9;
+    float result = 0.0f;
+    for (uint32_t ii = 0; ii < Repeats; ++ii)
+    {
+        double start = benchNow();
+        result += sum<true>(0);
+        aligned = dm::min(aligned, benchNow() - start);
+
+        start = benchNow();
+        result += sum<false>(1);
+        unaligned = dm::min(unaligned, benchNow() - start);
+    }
+
+    printf("%-8s %6u %12.3f %12.3f %10.1f%% %12.0f\n"
+          , _name
+          , uint32_t(_align)
+          , aligned*1e9/ops
+          , unaligned*1e9/ops
+          , 100.0*lineAligned/NumBuffers
+          , result
+          );
+}
+
+int main()
+{
+    dm::allocInit();
+
+    printf("%-8s %6s %12s %12s %11s %12s\n", "alloc", "align", "load ns", "loadu+4 ns", "line alig.", "checksum");
+
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_aligns); ++ii)
+    {
+        run("main", dm::mainAlloc, s_aligns[ii]);
+        for (uint32_t jj = 0; jj < NumBuffers; ++jj)
+        {
+            BX_ALIGNED_FREE(dm::mainAlloc, s_buffers[jj], s_aligns[ii]);
+        }
+
+        dm::StackAllocScope scope(dm::stackAlloc);
+        run("stack", dm::stackAlloc, s_aligns[ii]);
+    }
+
+    // Static memory is never given back, every run takes its buffers for good.
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_aligns); ++ii)
+    {
+        run("static", dm::staticAlloc, s_aligns[ii]);
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
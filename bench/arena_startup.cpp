@@ -0,0 +1,53 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Startup time and RSS of the arena, built once per DM_MEM_ARENA mode, see scripts/dmbench.lua.
+// RSS is sampled after init, with 256MB of heap blocks in use, and after they are freed again.
+
+#include "bench.h"
+
+enum
+{
+    BlockSize = DM_KILOBYTES(64),
+    NumBlocks = DM_MEGABYTES(256)/BlockSize,
+};
+
+static void* s_blocks[NumBlocks];
+
+int main()
+{
+    const size_t rssStart = benchRss();
+
+    const double start = benchNow();
+    dm::allocInit();
+    const double initTime = benchNow() - start;
+    const size_t rssInit = benchRss();
+
+    for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+    {
+        s_blocks[ii] = DM_ALLOC(dm::mainAlloc, BlockSize);
+        memset(s_blocks[ii], 0xab, BlockSize);
+    }
+    const size_t rssUsed = benchRss();
+
+    for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+    {
+        DM_FREE(dm::mainAlloc, s_blocks[ii]);
+    }
+    const size_t rssFreed = benchRss();
+
+    printf("arena: %s\n", (DM_MEM_ARENA_VMEM == DM_MEM_ARENA) ? "vmem" : "malloc");
+    printf("init:  %10.3f ms\n", initTime*1e3);
+    printf("rss:   %10.1f MB at start, %.1f MB after init, %.1f MB with 256MB used, %.1f MB after free\n"
+          , double(rssStart)/DM_MEGABYTES(1)
+          , double(rssInit)/DM_MEGABYTES(1)
+          , double(rssUsed)/DM_MEGABYTES(1)
+          , double(rssFreed)/DM_MEGABYTES(1)
+          );
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
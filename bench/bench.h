@@ -0,0 +1,158 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_BENCH_H_HEADER_GUARD
+#define DM_BENCH_H_HEADER_GUARD
+
+// Shared by the allocator benchmarks, see scripts/dmbench.lua.
+// Every benchmark is a program of its own, configuration variants are separate builds of the same file.
+// POSIX only, RSS is read from /proc on Linux.
+
+#include <stdio.h>  // printf()
+#include <stdint.h> // uint32_t
+#include <time.h>   // clock_gettime()
+#include <pthread.h>
+
+#ifndef CS_CHECK
+#   define CS_CHECK DM_CHECK
+#endif //CS_CHECK
+
+// DM_BENCH_NO_IMPL leaves out the allocator, for benchmarks of the malloc() in use.
+#ifndef DM_BENCH_NO_IMPL
+#   define DM_ALLOCATOR_IMPL
+#endif //DM_BENCH_NO_IMPL
+#include <dm/allocator/allocator.h>
+#include <dm/allocator/vmem.h> // dm::vmemPageSize()
+#include <bx/os.h>             // bx::yield()
+
+/// Seconds.
+static inline double benchNow()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec)*1e-9;
+}
+
+/// Resident set size in bytes, 0 if unknown.
+static inline size_t benchRss()
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (NULL == file)
+    {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int num = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+
+    return (2 == num) ? size_t(resident)*dm::vmemPageSize() : 0;
+}
+
+/// xorshift32, '_state' must not be 0.
+static inline uint32_t benchRand(uint32_t& _state)
+{
+    _state ^= _state<<13;
+    _state ^= _state>>17;
+    _state ^= _state<<5;
+    return _state;
+}
+
+/// Spinning barrier for threads started by benchRunThreads(), init() before use.
+struct BenchBarrier
+{
+    void init(uint32_t _num)
+    {
+        m_num   = _num;
+        m_count = 0;
+        m_phase = 0;
+    }
+
+    void wait()
+    {
+        const uint32_t phase = m_phase;
+        if (m_num == dm::atomicFetchAndAdd32(&m_count, 1) + 1)
+        {
+            m_count = 0;
+            dm::atomicFetchAndAdd32(&m_phase, 1);
+            return;
+        }
+
+        while (phase == m_phase)
+        {
+            bx::yield();
+        }
+    }
+
+    uint32_t          m_num;
+    volatile uint32_t m_count;
+    volatile uint32_t m_phase;
+};
+
+typedef void (*BenchThreadFn)(uint32_t _thread, void* _userData);
+
+struct BenchThreads
+{
+    BenchThreadFn     m_fn;
+    void*             m_userData;
+    volatile uint32_t m_ready;
+    volatile uint32_t m_go;
+    volatile uint32_t m_next;
+};
+
+static void* benchThreadEntry(void* _threads)
+{
+    BenchThreads& threads = *(BenchThreads*)_threads;
+    const uint32_t thread = dm::atomicFetchAndAdd32(&threads.m_next, 1);
+
+    dm::atomicFetchAndAdd32(&threads.m_ready, 1);
+    while (0 == threads.m_go)
+    {
+        bx::yield();
+    }
+
+    threads.m_fn(thread, threads.m_userData);
+
+    return NULL;
+}
+
+/// Runs '_fn' on '_num' threads, released together once all of them are up.
+/// Returns seconds from the release until the last thread finished.
+static inline double benchRunThreads(uint32_t _num, BenchThreadFn _fn, void* _userData)
+{
+    BenchThreads threads;
+    threads.m_fn       = _fn;
+    threads.m_userData = _userData;
+    threads.m_ready    = 0;
+    threads.m_go       = 0;
+    threads.m_next     = 0;
+
+    pthread_t handles[256];
+    _num = dm::min(_num, uint32_t(256));
+    for (uint32_t ii = 0; ii < _num; ++ii)
+    {
+        pthread_create(&handles[ii], NULL, benchThreadEntry, &threads);
+    }
+
+    while (threads.m_ready != _num)
+    {
+        bx::yield();
+    }
+
+    const double start = benchNow();
+    dm::atomicFetchAndAdd32(&threads.m_go, 1);
+
+    for (uint32_t ii = 0; ii < _num; ++ii)
+    {
+        pthread_join(handles[ii], NULL);
+    }
+
+    return benchNow() - start;
+}
+
+#endif // DM_BENCH_H_HEADER_GUARD
+
+/* vim: set sw=4 ts=4 expandtab: */
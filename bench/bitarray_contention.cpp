@@ -0,0 +1,115 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Lock-free dm::AtomicBitArray against dm::BitArray behind a mutex, the way the segregated lists used it before.
+// Every thread claims a batch of bits with setAny() and releases them again, at 1 to 64 threads.
+
+#include "bench.h"
+
+enum
+{
+    NumBits    = 64*1024,
+    Batch      = 32,
+    Iterations = 20000,
+};
+
+struct MutexBits
+{
+    void init(void* _mem)
+    {
+        m_bits.init(NumBits, _mem);
+    }
+
+    uint32_t setAny()
+    {
+        bx::LwMutexScope lock(m_mutex);
+        return m_bits.setAny();
+    }
+
+    void unset(uint32_t _bit)
+    {
+        bx::LwMutexScope lock(m_mutex);
+        m_bits.unset(_bit);
+    }
+
+    bx::LwMutex  m_mutex;
+    dm::BitArray m_bits;
+};
+
+struct AtomicBits
+{
+    void init(void* _mem)
+    {
+        m_bits.init(NumBits, _mem);
+    }
+
+    uint32_t setAny()
+    {
+        return m_bits.setAny();
+    }
+
+    void unset(uint32_t _bit)
+    {
+        m_bits.unset(_bit);
+    }
+
+    dm::AtomicBitArray m_bits;
+};
+
+template <typename BitsT>
+static void claimRelease(uint32_t /*_thread*/, void* _bits)
+{
+    BitsT& bits = *(BitsT*)_bits;
+
+    uint32_t claimed[Batch];
+    for (uint32_t ii = 0; ii < Iterations; ++ii)
+    {
+        for (uint32_t jj = 0; jj < Batch; ++jj)
+        {
+            claimed[jj] = bits.setAny();
+        }
+        for (uint32_t jj = 0; jj < Batch; ++jj)
+        {
+            bits.unset(claimed[jj]);
+        }
+    }
+}
+
+template <typename BitsT>
+static double run(uint32_t _numThreads)
+{
+    static uint8_t s_mem[DM_KILOBYTES(64)];
+    DM_CHECK(dm::AtomicBitArray::sizeFor(NumBits) <= sizeof(s_mem), "bitarray_contention | Buffer too small.");
+
+    BitsT* bits = ::new (dm::mainAlloc->alloc(sizeof(BitsT), 64, __FILE__, __LINE__)) BitsT();
+    bits->init(s_mem);
+
+    const double time = benchRunThreads(_numThreads, claimRelease<BitsT>, bits);
+
+    bits->~BitsT();
+    dm::mainAlloc->free(bits, 64, __FILE__, __LINE__);
+
+    return time;
+}
+
+int main()
+{
+    dm::allocInit();
+
+    printf("%8s %16s %16s %8s\n", "threads", "mutex ns/op", "atomic ns/op", "speedup");
+
+    for (uint32_t numThreads = 1; numThreads <= 64; numThreads *= 2)
+    {
+        const double ops    = double(numThreads)*Iterations*Batch*2;
+        const double mutex  = run<MutexBits>(numThreads);
+        const double atomic = run<AtomicBits>(numThreads);
+
+        printf("%8u %16.1f %16.1f %8.2f\n", numThreads, mutex*1e9/ops, atomic*1e9/ops, mutex/atomic);
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// dm::AtomicBitArray with its summaries against the linear scan of dm::BitArray, single threaded, 512K bits like the
+// 64-byte class. Each claim is followed by the release of a random set bit, so that free bits keep showing up
+// behind the hint. At 95% the low half is full and every 10th bit of the high half is free. With a single free bit
+// the linear scan has to go around the array to find it, the worst case of a stale hint.
+// Built again with DM_ATOMICBITARRAY_SUMMARIES=0 (bench_bitarray_occupancy_nosummary), see scripts/dmbench.lua.
+// dm::AtomicBitArray then keeps no summaries and scans from its hint, as the small lists did before summaries.
+
+#include "bench.h"
+
+enum
+{
+    NumBits = 512*1024,
+    NumOps  = 200000,
+};
+
+static uint32_t s_release[NumOps];
+
+template <typename BitsT>
+static double run(bool _single)
+{
+    BitsT bits;
+    bits.init(NumBits, dm::mainAlloc);
+    for (uint32_t ii = 0; ii < NumBits; ++ii)
+    {
+        if (_single ? ii != NumBits/2 : ii < NumBits/2 || 0 != ii%10)
+        {
+            bits.set(ii);
+        }
+    }
+
+    const double start = benchNow();
+    for (uint32_t ii = 0; ii < NumOps; ++ii)
+    {
+        const uint32_t bit = bits.setAny();
+        DM_CHECK(NumBits != bit, "bitarray_occupancy | Array is full.");
+
+        bits.unset(bits.isSet(s_release[ii]) ? s_release[ii] : bit);
+    }
+    const double time = benchNow() - start;
+
+    bits.destroy();
+
+    return time*1e9/NumOps;
+}
+
+int main()
+{
+    dm::allocInit();
+
+    uint32_t rand = 0x1b873593u;
+    for (uint32_t ii = 0; ii < NumOps; ++ii)
+    {
+        s_release[ii] = benchRand(rand)%NumBits;
+    }
+
+    printf("%-10s %-8s %10s\n", "array", "free", "claim ns");
+
+    for (uint32_t ii = 0; ii < 2; ++ii)
+    {
+        const bool single = (1 == ii);
+        const char* layout = single ? "1 bit" : "5%";
+
+        printf("%-10s %-8s %10.1f\n", "linear",  layout, run<dm::BitArray>(single));
+        printf("%-10s %-8s %10.1f\n", DM_ATOMICBITARRAY_SUMMARIES ? "summary" : "atomic", layout, run<dm::AtomicBitArray>(single));
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
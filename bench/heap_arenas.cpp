@@ -0,0 +1,116 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Heap allocation throughput from 1 to 32 threads, built with per-thread arenas and again with a single
+// heap lock (bench_heap_arenas_single), see scripts/dmbench.lua.
+// The local pass allocates and frees on the same thread. In the remote pass every thread frees the blocks of
+// its neighbour, which goes through the remote-free list of the owning arena.
+
+#include "bench.h"
+
+enum
+{
+    MaxThreads = 32,
+    NumBlocks  = 256,
+    Rounds     = 64,
+    MinSize    = DM_KILOBYTES(8),
+    MaxSize    = DM_KILOBYTES(256),
+};
+
+struct Blocks
+{
+    void*        m_ptrs[MaxThreads][NumBlocks];
+    uint32_t     m_numThreads;
+    BenchBarrier m_barrier;
+    double       m_allocTime; // Remote pass, measured by thread 0 between barriers.
+    double       m_freeTime;
+};
+
+static Blocks s_blocks;
+
+static inline size_t blockSize(uint32_t& _rand)
+{
+    return MinSize + benchRand(_rand)%(MaxSize-MinSize);
+}
+
+static void localAllocFree(uint32_t _thread, void* /*_userData*/)
+{
+    uint32_t rand = 0x9e3779b9u + _thread;
+    void** ptrs = s_blocks.m_ptrs[_thread];
+
+    for (uint32_t round = 0; round < Rounds; ++round)
+    {
+        for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+        {
+            ptrs[ii] = DM_ALLOC(dm::mainAlloc, blockSize(rand));
+            *(uint32_t*)ptrs[ii] = ii;
+        }
+        for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+        {
+            DM_FREE(dm::mainAlloc, ptrs[ii]);
+        }
+    }
+}
+
+static void remoteAllocFree(uint32_t _thread, void* /*_userData*/)
+{
+    uint32_t rand = 0x85ebca6bu + _thread;
+    void** ptrs      = s_blocks.m_ptrs[_thread];
+    void** neighbour = s_blocks.m_ptrs[(_thread+1)%s_blocks.m_numThreads];
+
+    for (uint32_t round = 0; round < Rounds; ++round)
+    {
+        s_blocks.m_barrier.wait();
+        const double start = benchNow();
+
+        for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+        {
+            ptrs[ii] = DM_ALLOC(dm::mainAlloc, blockSize(rand));
+            *(uint32_t*)ptrs[ii] = ii;
+        }
+
+        s_blocks.m_barrier.wait();
+        const double mid = benchNow();
+
+        for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+        {
+            DM_FREE(dm::mainAlloc, neighbour[ii]);
+        }
+
+        s_blocks.m_barrier.wait();
+        if (0 == _thread)
+        {
+            s_blocks.m_allocTime += mid - start;
+            s_blocks.m_freeTime  += benchNow() - mid;
+        }
+    }
+}
+
+int main()
+{
+    dm::allocInit();
+
+    printf("arenas: %u\n", uint32_t(DM_ALLOC_HEAP_ARENAS));
+    printf("%8s %20s %20s %20s\n", "threads", "local Mops/s", "remote alloc Mops/s", "remote free Mops/s");
+
+    for (uint32_t numThreads = 1; numThreads <= MaxThreads; numThreads *= 2)
+    {
+        s_blocks.m_numThreads = numThreads;
+
+        const double local = benchRunThreads(numThreads, localAllocFree, NULL);
+
+        s_blocks.m_barrier.init(numThreads);
+        s_blocks.m_allocTime = 0.0;
+        s_blocks.m_freeTime  = 0.0;
+        benchRunThreads(numThreads, remoteAllocFree, NULL);
+
+        const double ops = double(numThreads)*NumBlocks*Rounds;
+        printf("%8u %20.2f %20.2f %20.2f\n", numThreads, 2.0*ops/local*1e-6, ops/s_blocks.m_allocTime*1e-6, ops/s_blocks.m_freeTime*1e-6);
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Long running churn of 1MB-256MB buffers mixed with small blocks. Heap size should follow the live size and the
+// free space should not grow from round to round.
+// Built with the TLSF index and again with the array index (bench_heap_churn_array), see scripts/dmbench.lua.
+// Runs on a heap of its own, big buffers would take the large object path otherwise. Only the first page of
+// every block is touched, the mapping is reserved, not committed.
+
+#include "bench.h"
+
+enum
+{
+    NumBig      = 48,
+    NumSmall    = 20000,
+    Rounds      = 50,
+    OpsPerRound = 200000,
+    MinBigSize  = DM_MEGABYTES(1),
+    MaxBigSize  = DM_MEGABYTES(256),
+};
+
+static const uint64_t s_heapMemSize = UINT64_C(16)<<30;
+
+static void* s_big[NumBig];
+static void* s_small[NumSmall];
+
+int main()
+{
+    dm::allocInit();
+
+    uint8_t* mem = (uint8_t*)dm::vmemReserve(size_t(s_heapMemSize));
+    if (NULL == mem)
+    {
+        printf("Reserving %lluGB failed.\n", (unsigned long long)(s_heapMemSize>>30));
+        return 1;
+    }
+
+    uint8_t* heapLimit = mem;
+    uint8_t* heapEnd   = mem + s_heapMemSize;
+
+    dm::Memory::Heap* heap = ::new (DM_ALLOC(dm::mainAlloc, sizeof(dm::Memory::Heap))) dm::Memory::Heap();
+    heap->init(&heapLimit, &heapEnd, dm::vmemPageSize(), &heapLimit);
+
+    printf("%6s %12s %12s %12s %12s %10s\n", "round", "size MB", "used MB", "free MB", "free blocks", "failed");
+
+    uint32_t rand = 0x68e31da4u;
+    uint32_t failed = 0;
+    for (uint32_t round = 0; round < Rounds; ++round)
+    {
+        for (uint32_t ii = 0; ii < OpsPerRound; ++ii)
+        {
+            const uint32_t rnd = benchRand(rand);
+            void** slot = (0 == (rnd&1023)) ? &s_big[rnd%NumBig] : &s_small[rnd%NumSmall];
+
+            if (NULL != *slot)
+            {
+                heap->free(*slot);
+                *slot = NULL;
+                continue;
+            }
+
+            const size_t size = (slot >= s_big && slot < s_big + NumBig)
+                              ? MinBigSize + size_t(benchRand(rand))%(MaxBigSize-MinBigSize)
+                              : 64 + benchRand(rand)%DM_KILOBYTES(8)
+                              ;
+
+            *slot = heap->alloc(size);
+            if (NULL == *slot)
+            {
+                ++failed;
+                continue;
+            }
+
+            *(uint32_t*)*slot = ii;
+        }
+
+        dm::AllocStats stats;
+        memset(&stats, 0, sizeof(stats));
+        heap->getStats(stats);
+
+        printf("%6u %12.1f %12.1f %12.1f %12u %10u\n"
+              , round
+              , double(stats.m_heapSize)/DM_MEGABYTES(1)
+              , double(stats.m_heapUsed)/DM_MEGABYTES(1)
+              , double(stats.m_heapFree)/DM_MEGABYTES(1)
+              , stats.m_heapFreeBlocks
+              , failed
+              );
+    }
+
+    for (uint32_t ii = 0; ii < NumBig; ++ii)
+    {
+        if (NULL != s_big[ii])
+        {
+            heap->free(s_big[ii]);
+        }
+    }
+    for (uint32_t ii = 0; ii < NumSmall; ++ii)
+    {
+        if (NULL != s_small[ii])
+        {
+            heap->free(s_small[ii]);
+        }
+    }
+
+    dm::AllocStats stats;
+    memset(&stats, 0, sizeof(stats));
+    heap->getStats(stats);
+    printf("after free: %.1f MB heap, %u free blocks\n", double(stats.m_heapSize)/DM_MEGABYTES(1), stats.m_heapFreeBlocks);
+
+    heap->~Heap();
+    DM_FREE(dm::mainAlloc, heap);
+    dm::vmemRelease(mem, size_t(s_heapMemSize));
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
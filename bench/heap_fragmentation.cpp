@@ -0,0 +1,117 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Heap free space index under fragmentation, built with the TLSF index and again with the array index
+// (bench_heap_fragmentation_array), see scripts/dmbench.lua.
+// Runs on a heap of its own, so that small allocations do not take the segregated lists path. The heap is filled,
+// every other block is freed, then random frees and allocations churn through the fragmented heap.
+
+#include "bench.h"
+
+enum
+{
+    NumBlocks   = 200000,
+    ChurnOps    = 2000000,
+    MinSize     = 64,
+    MaxSize     = DM_KILOBYTES(16),
+    HeapMemSize = DM_MEGABYTES(1024),
+};
+
+static void* s_blocks[NumBlocks];
+
+static inline size_t blockSize(uint32_t& _rand)
+{
+    // Mostly small, sometimes big, like a long running application.
+    const uint32_t rnd = benchRand(_rand);
+    return (0 == (rnd&7)) ? MinSize + rnd%(MaxSize-MinSize) : MinSize + rnd%1024;
+}
+
+static void printHeap(const char* _phase, double _time, uint32_t _ops, dm::Memory::Heap& _heap)
+{
+    dm::AllocStats stats;
+    memset(&stats, 0, sizeof(stats));
+    _heap.getStats(stats);
+
+    const float fragmentation = (0 == stats.m_heapFree) ? 0.0f : 1.0f - float(double(stats.m_heapLargestFree)/double(stats.m_heapFree));
+    printf("%-10s %10.1f ns/op %10.1f MB used %10.1f MB free %8u free blocks %6.3f fragmentation\n"
+          , _phase
+          , _time*1e9/_ops
+          , double(stats.m_heapUsed)/DM_MEGABYTES(1)
+          , double(stats.m_heapFree)/DM_MEGABYTES(1)
+          , stats.m_heapFreeBlocks
+          , fragmentation
+          );
+}
+
+int main()
+{
+    dm::allocInit();
+
+    uint8_t* mem = (uint8_t*)dm::vmemReserve(HeapMemSize);
+    uint8_t* heapLimit = mem;
+    uint8_t* heapEnd   = mem + HeapMemSize;
+
+    dm::Memory::Heap* heap = ::new (DM_ALLOC(dm::mainAlloc, sizeof(dm::Memory::Heap))) dm::Memory::Heap();
+    heap->init(&heapLimit, &heapEnd, dm::vmemPageSize(), &heapLimit);
+
+    #if DM_HEAP_TLSF_IMPL
+    printf("index: tlsf\n");
+    #elif DM_HEAP_ARRAY_IMPL
+    printf("index: array\n");
+    #else
+    printf("index: list\n");
+    #endif // DM_HEAP_TLSF_IMPL
+
+    uint32_t rand = 0x2545f491u;
+
+    double start = benchNow();
+    for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+    {
+        s_blocks[ii] = heap->alloc(blockSize(rand));
+    }
+    printHeap("fill", benchNow() - start, NumBlocks, *heap);
+
+    start = benchNow();
+    for (uint32_t ii = 0; ii < NumBlocks; ii += 2)
+    {
+        heap->free(s_blocks[ii]);
+        s_blocks[ii] = NULL;
+    }
+    printHeap("fragment", benchNow() - start, NumBlocks/2, *heap);
+
+    start = benchNow();
+    for (uint32_t ii = 0; ii < ChurnOps; ++ii)
+    {
+        const uint32_t idx = benchRand(rand)%NumBlocks;
+        if (NULL != s_blocks[idx])
+        {
+            heap->free(s_blocks[idx]);
+            s_blocks[idx] = NULL;
+        }
+        else
+        {
+            s_blocks[idx] = heap->alloc(blockSize(rand));
+        }
+    }
+    printHeap("churn", benchNow() - start, ChurnOps, *heap);
+
+    start = benchNow();
+    for (uint32_t ii = 0; ii < NumBlocks; ++ii)
+    {
+        if (NULL != s_blocks[ii])
+        {
+            heap->free(s_blocks[ii]);
+        }
+    }
+    printHeap("free", benchNow() - start, NumBlocks, *heap);
+
+    heap->~Heap();
+    DM_FREE(dm::mainAlloc, heap);
+    dm::vmemRelease(mem, HeapMemSize);
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
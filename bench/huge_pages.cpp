@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Random reads over large dm::Arrays on dm::mainAlloc, built with regular pages and again with DM_MEM_HUGE_PAGES
+// (bench_huge_pages_on), see scripts/dmbench.lua. Each read depends on the previous one, so that the time per read
+// is the latency of a cache and TLB miss. The large object threshold is raised above the biggest array, large object
+// mappings do not use huge pages and the arrays would not be in the arena otherwise.
+
+#define DM_MEM_LARGE_OBJECT_THRESHOLD DM_GIGABYTES(1)
+#include "bench.h"
+#include <dm/datastructures/array.h>
+
+enum
+{
+    NumReads = 16*1024*1024,
+};
+
+static const size_t s_sizes[] = { DM_MEGABYTES(64), DM_MEGABYTES(256), DM_MEGABYTES(512) };
+
+int main()
+{
+    dm::allocInit();
+
+    dm::AllocStats stats;
+    memset(&stats, 0, sizeof(stats));
+    dm::allocGetStats(&stats);
+    printf("pages: %s\n", dm::pageModeName(dm::PageMode::Enum(stats.m_arenaPageMode)));
+    printf("%8s %12s %12s\n", "MB", "ns/read", "rss MB");
+
+    uint64_t result = 0;
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_sizes); ++ii)
+    {
+        const uint32_t count = uint32_t(s_sizes[ii]/sizeof(uint64_t));
+
+        dm::Array<uint64_t> values(count, dm::mainAlloc);
+        uint32_t rand = 0x6b43a9b5u;
+        for (uint32_t jj = 0; jj < count; ++jj)
+        {
+            values.add(uint64_t(benchRand(rand))<<32 | benchRand(rand));
+        }
+
+        uint64_t idx = 0;
+        const double start = benchNow();
+        for (uint32_t jj = 0; jj < NumReads; ++jj)
+        {
+            idx = (values[uint32_t(idx%count)] ^ jj)*UINT64_C(0x9e3779b97f4a7c15) >> 16;
+        }
+        const double time = benchNow() - start;
+        result += idx;
+
+        printf("%8u %12.1f %12.1f\n"
+              , uint32_t(s_sizes[ii]/DM_MEGABYTES(1))
+              , time*1e9/NumReads
+              , double(benchRss())/DM_MEGABYTES(1)
+              );
+    }
+
+    printf("(%u)\n", uint32_t(result));
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Two dm::Arrays on dm::stackAlloc growing in turns, so that neither is on top of the stack when it grows.
+// Stack use is compared to the bytes the arrays hold, and the time to the same arrays on dm::mainAlloc.
+
+#include "bench.h"
+#include <dm/datastructures/array.h>
+
+static double fill(bx::ReallocatorI* _alloc, uint32_t _count, uint32_t& _moves)
+{
+    dm::Array<uint32_t> aa(16, _alloc);
+    dm::Array<uint32_t> bb(16, _alloc);
+
+    const uint32_t* lastA = aa.elements();
+    const uint32_t* lastB = bb.elements();
+    _moves = 0;
+
+    const double start = benchNow();
+    for (uint32_t ii = 0; ii < _count; ++ii)
+    {
+        aa.add(ii);
+        bb.add(~ii);
+
+        _moves += (lastA != aa.elements()) + (lastB != bb.elements());
+        lastA = aa.elements();
+        lastB = bb.elements();
+    }
+    return benchNow() - start;
+}
+
+static uint64_t stackUsed()
+{
+    dm::AllocStats stats;
+    dm::allocGetStats(&stats);
+    return stats.m_stacks[0].m_used; // Main thread.
+}
+
+int main()
+{
+    dm::allocInit();
+
+    printf("%10s %12s %8s %14s %14s %12s\n", "elements", "stack ns/add", "moves", "stack used KB", "arrays KB", "main ns/add");
+
+    for (uint32_t count = 1000; count <= 1000000; count *= 10)
+    {
+        uint32_t moves;
+        uint64_t used;
+        double stackTime;
+        {
+            dm::StackAllocScope scope(dm::stackAlloc);
+            const uint64_t before = stackUsed();
+
+            stackTime = fill(dm::stackAlloc, count, moves);
+            used = stackUsed() - before;
+        }
+
+        uint32_t mainMoves;
+        const double mainTime = fill(dm::mainAlloc, count, mainMoves);
+
+        printf("%10u %12.2f %8u %14.1f %14.1f %12.2f\n"
+              , count
+              , stackTime*1e9/(2.0*count)
+              , moves
+              , double(used)/1024.0
+              , 2.0*count*sizeof(uint32_t)/1024.0
+              , mainTime*1e9/(2.0*count)
+              );
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// STL containers churning on 1 to 8 threads, for glibc malloc() against libdmalloc.so. The allocator is not built in,
+// the same binary runs both ways:
+//     ./bench_stl_workload
+//     LD_PRELOAD=/path/to/libdmalloc.so ./bench_stl_workload
+
+#define DM_BENCH_NO_IMPL
+#include "bench.h"
+
+#include <stdlib.h> // getenv()
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum
+{
+    MaxThreads = 8,
+    Rounds     = 20,
+    NumKeys    = 20000,
+};
+
+static void workload(uint32_t _thread, void* /*_userData*/)
+{
+    uint32_t rand = 0x2545f491u + _thread;
+
+    for (uint32_t round = 0; round < Rounds; ++round)
+    {
+        // Node based, strings past the small string buffer.
+        std::map<uint32_t, std::string> names;
+        for (uint32_t ii = 0; ii < NumKeys; ++ii)
+        {
+            names[benchRand(rand)%NumKeys] = std::string(24 + ii%40, char('a' + ii%26));
+        }
+        for (uint32_t ii = 0; ii < NumKeys/2; ++ii)
+        {
+            names.erase(benchRand(rand)%NumKeys);
+        }
+
+        // Buckets plus growing vectors.
+        std::unordered_map<uint32_t, std::vector<uint32_t> > groups;
+        for (uint32_t ii = 0; ii < NumKeys; ++ii)
+        {
+            groups[benchRand(rand)%(NumKeys/16)].push_back(ii);
+        }
+
+        // Concatenation.
+        std::string text;
+        for (uint32_t ii = 0; ii < NumKeys; ++ii)
+        {
+            text += names.empty() ? std::string("-") : names.begin()->second;
+            if (text.size() > DM_KILOBYTES(64))
+            {
+                std::string().swap(text);
+            }
+        }
+
+        // One big vector, reallocated while growing.
+        std::vector<uint64_t> values;
+        for (uint32_t ii = 0; ii < NumKeys*16; ++ii)
+        {
+            values.push_back(ii);
+        }
+    }
+}
+
+int main()
+{
+    const char* preload = getenv("LD_PRELOAD");
+    printf("malloc: %s\n", (NULL != preload && '\0' != preload[0]) ? preload : "default");
+    printf("%8s %12s %12s\n", "threads", "time ms", "rss MB");
+
+    for (uint32_t numThreads = 1; numThreads <= MaxThreads; numThreads *= 2)
+    {
+        const double time = benchRunThreads(numThreads, workload, NULL);
+        printf("%8u %12.1f %12.1f\n", numThreads, time*1e3, double(benchRss())/DM_MEGABYTES(1));
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
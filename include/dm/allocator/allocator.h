@@ -13,20 +13,53 @@
 #include "../misc.h"                        //dm::NoCopyNoAssign
 
 #include "../datastructures/bitarray.h"
+#include "../datastructures/atomicbitarray.h"
 #include "../datastructures/oplist.h"
 
 #define DM_ALLOC   BX_ALLOC
 #define DM_FREE    BX_FREE
 #define DM_REALLOC BX_REALLOC
 
+#if BX_CONFIG_ALLOCATOR_DEBUG
+#   define DM_CALLOC(_allocator, _size) dm::callocZeroed(_allocator, _size, 0, __FILE__, __LINE__)
+#else
+#   define DM_CALLOC(_allocator, _size) dm::callocZeroed(_allocator, _size, 0)
+#endif // BX_CONFIG_ALLOCATOR_DEBUG
+
 namespace dm
 {
+    /// Opaque position in a stack allocator, see StackAllocatorI::getMarker().
+    struct StackMarker
+    {
+        uintptr_t m_pos;
+        uintptr_t m_frame;
+        uint32_t  m_depth;
+        uint32_t  m_overflow;
+    };
+
     struct BX_NO_VTABLE StackAllocatorI : public bx::ReallocatorI
     {
         virtual void push() = 0;
         virtual void pop() = 0;
+
+        /// rewind() releases everything allocated after the marker was taken, including frames pushed since.
+        /// Markers do not need to follow push/pop nesting, but a marker is invalid once its frame is popped.
+        virtual StackMarker getMarker() = 0;
+        virtual void rewind(const StackMarker& _marker) = 0;
+    };
+
+    /// Allocator that hands out zeroed memory. Memory known to be zero already, never used or freshly mapped, is not cleared again.
+    /// Blocks are freed and resized like the ones returned by alloc().
+    struct BX_NO_VTABLE ZeroAllocatorI : public bx::ReallocatorI
+    {
+        virtual void* callocZeroed(size_t _size, size_t _align, const char* _file, uint32_t _line) = 0;
     };
 
+    inline void* callocZeroed(ZeroAllocatorI* _allocator, size_t _size, size_t _align = 0, const char* _file = NULL, uint32_t _line = 0)
+    {
+        return _allocator->callocZeroed(_size, _align, _file, _line);
+    }
+
     inline void push(StackAllocatorI* _stackAllocator)
     {
         _stackAllocator->push();
@@ -37,6 +70,16 @@ namespace dm
         _stackAllocator->pop();
     }
 
+    inline StackMarker getMarker(StackAllocatorI* _stackAllocator)
+    {
+        return _stackAllocator->getMarker();
+    }
+
+    inline void rewind(StackAllocatorI* _stackAllocator, const StackMarker& _marker)
+    {
+        _stackAllocator->rewind(_marker);
+    }
+
     struct StackAllocScope : dm::NoCopyNoAssign
     {
         StackAllocScope(StackAllocatorI* _stackAlloc) : m_stack(_stackAlloc)
@@ -53,12 +96,82 @@ namespace dm
         StackAllocatorI* m_stack;
     };
 
+    /// Sampled dm::mainAlloc statistics of a single call site, see allocProfileSnapshot().
+    /// Counts and bytes are estimates, each sample is weighted by the inverse of the probability that its allocation was sampled.
+    struct AllocSite
+    {
+        const char* m_file;       // NULL for the unknown site.
+        uint32_t    m_line;
+        uint32_t    m_external;   // Samples that were not served from dm memory.
+        int64_t     m_allocCount;
+        int64_t     m_allocBytes;
+        int64_t     m_liveCount;  // Not freed yet.
+        int64_t     m_liveBytes;
+    };
+
+    /// Snapshot of allocator usage, see allocGetStats().
+    /// Small classes and the heap sum up the arena and all segments. Sizes are in bytes.
+    struct AllocStats
+    {
+        enum
+        {
+            MaxSmallClasses = 64,
+            MaxStacks       = 32,
+        };
+
+        struct SmallClass
+        {
+            uint32_t m_size;
+            uint32_t m_max;       // Slots.
+            uint32_t m_used;      // Slots cached by threads count as used.
+            uint32_t m_highWater;
+            uint64_t m_overflow;  // Requests that found the class full and went to the heap.
+        };
+
+        struct Stack
+        {
+            uint64_t m_used;
+            uint64_t m_highWater; // Since the stack was created, or handed to its current thread.
+            uint64_t m_size;
+        };
+
+        SmallClass m_small[MaxSmallClasses];
+        uint32_t   m_numSmallClasses;
+
+        Stack      m_stacks[MaxStacks]; // dm::stackAlloc of the main thread, of other threads, then stacks from allocCreateStack()/allocSplitStack().
+        uint32_t   m_numStacks;         // Stacks past MaxStacks are not reported.
+
+        uint64_t m_heapSize;          // Taken by heap blocks, used or free.
+        uint64_t m_heapUsed;
+        uint64_t m_heapFree;
+        uint64_t m_heapLargestFree;
+        uint32_t m_heapFreeBlocks;
+        float    m_heapFragmentation; // 1 - largestFree/free, 0 when all free space is in one block.
+        uint64_t m_arenaRemaining;    // Between the stack and the heap of the arena.
+        uint32_t m_arenaPageMode;     // dm::PageMode::Enum backing the arena, see DM_MEM_HUGE_PAGES.
+
+        uint64_t m_staticSize;
+        uint64_t m_staticUsed;
+
+        uint32_t m_numSegments;
+        uint32_t m_largeObjects;
+        uint64_t m_largeObjectBytes;
+
+        uint64_t m_externalAlloc; // ::malloc() fallbacks.
+        uint64_t m_externalFree;
+        uint64_t m_externalBytes; // Allocated in total.
+    };
+
+    /// Heap allocation that allocCompact() is allowed to move, its memory is reached through allocPin().
+    struct RelocEntry;
+    typedef RelocEntry* RelocHandle;
+
     extern bx::ReallocatorI* crtAlloc;      // C-runtime allocator.
     extern StackAllocatorI*  crtStackAlloc; // C-runtime stack allocator.
 
     extern bx::ReallocatorI* staticAlloc; // Allocated memory is released on exit.
-    extern StackAllocatorI*  stackAlloc;  // Used for temporary allocations.
-    extern bx::ReallocatorI* mainAlloc;   // Default allocator.
+    extern StackAllocatorI*  stackAlloc;  // Used for temporary allocations. Each thread gets a stack of its own.
+    extern ZeroAllocatorI*   mainAlloc;   // Default allocator.
 
     bool             allocInit();
     bool             allocContains(void* _ptr);
@@ -67,8 +180,29 @@ namespace dm
     StackAllocatorI* allocCreateStack(size_t _size);
     StackAllocatorI* allocSplitStack(size_t _awayfromStackPtr, size_t _preferedSize);
     void             allocFreeStack(StackAllocatorI* _stackAlloc);
+    void             allocThreadShutdown(); // Hands back memory cached by the calling thread and its stack. Automatic on POSIX.
     void             allocPrintStats();
+    void             allocGetStats(AllocStats* _stats); // Walks the heap under its lock, meant to be polled, not called per allocation.
     bool             allocDestroyed();
+
+    // Counterparts of mainAlloc calls with natural alignment, for callers that know their sizes or work with many blocks at once.
+    // Batches bypass the thread cache, small slots go to and from the shared lists. Heaps are locked once per run, other arenas' heaps included.
+    void     allocFreeSized(void* _ptr, size_t _size);                 // '_size' as requested at allocation, it picks the tier to check. Any other pointer is looked up.
+    uint32_t allocBatch(size_t _size, uint32_t _count, void** _ptrs); // Returns the number of blocks allocated, less than '_count' only if memory ran out.
+    void     allocFreeBatch(void** _ptrs, uint32_t _count);           // NULL pointers are skipped.
+
+    // Relocatable allocations. A pointer returned by allocPin() stays valid until the matching allocUnpin().
+    // Containers keep plain pointers to their storage, they are not built on these.
+    RelocHandle allocRelocatable(size_t _size);          // Returns NULL on failure.
+    void        allocFreeRelocatable(RelocHandle _handle); // Expects the handle to be unpinned.
+    void*       allocPin(RelocHandle _handle);           // Pins nest.
+    void        allocUnpin(RelocHandle _handle);
+    size_t      allocCompact(size_t _budget, uint32_t _microseconds = 0); // Slides unpinned blocks over heap gaps until about '_budget' bytes are moved or the time is up (0 for no limit). Returns bytes moved.
+
+    // Snapshot and dump require DM_ALLOC_PROFILE, they return 0 and false otherwise.
+    uint32_t allocProfileSnapshot(AllocSite* _sites, uint32_t _max); // Returns the number of sites written.
+    uint32_t allocProfileDiff(AllocSite* _out, uint32_t _max, const AllocSite* _before, uint32_t _numBefore, const AllocSite* _after, uint32_t _numAfter); // Sites that changed.
+    bool     allocProfileDump(const char* _path); // Sites and live samples, binary.
 }
 
 #endif // DM_ALLOCATOR_H_HEADER_GUARD
@@ -76,13 +210,17 @@ namespace dm
 // Allocator implementation.
 //-----
 
-#ifdef DM_ALLOCATOR_IMPL
+#if defined(DM_ALLOCATOR_IMPL) && !defined(DM_ALLOCATOR_IMPL_GUARD)
+#define DM_ALLOCATOR_IMPL_GUARD
 
 #include "allocator_config.h"
 #include "allocator_p.h"
 
 #include <stdio.h>                      // fprintf
+#include <math.h>                       // log(), exp()
 #include "stack.h"                      // DynamicStack, FreeStack
+#include "vmem.h"                       // dm::vmemReserve(), dm::vmemDecommit()
+#include <new>                          // placement new
 
 #include <emmintrin.h>                  // __m128i
 #if defined(__SSE4_1__)
@@ -95,24 +233,61 @@ namespace dm
 #include <dm/datastructures/objarray.h> // dm::ObjArray
 
 #include <bx/thread.h>                  // bx::Mutex
+#include <bx/os.h>                      // bx::yield()
 #include <bx/uint32_t.h>                // bx::uint32_cntlz
 
+#if BX_PLATFORM_POSIX
+#   include <pthread.h>                 // pthread_key_create()
+#   include <time.h>                    // clock_gettime()
+#endif // BX_PLATFORM_POSIX
+
 namespace dm
 {
     #ifndef DM_ALLOCATOR
     #   define DM_ALLOCATOR 1
     #endif
 
+    /// Monotonic, for the time budget of allocCompact().
+    static inline uint64_t memTimeNs()
+    {
+        #if BX_PLATFORM_WINDOWS
+            LARGE_INTEGER freq, counter;
+            QueryPerformanceFrequency(&freq);
+            QueryPerformanceCounter(&counter);
+            return uint64_t(double(counter.QuadPart)*1e9/double(freq.QuadPart));
+        #elif BX_PLATFORM_POSIX
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return uint64_t(now.tv_sec)*UINT64_C(1000000000) + uint64_t(now.tv_nsec);
+        #else
+            return 0;
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    /// Handle of a relocatable allocation. Handles are small allocations, only the memory they point to moves.
+    struct RelocEntry
+    {
+        static const uint64_t Moving  = UINT64_C(1)<<62; // Being moved by allocCompact(), pins wait.
+        static const uint64_t Freed   = UINT64_C(1)<<63;
+        static const uint64_t PinMask = Moving-1;
+
+        enum
+        {
+            PrefixSize = 2*sizeof(uint64_t), // Points back to the entry, stays in front of the data so that a moved block finds its handle.
+        };
+
+        void* volatile    m_ptr;
+        volatile uint64_t m_state; // Pin count, or one of the flags above.
+    };
+
     #if DM_ALLOCATOR
         struct Memory
         {
             Memory()
             {
-                #if DM_ALLOC_PRINT_STATS
                 m_externalAlloc = 0;
                 m_externalFree  = 0;
                 m_externalSize  = 0;
-                #endif //DM_ALLOC_PRINT_STATS
             }
 
             ///
@@ -145,12 +320,24 @@ namespace dm
                 s_initialized = true;
 
                 const size_t customSize = DM_MEM_SIZE_FUNC();
-                const size_t size = DM_MAX(DM_MEM_MIN_SIZE, customSize);
+                size_t size = DM_MAX(DM_MEM_MIN_SIZE, customSize);
 
                 // Alloc.
-                m_orig = ::malloc(size);
+                m_pageMode = dm::PageMode::Regular;
+                #if DM_MEM_ARENA == DM_MEM_ARENA_VMEM
+                    #if DM_MEM_HUGE_PAGES
+                        m_orig = dm::vmemReserveHuge(size, m_pageMode);
+                    #else
+                        m_orig = dm::vmemReserve(size);
+                    #endif //DM_MEM_HUGE_PAGES
+                    DM_PRINT_MEM_STATS("Init: Reserving %u.%uMB, %s pages - (0x%p)", dm::U_UMB(size), dm::pageModeName(m_pageMode), m_orig);
+                #else
+                    m_orig = DM_ALLOC_EXTERNAL_MALLOC(size);
+                    DM_PRINT_MEM_STATS("Init: Allocating %u.%uMB - (0x%p)", dm::U_UMB(size), m_orig);
+                #endif //DM_MEM_ARENA == DM_MEM_ARENA_VMEM
 
-                DM_PRINT_MEM_STATS("Init: Allocating %u.%uMB - (0x%p)", dm::U_UMB(size), m_orig);
+                // Free spans are decommitted in whole huge pages, splitting them would defeat the purpose.
+                m_pageSize = (dm::PageMode::Regular == m_pageMode) ? dm::vmemPageSize() : size_t(dm::HugePageSize);
 
                 // Align.
                 void*  alignedPtr;
@@ -161,20 +348,43 @@ namespace dm
                 m_memory = alignedPtr;
                 m_size   = alignedSize;
 
-                // Touch every piece of memory, effectively forcing OS to add all memory pages to the process's address space.
-                memset(m_memory, 0, m_size);
+                #if DM_MEM_ARENA == DM_MEM_ARENA_MALLOC
+                    // Touch every piece of memory, effectively forcing OS to add all memory pages to the process's address space.
+                    memset(m_memory, 0, m_size);
+                #endif //DM_MEM_ARENA == DM_MEM_ARENA_MALLOC
 
                 // Init memory regions.
                 void* ptr = m_memory;
                 ptr = m_staticStorage.init(ptr, DM_MEM_STATIC_STORAGE_SIZE);
+                ptr = dm::alignPtrNext(ptr, SegregatedLists::GranuleSize);
                 ptr = m_segregatedLists.init(ptr, SegregatedLists::DataSize);
 
                 void* end = (void*)((uint8_t*)m_memory + m_size);
                 m_stackPtr = (uint8_t*)dm::alignPtrNext(ptr, DM_NATURAL_ALIGNMENT);
                 m_heapEnd  = (uint8_t*)dm::alignPtrPrev(end, DM_NATURAL_ALIGNMENT);
+                m_stackHighWater = m_stackPtr;
+
+                m_stack.init(&m_stackPtr, &m_heapEnd, &m_stackHighWater);
+                m_heap.init(&m_stackPtr, &m_heapEnd, m_pageSize, &m_stackHighWater);
+
+                m_numSegments = 0;
 
-                m_stack.init(&m_stackPtr, &m_heapEnd);
-                m_heap.init(&m_stackPtr, &m_heapEnd);
+                m_largeObjects.init(dm::vmemPageSize());
+
+                #if DM_ALLOC_HEAP_ARENAS > 1
+                m_nextArena = 0;
+                memset((void*)m_arenas, 0, sizeof(m_arenas));
+                #endif //DM_ALLOC_HEAP_ARENAS > 1
+
+                #if (DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS) && BX_PLATFORM_POSIX
+                pthread_key_create(&m_threadExitKey, threadExit);
+                #endif // (DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS) && BX_PLATFORM_POSIX
+
+                #if DM_ALLOC_THREAD_STACKS
+                m_threadStackPool = NULL;
+                m_threadStacks    = NULL;
+                s_mainThread = true;
+                #endif //DM_ALLOC_THREAD_STACKS
 
                 return false; // return value is not important.
             }
@@ -182,14 +392,75 @@ namespace dm
             void printStats()
             {
                 #if DM_ALLOC_PRINT_STATS
+                printf("Arena: %u.%uMB, %s pages\n\n", dm::U_UMB(m_size), dm::pageModeName(m_pageMode));
                 m_staticStorage.printStats();
                 m_stack.printStats();
                 m_segregatedLists.printStats();
                 m_heap.printStats();
-                printf("External: alloc/free %u.%u, total %u.%uMB\n\n", m_externalAlloc, m_externalFree, dm::U_UMB(m_externalSize));
+                printf("Segments: %u / %u, %u.%uMB each\n\n", m_numSegments, DM_MEM_MAX_SEGMENTS, dm::U_UMB(DM_MEM_SEGMENT_SIZE));
+                m_largeObjects.printStats();
+                printf("External: alloc/free %llu.%llu, total %u.%uMB\n\n"
+                      , (unsigned long long)m_externalAlloc, (unsigned long long)m_externalFree, dm::U_UMB(m_externalSize)
+                      );
                 #endif //DM_ALLOC_PRINT_STATS
             }
 
+            /// Expects '_stats' to be zeroed.
+            void getStats(AllocStats& _stats)
+            {
+                BX_STATIC_ASSERT(uint32_t(SegregatedLists::Count) <= uint32_t(AllocStats::MaxSmallClasses), "Raise AllocStats::MaxSmallClasses.");
+
+                _stats.m_numSmallClasses = SegregatedLists::Count;
+                _stats.m_numSegments     = m_numSegments;
+
+                m_segregatedLists.getStats(_stats.m_small);
+                m_heap.getStats(_stats);
+                for (uint32_t ii = 0, end = m_numSegments; ii < end; ++ii)
+                {
+                    m_segments[ii]->m_segregatedLists.getStats(_stats.m_small);
+                    m_segments[ii]->m_heap.getStats(_stats);
+                }
+
+                _stats.m_heapFragmentation = (0 == _stats.m_heapFree)
+                                           ? 0.0f
+                                           : 1.0f - float(double(_stats.m_heapLargestFree)/double(_stats.m_heapFree))
+                                           ;
+                _stats.m_arenaRemaining = sizeBetweenStackAndHeap();
+                _stats.m_arenaPageMode  = m_pageMode;
+
+                _stats.m_staticSize = m_staticStorage.total();
+                _stats.m_staticUsed = m_staticStorage.total() - m_staticStorage.available();
+
+                addStackStats(_stats, m_stack);
+                #if DM_ALLOC_THREAD_STACKS
+                {
+                    bx::LwMutexScope lock(m_threadStackMutex);
+                    for (ThreadStack* threadStack = m_threadStacks; NULL != threadStack; threadStack = threadStack->m_allNext)
+                    {
+                        addStackStats(_stats, threadStack->m_stack);
+                    }
+                }
+                #endif //DM_ALLOC_THREAD_STACKS
+
+                m_largeObjects.getStats(_stats);
+
+                _stats.m_externalAlloc = m_externalAlloc;
+                _stats.m_externalFree  = m_externalFree;
+                _stats.m_externalBytes = m_externalSize;
+            }
+
+            template <typename StackTy>
+            static void addStackStats(AllocStats& _stats, StackTy& _stack)
+            {
+                if (_stats.m_numStacks < AllocStats::MaxStacks)
+                {
+                    AllocStats::Stack& stack = _stats.m_stacks[_stats.m_numStacks++];
+                    stack.m_used      = _stack.getUsage();
+                    stack.m_highWater = _stack.getPeakUsage();
+                    stack.m_size      = _stack.total();
+                }
+            }
+
             void destroy()
             {
                 // Do not call free, let it stay until the very end of execution. OS will clean it up.
@@ -215,12 +486,10 @@ namespace dm
 
             void* externalAlloc(size_t _size)
             {
-                void* ptr = ::malloc(_size);
+                void* ptr = DM_ALLOC_EXTERNAL_MALLOC(_size);
 
-                #if DM_ALLOC_PRINT_STATS
-                m_externalAlloc++;
-                m_externalSize += _size;
-                #endif //DM_ALLOC_PRINT_STATS
+                dm::atomicFetchAndAdd64(&m_externalAlloc, 1);
+                dm::atomicFetchAndAdd64(&m_externalSize, _size);
 
                 DM_PRINT_EXT("EXTERNAL ALLOC: %u.%uMB - (0x%p)", dm::U_UMB(_size), ptr);
 
@@ -239,7 +508,17 @@ namespace dm
                 // Try small alloc.
                 if (_size <= SegregatedLists::BiggestSize)
                 {
-                    ptr = m_segregatedLists.alloc(_size);
+                    ptr = smallAlloc(_size);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
+                }
+
+                // Try large object alloc.
+                if (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD)
+                {
+                    ptr = m_largeObjects.alloc(_size);
                     if (NULL != ptr)
                     {
                         return ptr;
@@ -247,1497 +526,3921 @@ namespace dm
                 }
 
                 // Try heap alloc.
-                ptr = m_heap.alloc(_size);
+                Heap& heap = threadHeap();
+                ptr = heap.alloc(_size);
                 if (NULL != ptr)
                 {
                     return ptr;
                 }
 
-                // External alloc.
-                ptr = externalAlloc(_size);
-
-                return ptr;
-            }
+                if (&heap != &m_heap)
+                {
+                    ptr = m_heap.alloc(_size);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
+                }
 
-            void* stackAlloc(size_t _size)
-            {
-                void* ptr = m_stack.alloc(_size);
+                // Try segments.
+                ptr = segmentAlloc(_size);
                 if (NULL != ptr)
                 {
                     return ptr;
                 }
 
-                return this->alloc(_size);
-            }
+                // External alloc.
+                ptr = externalAlloc(_size);
 
-            void* staticAlloc(size_t _size)
-            {
-                return m_staticStorage.alloc(_size);
+                return ptr;
             }
 
-            bool contains(void* _ptr)
+            /// '_align' must be a power of two. Aligned pointers are freed and resized like any other.
+            void* alignedAlloc(size_t _size, size_t _align)
             {
-                return (m_memory <= _ptr && _ptr <= ((uint8_t*)m_memory + m_size));
-            }
+                if (_align <= DM_NATURAL_ALIGNMENT)
+                {
+                    return this->alloc(_size);
+                }
 
-            // Realloc.
-            //-----
+                if (0 == _size)
+                {
+                    return NULL;
+                }
 
-            void* realloc(void* _ptr, size_t _size)
-            {
-                if (NULL == _ptr)
+                void* ptr;
+
+                // Try small alloc, from a class with aligned slots.
+                const uint32_t smallSize = m_segregatedLists.getAlignedSize(_size, _align);
+                if (0 != smallSize)
                 {
-                    return this->alloc(_size);
+                    ptr = smallAlloc(smallSize);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
                 }
 
-                // Handle heap allocation.
-                const bool fromHeap = m_heap.contains(_ptr);
-                if (fromHeap)
+                // Try large object alloc.
+                if (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD)
                 {
-                    void* ptr = m_heap.realloc(_ptr, _size);
+                    ptr = m_largeObjects.alloc(_size, _align);
                     if (NULL != ptr)
                     {
                         return ptr;
                     }
                 }
 
-                // Handle external pointer.
-                if (!this->contains(_ptr))
+                // Try heap alloc.
+                Heap& heap = threadHeap();
+                ptr = heap.alignedAlloc(_size, _align);
+                if (NULL != ptr)
                 {
-                    void* ptr = ::realloc(_ptr, _size);
-                    DM_PRINT_EXT("EXTERNAL REALLOC: %u.%uMB - (0x%p - 0x%p)", dm::U_UMB(_size), _ptr, ptr);
                     return ptr;
                 }
 
-                // Make a new allocation of requested size.
-                void* newPtr = this->alloc(_size);
-                if (NULL == newPtr)
+                if (&heap != &m_heap)
                 {
-                    newPtr = externalAlloc(_size);
-                    if (NULL == newPtr)
+                    ptr = m_heap.alignedAlloc(_size, _align);
+                    if (NULL != ptr)
                     {
-                        return NULL;
+                        return ptr;
                     }
                 }
 
-                // Get size of current allocation.
-                size_t currSize = 0;
-                if (fromHeap)
-                {
-                    currSize = m_heap.getSize(_ptr);
-                }
-                else if (m_segregatedLists.contains(_ptr))
-                {
-                    currSize = m_segregatedLists.getSize(_ptr);
-                }
-                else if (fromStackRegion(_ptr))
+                // Try segments.
+                ptr = segmentAlloc(_size, _align);
+                if (NULL != ptr)
                 {
-                    currSize = DynamicStack::readSize(_ptr);
+                    return ptr;
                 }
 
-                CS_CHECK(0 != currSize, "Memory::realloc | Error getting allocation size.");
-
-                // Copy memory.
-                const size_t minSize = dm::min(currSize, _size);
-                memcpy(newPtr, _ptr, minSize);
-
-                // Free original pointer.
-                this->free(_ptr);
+                // External allocations are only naturally aligned, use a mapping of its own instead.
+                ptr = m_largeObjects.alloc(_size, _align);
 
-                return newPtr;
+                return ptr;
             }
 
-            void* stackRealloc(void* _ptr, size_t _size)
+            /// Returns zeroed memory. Clearing is skipped where the memory provably was never written:
+            /// small slots never freed before, heap space beyond the heap and stack high water marks and fresh mappings.
+            void* callocZeroed(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
             {
-                // Handle stack pointer.
-                void* ptr = m_stack.realloc(_ptr, _size);
-                if (NULL != ptr)
+                if (_align > DM_NATURAL_ALIGNMENT)
                 {
+                    void* ptr = this->alignedAlloc(_size, _align);
+                    if (NULL != ptr)
+                    {
+                        memset(ptr, 0, _size);
+                    }
+
                     return ptr;
                 }
 
-                // Pointer not from stack.
-                return this->realloc(_ptr, _size);
-            }
-
-            void* staticRealloc(void* _ptr, size_t _size)
-            {
-                return m_staticStorage.realloc(_ptr, _size);
-            }
+                if (0 == _size)
+                {
+                    return NULL;
+                }
 
-            // Free.
-            //-----
+                void* ptr;
 
-            void free(void* _ptr)
-            {
-                if (this->contains(_ptr))
+                // Try small alloc.
+                if (_size <= SegregatedLists::BiggestSize)
                 {
-                    if (m_segregatedLists.contains(_ptr))
+                    ptr = smallAlloc(_size);
+                    if (NULL != ptr)
                     {
-                        m_segregatedLists.free(_ptr);
+                        if (m_segregatedLists.isDirty(ptr))
+                        {
+                            memset(ptr, 0, _size);
+                        }
+
+                        return ptr;
                     }
-                    else if (m_heap.contains(_ptr))
+                }
+
+                // Try large object alloc, mappings are always fresh.
+                if (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD)
+                {
+                    ptr = m_largeObjects.alloc(_size);
+                    if (NULL != ptr)
                     {
-                        m_heap.free(_ptr);
+                        return ptr;
                     }
                 }
-                else // external pointer
+
+                // Try heap alloc.
+                Heap& heap = threadHeap();
+                ptr = heap.callocZeroed(_size);
+                if (NULL != ptr)
                 {
-                    DM_PRINT_EXT("~EXTERNAL FREE: (0x%p)", _ptr);
+                    return ptr;
+                }
 
-                    #if DM_ALLOC_PRINT_STATS
-                    m_externalFree++;
-                    #endif //DM_ALLOC_PRINT_STATS
+                if (&heap != &m_heap)
+                {
+                    ptr = m_heap.callocZeroed(_size);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
+                }
 
-                    ::free(_ptr);
+                // Try segments.
+                ptr = segmentAlloc(_size, DM_NATURAL_ALIGNMENT, true);
+                if (NULL != ptr)
+                {
+                    return ptr;
                 }
-            }
 
-            // Stack.
-            //-----
+                // External alloc.
+                ptr = externalAlloc(_size);
+                if (NULL != ptr)
+                {
+                    memset(ptr, 0, _size);
+                }
 
-            bool fromStackRegion(void* _ptr)
+                return ptr;
+            }
+
+            void* stackAlloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
             {
-                return (m_stack.begin() <= _ptr && _ptr < m_heapEnd);
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    void* ptr = stack->alloc(_size, _align);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
+                }
+
+                return this->alignedAlloc(_size, _align);
             }
 
-            void stackPush()
+            void* staticAlloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
             {
-                m_stack.push();
+                return m_staticStorage.alloc(_size, _align);
             }
 
-            void stackPop()
+            bool arenaContains(void* _ptr) const
             {
-                m_stack.pop();
+                return (m_memory <= _ptr && _ptr <= ((uint8_t*)m_memory + m_size));
             }
 
-            uint8_t* stackAdvance(size_t _size)
+            bool contains(void* _ptr)
             {
-                m_stackPtr += _size;
-                return m_stackPtr;
+                return arenaContains(_ptr) || NULL != findSegment(_ptr) || m_largeObjects.contains(_ptr);
             }
 
-            // Other.
+            // Segments.
             //-----
 
-            size_t getSize(void* _ptr)
+            struct Heap;
+            struct Segment;
+
+            Segment* findSegment(void* _ptr) const
             {
-                if (m_segregatedLists.contains(_ptr))
+                // Segments are aligned to their size.
+                const void* base = dm::alignPtrPrev(_ptr, DM_MEM_SEGMENT_SIZE);
+                for (uint32_t ii = 0, end = m_numSegments; ii < end; ++ii)
                 {
-                    return m_segregatedLists.getSize(_ptr);
-                }
-                else if (m_heap.contains(_ptr))
-                {
-                    return m_heap.getSize(_ptr);
+                    if (base == m_segments[ii])
+                    {
+                        return m_segments[ii];
+                    }
                 }
-                else if (m_stack.contains(_ptr))
+
+                return NULL;
+            }
+
+            /// Expects m_segmentsMutex to be locked.
+            Segment* mapSegment()
+            {
+                if (m_numSegments >= DM_MEM_MAX_SEGMENTS)
                 {
-                    return m_stack.getSize(_ptr);
+                    return NULL;
                 }
-                else // external pointer
+
+                void* mem = dm::vmemReserveAligned(DM_MEM_SEGMENT_SIZE, DM_MEM_SEGMENT_SIZE);
+                if (NULL == mem)
                 {
-                    return 0;
+                    return NULL;
                 }
-            }
 
-            size_t remainingStaticMemory() const
-            {
-                return m_staticStorage.available();
-            }
+                Segment* segment = ::new (mem) Segment();
+                segment->init(mem, DM_MEM_SEGMENT_SIZE, dm::vmemPageSize());
 
-            size_t sizeBetweenStackAndHeap()
-            {
-                return m_heap.getRemainingSpace();
+                DM_PRINT_MEM_STATS("Segment #%u: Reserving %u.%uMB - (0x%p)", m_numSegments, dm::U_UMB(DM_MEM_SEGMENT_SIZE), mem);
+
+                // Publish after the segment is ready, lookups are not locked.
+                m_segments[m_numSegments] = segment;
+                dm::atomicFetchAndAdd32(&m_numSegments, 1);
+
+                return segment;
             }
 
-            struct StaticStorage
+            bool createSegment(uint32_t _numSegments)
             {
-                void* init(void* _mem, size_t _size)
-                {
-                    void*  alignedPtr;
-                    size_t alignedSize;
-                    dm::alignPtrAndSize(alignedPtr, alignedSize, _mem, _size, DM_NATURAL_ALIGNMENT);
+                bx::LwMutexScope lock(m_segmentsMutex);
 
-                    DM_PRINT_MEM_STATS("Init: Using %u.%uMB for static storage.", dm::U_UMB(alignedSize));
+                // Another thread has already added one.
+                if (_numSegments != m_numSegments)
+                {
+                    return true;
+                }
 
-                    m_ptr   = (uint8_t*)alignedPtr;
-                    m_last  = m_ptr;
-                    m_avail = alignedSize;
+                return (NULL != mapSegment());
+            }
 
-                    #if DM_ALLOC_PRINT_STATS
-                    m_size = alignedSize;
-                    #endif //DM_ALLOC_PRINT_STATS
+            // Heap arenas.
+            //-----
 
-                    return (uint8_t*)alignedPtr + alignedSize;
+            #if DM_ALLOC_HEAP_ARENAS > 1
+            /// Threads are assigned to heap arenas in round-robin order on their first heap allocation.
+            /// Arena 0 is the main heap, other arenas are heaps of dedicated segments.
+            Heap& threadHeap()
+            {
+                uint32_t arena = s_threadArena;
+                if (0 == arena)
+                {
+                    arena = dm::atomicFetchAndAdd32(&m_nextArena, 1)%DM_ALLOC_HEAP_ARENAS + 1;
+                    s_threadArena = arena;
                 }
 
-                void* alloc(size_t _size)
+                const uint32_t idx = arena-1;
+                if (0 == idx)
                 {
-                    const size_t size = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
+                    return m_heap;
+                }
 
-                    CS_CHECK(size <= m_avail
-                            , "StaticStorage::alloc | No more space left. %u.%uKB - %u.%uKB (requested/left)"
-                            , dm::U_UKB(size)
-                            , dm::U_UKB(m_avail)
-                            );
+                Segment* segment = m_arenas[idx];
+                if (NULL == segment)
+                {
+                    bx::LwMutexScope lock(m_segmentsMutex);
 
-                    if (size > m_avail)
+                    segment = m_arenas[idx];
+                    if (NULL == segment)
                     {
-                        return NULL;
+                        segment = mapSegment();
+                        if (NULL == segment)
+                        {
+                            // Out of segments, stay on the main heap.
+                            s_threadArena = 1;
+                            return m_heap;
+                        }
+
+                        m_arenas[idx] = segment;
                     }
+                }
 
-                    m_last = m_ptr;
+                return segment->m_heap;
+            }
 
-                    m_ptr   += size;
-                    m_avail -= size;
+            bool ownsHeap(const Heap& _heap) const
+            {
+                const uint32_t idx = (0 == s_threadArena) ? 0 : s_threadArena-1;
+                const Heap* own = (0 == idx || NULL == m_arenas[idx]) ? &m_heap : &m_arenas[idx]->m_heap;
+                return (own == &_heap);
+            }
+            #else
+            Heap& threadHeap()
+            {
+                return m_heap;
+            }
 
-                    DM_PRINT_STATIC("Static alloc: %u.%uMB, Remaining: %u.%uMB - (0x%p)", dm::U_UMB(_size), dm::U_UMB(m_avail), m_last);
+            bool ownsHeap(const Heap& /*_heap*/) const
+            {
+                return true;
+            }
+            #endif //DM_ALLOC_HEAP_ARENAS > 1
 
-                    return m_last;
+            /// Frees from other arenas are deferred, so that the heap mutex is mostly taken by its own threads.
+            void heapFree(Heap& _heap, void* _ptr)
+            {
+                if (ownsHeap(_heap))
+                {
+                    _heap.free(_ptr);
+                }
+                else
+                {
+                    _heap.remoteFree(_ptr);
                 }
+            }
 
-                void* realloc(void* _ptr, size_t _size)
+            void* segmentAlloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT, bool _zeroed = false)
+            {
+                if (_size + _align > Segment::heapSize())
                 {
-                    if (NULL == _ptr)
+                    return NULL;
+                }
+
+                for (;;)
+                {
+                    const uint32_t numSegments = m_numSegments;
+                    for (uint32_t ii = 0; ii < numSegments; ++ii)
                     {
-                        return alloc(_size);
+                        void* ptr = m_segments[ii]->alloc(_size, _align, _zeroed);
+                        if (NULL != ptr)
+                        {
+                            return ptr;
+                        }
                     }
 
-                    CS_CHECK(_ptr == m_last, "StaticStorage::realloc | Invalid realloc call! Realloc can be called only for the last alloc.");
-
-                    if (_ptr == m_last)
+                    if (!createSegment(numSegments))
                     {
-                        const size_t currSize = m_ptr - m_last;
-                        const size_t newSize = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
-                        const int32_t diff = int32_t(newSize - currSize);
+                        return NULL;
+                    }
+                }
+            }
 
-                        CS_CHECK(diff <= int32_t(m_avail)
-                               , "StaticStorage::realloc | No more space left. %u.%uKB - %u.%uKB (requested/left)"
-                               , dm::U_UKB(diff)
-                               , dm::U_UKB(m_avail)
-                               );
+            // Realloc.
+            //-----
 
-                        if (diff > int32_t(m_avail))
-                        {
-                            return NULL;
-                        }
+            void* realloc(void* _ptr, size_t _size)
+            {
+                if (NULL == _ptr)
+                {
+                    return this->alloc(_size);
+                }
 
-                        m_ptr   += diff;
-                        m_avail -= diff;
+                Segment* segment = NULL;
+                if (!this->arenaContains(_ptr))
+                {
+                    segment = findSegment(_ptr);
 
-                        DM_PRINT_STATIC("Static realloc: %u.%uMB, Remaining: %u.%uMB - (0x%p)", dm::U_UMB(newSize), dm::U_UMB(m_avail), m_last);
+                    // Handle large object.
+                    if (NULL == segment && m_largeObjects.contains(_ptr))
+                    {
+                        return largeRealloc(_ptr, _size);
+                    }
 
-                        return m_last;
+                    // Handle external pointer.
+                    if (NULL == segment)
+                    {
+                        void* ptr = DM_ALLOC_EXTERNAL_REALLOC(_ptr, _size);
+                        DM_PRINT_EXT("EXTERNAL REALLOC: %u.%uMB - (0x%p - 0x%p)", dm::U_UMB(_size), _ptr, ptr);
+                        return ptr;
                     }
+                }
 
-                    return NULL;
+                // Handle heap allocation.
+                Heap& heap = (NULL == segment) ? m_heap : segment->m_heap;
+                const bool fromHeap = heap.contains(_ptr);
+                if (fromHeap)
+                {
+                    void* ptr = heap.realloc(_ptr, _size);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
                 }
 
-                size_t available() const
+                // Make a new allocation of requested size.
+                void* newPtr = this->alloc(_size);
+                if (NULL == newPtr)
                 {
-                    return m_avail;
+                    newPtr = externalAlloc(_size);
+                    if (NULL == newPtr)
+                    {
+                        return NULL;
+                    }
                 }
 
-                #if DM_ALLOC_PRINT_STATS
-                void printStats()
+                // Get size of current allocation.
+                size_t currSize = 0;
+                if (fromHeap)
                 {
-                    const size_t diff = m_size-m_avail;
-                    printf("Static storage:\n");
-                    printf("\tTotal: %u.%03lluMB, Used: %u.%03lluMB, Remaining: %u.%03lluMB\n\n"
-                          , dm::U_UMB(m_size), dm::U_UMB(diff), dm::U_UMB(m_avail));
+                    currSize = heap.getSize(_ptr);
+                }
+                else if (NULL != segment)
+                {
+                    currSize = segment->m_segregatedLists.getSize(_ptr);
+                }
+                else if (m_segregatedLists.contains(_ptr))
+                {
+                    currSize = m_segregatedLists.getSize(_ptr);
+                }
+                else if (fromStackRegion(_ptr))
+                {
+                    currSize = DynamicStack::readSize(_ptr);
                 }
-                #endif //DM_ALLOC_PRINT_STATS
 
-                uint8_t* m_ptr;
-                uint8_t* m_last;
-                size_t m_avail;
+                CS_CHECK(0 != currSize, "Memory::realloc | Error getting allocation size.");
 
-                #if DM_ALLOC_PRINT_STATS
-                size_t m_size;
-                #endif //DM_ALLOC_PRINT_STATS
-            };
+                // Copy memory.
+                const size_t minSize = dm::min(currSize, _size);
+                memcpy(newPtr, _ptr, minSize);
 
-            struct SegregatedLists
-            {
-                enum
-                {
-                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
-                        Size ## _idx = _size, Num ## _idx = _num,
-                    #include "allocator_config.h"
+                // Free original pointer.
+                this->free(_ptr);
 
-                    DataSize = 0
-                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
-                        + Size ## _idx * Num ## _idx
-                    #include "allocator_config.h"
-                        , // DataSize.
+                return newPtr;
+            }
 
-                    ListsSize = 0
-                    #define DM_SIZE_FOR(_num) ((_num>>6)+1)*sizeof(uint64_t)
-                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
-                        + DM_SIZE_FOR(Num ## _idx)
-                    #include "allocator_config.h"
-                    #undef DM_SIZE_FOR
-                        , // ListsSize.
+            void* alignedRealloc(void* _ptr, size_t _size, size_t _align)
+            {
+                if (_align <= DM_NATURAL_ALIGNMENT)
+                {
+                    return this->realloc(_ptr, _size);
+                }
 
-                    #define DM_SMALL_ALLOC_CONFIG
-                    #include "allocator_config.h"
-                    Count       = DM_SMALL_ALLOC_COUNT,
-                    BiggestSize = DM_SMALL_ALLOC_BIGGEST_SIZE,
-                    Steps = dm::Log<2,BiggestSize>::value + 1,
+                if (NULL == _ptr)
+                {
+                    return this->alignedAlloc(_size, _align);
+                }
 
-                };
+                // Heap blocks resized in place and remapped large objects keep their alignment.
+                // Small slots are never resized in place, they go straight to a new aligned allocation.
+                Segment* segment = findSegment(_ptr);
+                const bool fromSmall = m_segregatedLists.contains(_ptr) || (NULL != segment && segment->m_segregatedLists.contains(_ptr));
 
-                SegregatedLists()
+                void*  ptr      = _ptr;
+                size_t currSize = 0;
+                if (fromSmall)
                 {
-                    #if DM_ALLOC_PRINT_STATS
-                    for (uint8_t ii = Count; ii--; )
+                    currSize = this->getSize(_ptr);
+                }
+                else
+                {
+                    ptr = this->realloc(_ptr, _size);
+                    if (NULL == ptr || 0 == (uintptr_t(ptr) & (_align-1)))
                     {
-                        m_overflow[ii] = 0;
+                        return ptr;
                     }
-                    #endif //DM_ALLOC_PRINT_STATS
+
+                    currSize = _size;
                 }
 
-                void* init(void* _mem, size_t _size)
+                void* newPtr = this->alignedAlloc(_size, _align);
+                if (NULL == newPtr)
                 {
-                    void*  alignedPtr;
-                    size_t alignedSize;
-                    dm::alignPtrAndSize(alignedPtr, alignedSize, _mem, _size, DM_NATURAL_ALIGNMENT);
+                    return NULL;
+                }
 
-                    m_mem = alignedPtr;
-                    m_totalSize = alignedSize;
-                    CS_CHECK(m_totalSize == DataSize
-                           , "SegregatedLists::init | Not enough data allocated %u.%uMB / %u.%uMB"
-                           , dm::U_UMB(m_totalSize), dm::U_UMB(DataSize)
-                           );
-                    DM_PRINT_MEM_STATS("Init: Using %u.%uMB for segregated lists", dm::U_UMB(DataSize));
+                memcpy(newPtr, ptr, dm::min(currSize, _size));
+                this->free(ptr);
 
-                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
-                        m_sizes[_idx] = Size ## _idx;
-                    #include "allocator_config.h"
-                    CS_CHECK(m_sizes[Count-1] == BiggestSize, "Error! 'BiggestSize' is not well defined");
+                return newPtr;
+            }
+
+            void* stackRealloc(void* _ptr, size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+            {
+                // Handle stack pointer.
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    void* ptr = stack->realloc(_ptr, _size, _align);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
 
-                    for (uint8_t idx = 0, ii = 0; ii < Steps; ++ii)
+                    // Stack is full, move to the heap.
+                    if (scratchStackOwns(stack, _ptr))
                     {
-                        const uint32_t currSize = 1<<ii;
-                        if (currSize > m_sizes[idx])
+                        void* newPtr = this->alignedAlloc(_size, _align);
+                        if (NULL != newPtr)
                         {
-                            ++idx;
-                            CS_CHECK(idx < Count, "Error! 'Steps' is not well defined.");
+                            memcpy(newPtr, _ptr, dm::min(DynamicStack::readSize(_ptr), _size));
                         }
 
-                        m_powToIdx[ii] = idx;
+                        return newPtr;
                     }
+                }
 
-                    void* ptr = m_allocsData;
-                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
-                        ptr = m_allocs[_idx].init(Num ## _idx, ptr);
-                    #include "allocator_config.h"
+                // Pointer not from stack.
+                return this->alignedRealloc(_ptr, _size, _align);
+            }
 
-                    m_begin[0] = (uint8_t*)m_mem;
-                    for (uint8_t ii = 1; ii < Count; ++ii)
-                    {
-                        const uint8_t prev = ii-1;
-                        m_begin[ii] = (uint8_t*)m_begin[prev] + m_sizes[prev]*m_allocs[prev].max();
-                    }
+            void* staticRealloc(void* _ptr, size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+            {
+                return m_staticStorage.realloc(_ptr, _size, _align);
+            }
 
-                    return (uint8_t*)alignedPtr + alignedSize;
-                }
+            // Free.
+            //-----
 
-                void* alloc(size_t _size)
+            void free(void* _ptr)
+            {
+                if (this->arenaContains(_ptr))
                 {
-                    CS_CHECK(_size <= BiggestSize, "Requested size is bigger than the largest supported size!");
-
-                    // Get list index.
-                    const uint32_t sizePow2 = bx::uint32_nextpow2(uint32_t(_size));
-                    const uint32_t pow = bx::uint32_cnttz(sizePow2);
-                    CS_CHECK(pow < Steps, "Error! Sizes are probably not well defined.");
-                    const uint8_t idx = m_powToIdx[pow];
-
-                    // Allocate if there is an empty slot.
-                    m_mutex.lock();
-                    const uint32_t slot = m_allocs[idx].setAny();
-                    m_mutex.unlock();
-                    if (slot != m_allocs[idx].max())
+                    if (m_segregatedLists.contains(_ptr))
                     {
-                        uint8_t* mem = (uint8_t*)m_begin[idx] + slot*m_sizes[idx];
-
-                        CS_CHECK(mem < (uint8_t*)m_mem + m_totalSize, "SegregatedLists::alloc | Allocating outside of bounds!");
-
-                        DM_PRINT_SMALL("Small alloc: %u.%uKB -> slot %u (%u.%uKB) - %u/%u - (0x%p)"
-                                      , dm::U_UKB(_size)
-                                      , slot
-                                      , dm::U_UKB(m_sizes[idx])
-                                      , m_allocs[idx].count(), m_allocs[idx].max()
-                                      , mem
-                                      );
-
-                        #if DM_ALLOC_PRINT_STATS
-                        m_mutex.lock();
-                        m_totalUsed[idx]++;
-                        m_mutex.unlock();
-                        #endif //DM_ALLOC_PRINT_STATS
-
-                        return mem;
+                        smallFree(_ptr);
                     }
-                    else
+                    else if (m_heap.contains(_ptr))
+                    {
+                        heapFree(m_heap, _ptr);
+                    }
+                }
+                else if (Segment* segment = findSegment(_ptr))
+                {
+                    if (segment->m_segregatedLists.contains(_ptr))
+                    {
+                        segment->m_segregatedLists.free(_ptr);
+                    }
+                    else if (segment->m_heap.contains(_ptr))
                     {
-                        DM_PRINT_SMALL("Small alloc: All small lists of %uB are full. Requested %zuB.", m_sizes[idx], _size);
+                        heapFree(segment->m_heap, _ptr);
+                    }
+                }
+                else if (m_largeObjects.free(_ptr))
+                {
+                    return;
+                }
+                else // external pointer
+                {
+                    DM_PRINT_EXT("~EXTERNAL FREE: (0x%p)", _ptr);
 
-                        #if DM_ALLOC_PRINT_STATS
-                        m_mutex.lock();
-                        m_overflow[idx]++;
-                        m_mutex.unlock();
-                        #endif //DM_ALLOC_PRINT_STATS
+                    dm::atomicFetchAndAdd64(&m_externalFree, 1);
 
-                        return NULL;
-                    }
+                    DM_ALLOC_EXTERNAL_FREE(_ptr);
                 }
+            }
 
-                void free(void* _ptr)
+            /// '_size' picks the tier that alloc() tries first for it, only that tier is checked: the small class,
+            /// the heap of the calling thread's arena, or the large objects. Blocks that were served by another
+            /// tier, or heap blocks of other arenas, take the lookup of free().
+            void freeSized(void* _ptr, size_t _size)
+            {
+                if (_size <= SegregatedLists::BiggestSize)
                 {
-                    for (uint8_t ii = Count; ii--; )
+                    if (m_segregatedLists.contains(_ptr))
                     {
-                        if (_ptr >= m_begin[ii])
-                        {
-                            const size_t   dist = (uint8_t*)_ptr - (uint8_t*)m_begin[ii];
-                            const uint32_t slot = uint32_t(dist/m_sizes[ii]);
-                            m_mutex.lock();
-                            m_allocs[ii].unset(slot);
-                            m_mutex.unlock();
-
-                            DM_PRINT_SMALL("~Small free: slot %u %u.%uKB %d/%d - (0x%p)"
-                                          , slot
-                                          , dm::U_UKB(m_sizes[ii])
-                                          , m_allocs[ii].count(), m_allocs[ii].max()
-                                          , _ptr
-                                          );
+                        DM_CHECK(_size <= m_segregatedLists.getSize(_ptr), "Memory::freeSized | Size %zu does not match the slot of %zu.", _size, m_segregatedLists.getSize(_ptr));
 
-                            return;
-                        }
+                        smallFree(_ptr);
+                        return;
                     }
                 }
-
-                size_t getSize(void* _ptr) const
+                else if (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD)
                 {
-                    for (uint8_t ii = Count; ii--; )
+                    if (m_largeObjects.free(_ptr))
                     {
-                        if (_ptr >= m_begin[ii])
-                        {
-                            return m_sizes[ii];
-                        }
+                        return;
+                    }
+                }
+                else
+                {
+                    Heap& heap = threadHeap();
+                    if (heap.contains(_ptr))
+                    {
+                        heap.free(_ptr);
+                        return;
                     }
+                }
 
+                this->free(_ptr);
+            }
+
+            // Batch.
+            //-----
+
+            /// Small slots are taken from the shared lists directly, the thread cache is neither used nor refilled.
+            /// Heap blocks are taken under a single lock of the thread heap.
+            /// Returns the number of pointers written to '_ptrs', less than '_count' only if memory ran out.
+            uint32_t allocBatch(size_t _size, uint32_t _count, void** _ptrs)
+            {
+                if (0 == _size)
+                {
                     return 0;
                 }
 
-                bool contains(void* _ptr) const
+                uint32_t num = 0;
+                if (_size <= SegregatedLists::BiggestSize)
                 {
-                    return (m_mem <= _ptr && _ptr < ((uint8_t*)m_mem + m_totalSize));
+                    const uint8_t idx = m_segregatedLists.getIdx(_size);
+                    num = m_segregatedLists.allocBatch(idx, _ptrs, _count);
                 }
 
-                #if DM_ALLOC_PRINT_STATS
-                void printStats()
+                const bool large = (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD);
+                if (!large && num != _count)
                 {
-                    printf("Small allocations:\n");
+                    num += threadHeap().allocBatch(_size, _count-num, &_ptrs[num]);
+                }
 
-                    uint32_t totalSize = 0;
-                    for (uint8_t ii = 0; ii < Count; ++ii)
+                // Whatever is left goes the regular way.
+                for (; num < _count; ++num)
+                {
+                    _ptrs[num] = this->alloc(_size);
+                    if (NULL == _ptrs[num])
                     {
-                        const uint32_t used = m_allocs[ii].count();
-                        const uint32_t max  = m_allocs[ii].max();
-                        totalSize += m_sizes[ii]*used;
-                        printf("\t#%2d: Size: %5llu.%03lluKB, Used: %3d / %5d, Overflow: %d, Total: %d\n"
-                              , ii, dm::U_UKB(m_sizes[ii]), used, max, m_overflow[ii], m_totalUsed[ii]);
+                        break;
                     }
-                    printf("\t-------------------------\n");
-                    printf("\tTotal: %u.%uMB / %u.%uMB\n\n", dm::U_UMB(totalSize), dm::U_UMB(DataSize));
                 }
-                #endif //DM_ALLOC_PRINT_STATS
-
-            private:
-                void*       m_mem;
-                size_t      m_totalSize;
-                bx::LwMutex m_mutex;
-                // Lists:
-                uint32_t     m_sizes[Count];
-                void*        m_begin[Count];
-                uint8_t      m_powToIdx[Steps];
-                dm::BitArray m_allocs[Count];
-                uint8_t      m_allocsData[ListsSize];
 
-                #if DM_ALLOC_PRINT_STATS
-                uint32_t m_totalUsed[Count];
-                uint32_t m_overflow[Count];
-                #endif //DM_ALLOC_PRINT_STATS
-            };
+                return num;
+            }
 
-            struct Heap
+            /// Pointers can come from anywhere, NULL ones are skipped. Consecutive slots of the same class
+            /// and consecutive blocks of the same heap are freed together. Slots go to the shared lists, not to the
+            /// thread cache, and heap blocks of other arenas are freed under their lock rather than deferred.
+            void freeBatch(void** _ptrs, uint32_t _count)
             {
-                #define DM_HEAP_ARRAY_IMPL (DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY == DM_ALLOCATOR_UNDERLYING_IMPL)
+                for (uint32_t ii = 0, end; ii < _count; ii = end)
+                {
+                    void* ptr = _ptrs[ii];
+                    end = ii+1;
 
-                #if DM_HEAP_ARRAY_IMPL
-                #   define DM_UsedMask    0x8000000000000000UL
-                #   define DM_UsedShift   63UL
-                #   define DM_SizeMask    0x7fffffffffffffffUL
-                #   define DM_SizeShift   0UL
-                #else
-                #   define DM_UsedMask    0x8000000000000000UL
-                #   define DM_UsedShift   63UL
-                #   define DM_HandleMask  0x7fff000000000000UL
-                #   define DM_HandleShift 48UL
-                #   define DM_HandleMax   (DM_HandleMask>>DM_HandleShift)
-                #   define DM_GroupMask   0x0000fff000000000UL
-                #   define DM_GroupShift  36UL
-                #   define DM_GroupMax    (DM_GroupMask>>DM_GroupShift)
-                #   define DM_SizeMask    0x0000000fffffffffUL
-                #   define DM_SizeShift   0UL
-                #endif //DM_HEAP_ARRAY_IMPL
+                    if (NULL == ptr)
+                    {
+                        continue;
+                    }
 
-                enum
-                {
-                    HeaderSize = sizeof(uint64_t),
-                    FooterSize = sizeof(uint64_t),
-                    HeaderFooterSize = HeaderSize+FooterSize,
+                    if (m_segregatedLists.contains(ptr))
+                    {
+                        const uint8_t idx = m_segregatedLists.getIdxOf(ptr);
+                        while (end < _count
+                            && m_segregatedLists.contains(_ptrs[end])
+                            && idx == m_segregatedLists.getIdxOf(_ptrs[end]))
+                        {
+                            ++end;
+                        }
 
-                    MinimalSlotSize = HeaderFooterSize + 64,
+                        m_segregatedLists.freeBatch(idx, &_ptrs[ii], end-ii);
+                        continue;
+                    }
 
-                    #define DM_ALLOC_CONFIG
-                    #include "allocator_config.h"
-                    MaxBigFreeSlots   = DM_ALLOC_MAX_BIG_FREE_SLOTS,
-                    NumRegions        = DM_ALLOC_NUM_REGIONS,
-                    NumSubRegions     = DM_ALLOC_NUM_SUB_REGIONS,
-                    SmallestRegion    = DM_ALLOC_SMALLEST_REGION,
-                    BiggestRegion     = DM_ALLOC_SMALLEST_REGION<<(DM_ALLOC_NUM_REGIONS-1),
-                    SmallestRegionPwr = dm::Log<2,(SmallestRegion>>20ul)>::value,
+                    Heap* heap = NULL;
+                    if (m_heap.contains(ptr))
+                    {
+                        heap = &m_heap;
+                    }
+                    else if (Segment* segment = findSegment(ptr))
+                    {
+                        heap = segment->m_heap.contains(ptr) ? &segment->m_heap : NULL;
+                    }
 
-                    #define DM_ALLOC_DEF(_regionIdx, _num) \
-                        NumSlots ## _regionIdx = _num,
-                    #include "allocator_config.h"
+                    // Unlike heapFree(), blocks of other arenas are not deferred, the lock is taken once for the whole run.
+                    if (NULL != heap)
+                    {
+                        while (end < _count && NULL != _ptrs[end] && heap->contains(_ptrs[end]))
+                        {
+                            ++end;
+                        }
 
-                    #if !DM_HEAP_ARRAY_IMPL
-                        TotalSlotCount = (0
-                        #define DM_ALLOC_DEF(_regionIdx, _num) \
-                            + NumSlots ## _regionIdx
-                        #include "allocator_config.h"
-                            ) * NumSubRegions, // TotalSlotCount.
-                    #endif //!DM_HEAP_ARRAY_IMPL
-                };
+                        heap->freeBatch(&_ptrs[ii], end-ii);
+                        continue;
+                    }
 
-                void init(uint8_t** _stackPtr, uint8_t** _heap)
-                {
-                    m_begin    = *_heap;
-                    m_end      = _heap;
-                    m_stackPtr = _stackPtr;
+                    this->free(ptr);
+                }
+            }
 
-                    *m_end -= 2*sizeof(uint64_t);
-                    uint64_t* terminator = (uint64_t*)*m_end;
-                    terminator[0] = UINT64_MAX;
-                    terminator[1] = UINT64_MAX;
+            // Stack.
+            //-----
 
-                    m_bigFreeSlotsCount = 0;
-                    memset(m_bigFreeSlotsSize, 0, sizeof(m_bigFreeSlotsSize));
-                    memset(m_bigFreeSlotsPtr,  0, sizeof(m_bigFreeSlotsPtr));
+            bool fromStackRegion(void* _ptr)
+            {
+                return (m_stack.begin() <= _ptr && _ptr < m_heapEnd);
+            }
 
-                    memset(m_regionInfo, 0xff, sizeof(m_regionInfo));
-                    memset(m_freeSlotsCount, 0, sizeof(m_freeSlotsCount));
+            /// Stack used by dm::stackAlloc on the calling thread. NULL if it could not be created.
+            DynamicStack* scratchStack()
+            {
+                #if DM_ALLOC_THREAD_STACKS
+                if (!s_mainThread)
+                {
+                    return threadStack();
+                }
+                #endif //DM_ALLOC_THREAD_STACKS
 
-                    #if DM_HEAP_ARRAY_IMPL
-                        #define DM_ALLOC_DEF(_regionIdx, _num) \
-                            m_freeSlotsMax[_regionIdx] = NumSlots ## _regionIdx;
-                        #include "allocator_config.h"
+                return &m_stack;
+            }
 
-                        // Free slots size.
+            /// Pointers are owned as long as they are in the stack memory, popped or not.
+            static bool scratchStackOwns(const DynamicStack* _stack, void* _ptr)
+            {
+                return (NULL != _stack && _stack->begin() <= _ptr && _ptr < _stack->end());
+            }
 
-                        memset(m_freeSlotsSize,  0, sizeof(m_freeSlotsSize));
+            void stackPush()
+            {
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    stack->push();
+                }
+            }
 
-                        #define DM_ALLOC_DEF(_regionIdx, _num) \
-                            memset(m_freeSlotsSize ## _regionIdx, 0, sizeof(m_freeSlotsSize ## _regionIdx));
-                        #include "allocator_config.h"
+            void stackPop()
+            {
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    stack->pop();
+                }
+            }
 
-                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                        \
-                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                           \
-                            {                                                                                         \
-                                m_freeSlotsSize[_regionIdx*NumSubRegions+ii] = m_freeSlotsSize ## _regionIdx[ii]; \
-                            }
-                        #include "allocator_config.h"
+            dm::StackMarker stackGetMarker()
+            {
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    return stack->getMarker();
+                }
 
-                        // Free slots ptr.
+                dm::StackMarker marker;
+                memset(&marker, 0, sizeof(marker));
+                return marker;
+            }
 
-                        memset(m_freeSlotsPtr,   0, sizeof(m_freeSlotsPtr));
+            void stackRewind(const dm::StackMarker& _marker)
+            {
+                DynamicStack* stack = scratchStack();
+                if (NULL != stack)
+                {
+                    stack->rewind(_marker);
+                }
+            }
 
-                        #define DM_ALLOC_DEF(_regionIdx, _num) \
-                            memset(m_freeSlotsPtr ## _regionIdx, 0, sizeof(m_freeSlotsPtr ## _regionIdx));
-                        #include "allocator_config.h"
+            void stackFree(void* _ptr)
+            {
+                // Stack memory is released by stackPop().
+                if (!scratchStackOwns(scratchStack(), _ptr))
+                {
+                    this->free(_ptr);
+                }
+            }
 
-                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                      \
-                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                         \
-                            {                                                                                       \
-                                m_freeSlotsPtr[_regionIdx*NumSubRegions+ii] = m_freeSlotsPtr ## _regionIdx[ii]; \
-                            }
-                        #include "allocator_config.h"
-                    #else
-                        void* ptr = (void*)m_freeSlotsData;
-                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                    \
-                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                       \
-                            {                                                                                     \
-                                ptr = m_freeSlots[_regionIdx*NumSubRegions+ii].init(NumSlots ## _regionIdx, ptr); \
-                            }
-                        #include "allocator_config.h"
-                    #endif //DM_HEAP_ARRAY_IMPL
+            #if DM_ALLOC_THREAD_STACKS
+            /// Scratch stack of a thread other than the one that called init(), that one uses m_stack.
+            /// Placed at the beginning of its own mapping, followed by the stack memory.
+            struct ThreadStack
+            {
+                DynamicStack m_stack;
+                ThreadStack* m_next;    // Pool link.
+                ThreadStack* m_allNext; // All mapped stacks, they are never unmapped.
+            };
+
+            static size_t threadStackHeaderSize()
+            {
+                return dm::alignSizeNext(sizeof(ThreadStack), DM_NATURAL_ALIGNMENT);
+            }
+
+            DynamicStack* threadStack()
+            {
+                if (NULL != s_threadStack)
+                {
+                    return &s_threadStack->m_stack;
                 }
 
-                uint16_t getRegion(uint16_t _slotGroup)
+                // Nothing would hand the stack back, stackAlloc() falls back to the heap.
+                if (s_threadExited)
                 {
-                    return _slotGroup/NumSubRegions;
+                    return NULL;
                 }
 
-                uint16_t nextSlotGroup(uint16_t _slotGroup)
+                ThreadStack* threadStack;
+                bool mapped = false;
                 {
-                    const uint16_t region = getRegion(_slotGroup);
+                    bx::LwMutexScope lock(m_threadStackMutex);
 
-                    const uint16_t incr = _slotGroup+1;
-                    const uint16_t end  = region*NumSubRegions + NumSubRegions;
-                    if (incr < end)
+                    threadStack = m_threadStackPool;
+                    if (NULL != threadStack)
                     {
-                        return incr;
+                        m_threadStackPool = threadStack->m_next;
                     }
-                    else
+                }
+
+                if (NULL == threadStack)
+                {
+                    void* mem = dm::vmemReserve(DM_ALLOC_THREAD_STACK_SIZE);
+                    if (NULL == mem)
                     {
-                        const uint16_t nextRegion = m_regionInfo[region].m_next;
-                        if (UINT16_MAX == nextRegion)
+                        return NULL;
+                    }
+
+                    threadStack = ::new (mem) ThreadStack();
+                    mapped = true;
+
+                    DM_PRINT_STACK("Thread stack: Reserving %u.%uMB - (0x%p)", dm::U_UMB(DM_ALLOC_THREAD_STACK_SIZE), mem);
+                }
+
+                {
+                    // Locked, getStats() reads stacks of other threads.
+                    bx::LwMutexScope lock(m_threadStackMutex);
+
+                    if (mapped)
+                    {
+                        threadStack->m_allNext = m_threadStacks;
+                        m_threadStacks = threadStack;
+                    }
+
+                    // The stack takes over its pointers, see DynamicStack::setInternal().
+                    uint8_t* begin = (uint8_t*)threadStack + threadStackHeaderSize();
+                    uint8_t* end   = (uint8_t*)threadStack + DM_ALLOC_THREAD_STACK_SIZE;
+                    threadStack->m_stack.init(&begin, &end);
+                    threadStack->m_stack.setInternal(end);
+                }
+
+                registerThread();
+                s_threadStack = threadStack;
+
+                return &threadStack->m_stack;
+            }
+
+            void releaseThreadStack()
+            {
+                ThreadStack* threadStack = s_threadStack;
+                if (NULL == threadStack)
+                {
+                    return;
+                }
+
+                s_threadStack = NULL;
+
+                bx::LwMutexScope lock(m_threadStackMutex);
+                threadStack->m_next = m_threadStackPool;
+                m_threadStackPool   = threadStack;
+            }
+            #else
+            void releaseThreadStack()
+            {
+            }
+            #endif //DM_ALLOC_THREAD_STACKS
+
+            uint8_t* stackAdvance(size_t _size)
+            {
+                m_stackPtr += _size;
+                m_stackHighWater = dm::max(m_stackHighWater, m_stackPtr);
+                return m_stackPtr;
+            }
+
+            // Relocatable.
+            //-----
+
+            RelocEntry* relocAlloc(size_t _size)
+            {
+                RelocEntry* entry = (RelocEntry*)this->alloc(sizeof(RelocEntry));
+                if (NULL == entry)
+                {
+                    entry = (RelocEntry*)externalAlloc(sizeof(RelocEntry));
+                    if (NULL == entry)
+                    {
+                        return NULL;
+                    }
+                }
+                entry->m_state = 0;
+
+                // Only the arena heap is compacted, large objects are remapped instead.
+                // Allocations made elsewhere keep the same layout and never move.
+                const bool large = (0 != DM_MEM_LARGE_OBJECT_THRESHOLD && _size >= DM_MEM_LARGE_OBJECT_THRESHOLD);
+                if (large || NULL == m_heap.allocRelocatable(_size, entry))
+                {
+                    const size_t size = _size + RelocEntry::PrefixSize;
+                    uint8_t* ptr = (uint8_t*)this->alloc(size);
+                    if (NULL == ptr)
+                    {
+                        ptr = (uint8_t*)externalAlloc(size);
+                        if (NULL == ptr)
+                        {
+                            this->free(entry);
+                            return NULL;
+                        }
+                    }
+
+                    *(RelocEntry**)ptr = entry;
+                    entry->m_ptr = ptr + RelocEntry::PrefixSize;
+                }
+
+                return entry;
+            }
+
+            void relocFree(RelocEntry* _entry)
+            {
+                // Blocks the entry from being moved, then waits for a move in progress.
+                const uint64_t state = dm::atomicFetchAndOr64(&_entry->m_state, RelocEntry::Freed);
+                DM_CHECK(0 == (state&(RelocEntry::Freed|RelocEntry::PinMask)), "Memory::relocFree | Handle is pinned or freed twice (0x%p).", _entry);
+                BX_UNUSED(state);
+
+                while (0 != (_entry->m_state&RelocEntry::Moving))
+                {
+                    bx::yield();
+                }
+
+                // Blocks of the arena heap never take the remote free path, compact() reads the link at their
+                // beginning under m_mutex, a deferred free would overwrite it. Once free() returns the block is
+                // gone, only then the entry it links to is freed.
+                uint8_t* ptr = (uint8_t*)_entry->m_ptr - RelocEntry::PrefixSize;
+                if (m_heap.contains(ptr))
+                {
+                    m_heap.free(ptr);
+                }
+                else
+                {
+                    this->free(ptr);
+                }
+
+                this->free(_entry);
+            }
+
+            size_t relocCompact(size_t _budget, uint32_t _microseconds)
+            {
+                const uint64_t deadline = (0 == _microseconds) ? 0 : memTimeNs() + uint64_t(_microseconds)*1000;
+                return m_heap.compact(_budget, deadline);
+            }
+
+            // Other.
+            //-----
+
+            size_t getSize(void* _ptr)
+            {
+                if (m_segregatedLists.contains(_ptr))
+                {
+                    return m_segregatedLists.getSize(_ptr);
+                }
+                else if (m_heap.contains(_ptr))
+                {
+                    return m_heap.getSize(_ptr);
+                }
+                else if (m_stack.contains(_ptr))
+                {
+                    return m_stack.getSize(_ptr);
+                }
+                else if (Segment* segment = findSegment(_ptr))
+                {
+                    return segment->getSize(_ptr);
+                }
+                else // large object or external pointer
+                {
+                    return m_largeObjects.getSize(_ptr);
+                }
+            }
+
+            size_t remainingStaticMemory() const
+            {
+                return m_staticStorage.available();
+            }
+
+            size_t sizeBetweenStackAndHeap()
+            {
+                return m_heap.getRemainingSpace();
+            }
+
+            struct StaticStorage
+            {
+                void* init(void* _mem, size_t _size)
+                {
+                    void*  alignedPtr;
+                    size_t alignedSize;
+                    dm::alignPtrAndSize(alignedPtr, alignedSize, _mem, _size, DM_NATURAL_ALIGNMENT);
+
+                    DM_PRINT_MEM_STATS("Init: Using %u.%uMB for static storage.", dm::U_UMB(alignedSize));
+
+                    m_ptr   = (uint8_t*)alignedPtr;
+                    m_last  = m_ptr;
+                    m_avail = alignedSize;
+                    m_size  = alignedSize;
+
+                    return (uint8_t*)alignedPtr + alignedSize;
+                }
+
+                void* alloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+                {
+                    // Padding in front of the allocation is wasted.
+                    const size_t pad  = (_align > DM_NATURAL_ALIGNMENT) ? (uint8_t*)dm::alignPtrNext(m_ptr, _align) - m_ptr : 0;
+                    const size_t size = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT) + pad;
+
+                    CS_CHECK(size <= m_avail
+                            , "StaticStorage::alloc | No more space left. %u.%uKB - %u.%uKB (requested/left)"
+                            , dm::U_UKB(size)
+                            , dm::U_UKB(m_avail)
+                            );
+
+                    if (size > m_avail)
+                    {
+                        return NULL;
+                    }
+
+                    m_last = m_ptr + pad;
+
+                    m_ptr   += size;
+                    m_avail -= size;
+
+                    DM_PRINT_STATIC("Static alloc: %u.%uMB, Remaining: %u.%uMB - (0x%p)", dm::U_UMB(_size), dm::U_UMB(m_avail), m_last);
+
+                    return m_last;
+                }
+
+                void* realloc(void* _ptr, size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+                {
+                    if (NULL == _ptr)
+                    {
+                        return alloc(_size, _align);
+                    }
+
+                    CS_CHECK(_ptr == m_last, "StaticStorage::realloc | Invalid realloc call! Realloc can be called only for the last alloc.");
+
+                    if (_ptr == m_last)
+                    {
+                        const size_t currSize = m_ptr - m_last;
+                        const size_t newSize = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
+                        const int32_t diff = int32_t(newSize - currSize);
+
+                        CS_CHECK(diff <= int32_t(m_avail)
+                               , "StaticStorage::realloc | No more space left. %u.%uKB - %u.%uKB (requested/left)"
+                               , dm::U_UKB(diff)
+                               , dm::U_UKB(m_avail)
+                               );
+
+                        if (diff > int32_t(m_avail))
+                        {
+                            return NULL;
+                        }
+
+                        m_ptr   += diff;
+                        m_avail -= diff;
+
+                        DM_PRINT_STATIC("Static realloc: %u.%uMB, Remaining: %u.%uMB - (0x%p)", dm::U_UMB(newSize), dm::U_UMB(m_avail), m_last);
+
+                        return m_last;
+                    }
+
+                    return NULL;
+                }
+
+                size_t available() const
+                {
+                    return m_avail;
+                }
+
+                size_t total() const
+                {
+                    return m_size;
+                }
+
+                #if DM_ALLOC_PRINT_STATS
+                void printStats()
+                {
+                    const size_t diff = m_size-m_avail;
+                    printf("Static storage:\n");
+                    printf("\tTotal: %u.%03lluMB, Used: %u.%03lluMB, Remaining: %u.%03lluMB\n\n"
+                          , dm::U_UMB(m_size), dm::U_UMB(diff), dm::U_UMB(m_avail));
+                }
+                #endif //DM_ALLOC_PRINT_STATS
+
+                uint8_t* m_ptr;
+                uint8_t* m_last;
+                size_t m_avail;
+                size_t m_size;
+            };
+
+            struct SegregatedLists
+            {
+                enum
+                {
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        Size ## _idx = _size, Num ## _idx = _num,
+                    #include "allocator_config.h"
+
+                    // Each class occupies a region aligned to a granule, so that the owning class of a pointer
+                    // is found by a single shift of its offset and a table lookup. See getIdxOf().
+                    GranuleShift = 16,
+                    GranuleSize  = 1<<GranuleShift,
+                    GranuleMask  = GranuleSize-1,
+
+                    DataSize = 0
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        + ((Size ## _idx * Num ## _idx + GranuleMask) & ~GranuleMask)
+                    #include "allocator_config.h"
+                        , // DataSize.
+
+                    NumGranules = DataSize>>GranuleShift,
+
+                    ListsSize = 0
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        + dm::AtomicBitArraySize<Num ## _idx>::value
+                    #include "allocator_config.h"
+                        , // ListsSize.
+
+                    DirtyWords = 0
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        + (Num ## _idx + 63)/64
+                    #include "allocator_config.h"
+                        , // DirtyWords.
+
+                    Count = 0
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        + 1
+                    #include "allocator_config.h"
+                        , // Count.
+
+                    // Sizes are increasing, this evaluates to the last one.
+                    BiggestSize = 0
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        * 0 + Size ## _idx
+                    #include "allocator_config.h"
+                        , // BiggestSize.
+
+                    // Requested sizes are binned with quarter power-of-two spacing, see getBin().
+                    BiggestPwr = dm::Log<2,BiggestSize-1>::value,
+                    NumBins    = 4 + (BiggestPwr-6)*4 + (((BiggestSize-1)>>(BiggestPwr-2))&3) + 1,
+                };
+
+                static const uint32_t s_sizes[Count];
+
+                SegregatedLists()
+                {
+                    #if DM_ALLOC_PRINT_STATS
+                    for (uint8_t ii = Count; ii--; )
+                    {
+                        m_totalUsed[ii] = 0;
+                        m_numRequests[ii] = 0;
+                        m_requestedSize[ii] = 0;
+                    }
+                    #endif //DM_ALLOC_PRINT_STATS
+                }
+
+                void* init(void* _mem, size_t _size)
+                {
+                    void*  alignedPtr;
+                    size_t alignedSize;
+                    dm::alignPtrAndSize(alignedPtr, alignedSize, _mem, _size, GranuleSize);
+
+                    m_mem = alignedPtr;
+                    m_totalSize = alignedSize;
+                    CS_CHECK(m_totalSize == DataSize
+                           , "SegregatedLists::init | Not enough data allocated %u.%uMB / %u.%uMB"
+                           , dm::U_UMB(m_totalSize), dm::U_UMB(DataSize)
+                           );
+                    DM_PRINT_MEM_STATS("Init: Using %u.%uMB for segregated lists", dm::U_UMB(DataSize));
+
+                    CS_CHECK(s_sizes[Count-1] == BiggestSize, "Error! 'BiggestSize' is not well defined");
+
+                    // Map each size bin to the smallest class that can hold the biggest size in the bin.
+                    for (uint8_t idx = 0, bin = 0; bin < NumBins; ++bin)
+                    {
+                        while (s_sizes[idx] < getBinSize(bin))
+                        {
+                            ++idx;
+                            CS_CHECK(idx < Count, "Error! Sizes are probably not well defined.");
+                        }
+
+                        m_binToIdx[bin] = idx;
+                    }
+
+                    void* ptr = m_allocsData;
+                    #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                        ptr = m_allocs[_idx].init(Num ## _idx, ptr);
+                    #include "allocator_config.h"
+
+                    uint8_t* begin = (uint8_t*)m_mem;
+                    for (uint8_t ii = 0; ii < Count; ++ii)
+                    {
+                        const size_t regionSize = dm::alignSizeNext(size_t(s_sizes[ii])*m_allocs[ii].max(), GranuleSize);
+
+                        m_begin[ii] = begin;
+                        CS_CHECK(0 == (s_sizes[ii]&15), "Error! Sizes are expected to be multiples of 16.");
+                        m_reciprocal[ii] = ((UINT64_C(1)<<32) + (s_sizes[ii]>>4) - 1)/(s_sizes[ii]>>4);
+                        memset(&m_granuleToIdx[(begin-(uint8_t*)m_mem)>>GranuleShift], ii, regionSize>>GranuleShift);
+
+                        begin += regionSize;
+                    }
+
+                    for (uint8_t ii = 0; ii < Count; ++ii)
+                    {
+                        const uint32_t num = DM_ALLOC_THREAD_CACHE_BYTES/s_sizes[ii];
+                        m_cacheMax[ii] = dm::min(num, uint32_t(DM_ALLOC_THREAD_CACHE_SIZE));
+                    }
+
+                    memset((void*)m_used,      0, sizeof(m_used));
+                    memset((void*)m_highWater, 0, sizeof(m_highWater));
+                    memset((void*)m_overflow,  0, sizeof(m_overflow));
+
+                    #if DM_MEM_TRACK_ZEROED
+                    memset((void*)m_dirty, 0, sizeof(m_dirty));
+                    for (uint32_t ii = 0, word = 0; ii < Count; ++ii)
+                    {
+                        m_dirtyBegin[ii] = word;
+                        word += (m_allocs[ii].max() + 63)/64;
+                    }
+                    #endif //DM_MEM_TRACK_ZEROED
+
+                    return (uint8_t*)alignedPtr + alignedSize;
+                }
+
+                /// Maps a requested size to a bin, four bins per power of two:
+                ///   (  0,  64] -> 16 byte steps, bins 0-3.
+                ///   ( 64, 128] -> 16 byte steps, bins 4-7.
+                ///   (128, 256] -> 32 byte steps, bins 8-11.
+                ///   ...
+                static inline uint32_t getBin(uint32_t _size)
+                {
+                    const uint32_t val = _size-1;
+                    if (val < 64)
+                    {
+                        return val>>4;
+                    }
+
+                    const uint32_t pwr = dm::log2floor(val);
+                    const uint32_t quarter = (val>>(pwr-2))&3;
+                    return 4 + (pwr-6)*4 + quarter;
+                }
+
+                /// Biggest size that falls into '_bin'.
+                static inline uint32_t getBinSize(uint32_t _bin)
+                {
+                    if (_bin < 4)
+                    {
+                        return (_bin+1)<<4;
+                    }
+
+                    const uint32_t pwr = (_bin-4)/4 + 6;
+                    const uint32_t quarter = (_bin-4)&3;
+                    return (5+quarter)<<(pwr-2);
+                }
+
+                uint8_t getIdx(size_t _size) const
+                {
+                    CS_CHECK(_size <= BiggestSize, "Requested size is bigger than the largest supported size!");
+
+                    return m_binToIdx[getBin(uint32_t(_size))];
+                }
+
+                /// Smallest class size that fits '_size' and has all of its slots aligned to '_align'.
+                /// Regions begin at granule boundaries, so slots of a class are aligned to the biggest power of two dividing its size.
+                /// Returns 0 if there is no such class.
+                uint32_t getAlignedSize(size_t _size, size_t _align) const
+                {
+                    if (_size > BiggestSize || _align > GranuleSize)
+                    {
+                        return 0;
+                    }
+
+                    for (uint8_t idx = getIdx(_size); idx < Count; ++idx)
+                    {
+                        if (0 == (s_sizes[idx] & (_align-1)))
+                        {
+                            return s_sizes[idx];
+                        }
+                    }
+
+                    return 0;
+                }
+
+                uint8_t getIdxOf(void* _ptr) const
+                {
+                    const size_t offset = (uint8_t*)_ptr - (uint8_t*)m_mem;
+                    return m_granuleToIdx[offset>>GranuleShift];
+                }
+
+                uint32_t getSlot(uint8_t _idx, void* _ptr) const
+                {
+                    // Division by multiplication with a rounded up reciprocal, see init().
+                    // Both operands are scaled down by 16, which keeps it exact for regions below 4GB.
+                    const uint64_t dist = uint64_t((uint8_t*)_ptr - (uint8_t*)m_begin[_idx]);
+                    return uint32_t(((dist>>4)*m_reciprocal[_idx])>>32);
+                }
+
+                /// Number of slots of class '_idx' a single thread is allowed to keep cached.
+                uint32_t getCacheMax(uint8_t _idx) const
+                {
+                    return m_cacheMax[_idx];
+                }
+
+                /// Takes up to '_count' slots from class '_idx'. Returns the number of slots taken.
+                uint32_t allocBatch(uint8_t _idx, void** _ptrs, uint32_t _count)
+                {
+                    uint32_t num = 0;
+                    for (; num < _count; ++num)
+                    {
+                        const uint32_t slot = m_allocs[_idx].setAny();
+                        if (slot == m_allocs[_idx].max())
+                        {
+                            break;
+                        }
+
+                        _ptrs[num] = (uint8_t*)m_begin[_idx] + slot*s_sizes[_idx];
+                    }
+
+                    trackUsed(_idx, int32_t(num));
+                    if (num != _count)
+                    {
+                        dm::atomicFetchAndAdd64(&m_overflow[_idx], 1);
+                    }
+
+                    #if DM_ALLOC_PRINT_STATS
+                    dm::atomicFetchAndAdd32(&m_totalUsed[_idx], num);
+                    #endif //DM_ALLOC_PRINT_STATS
+
+                    DM_PRINT_SMALL("Small alloc batch: %u/%u slots of %u.%uKB - %u/%u"
+                                  , num, _count
+                                  , dm::U_UKB(s_sizes[_idx])
+                                  , m_allocs[_idx].count(), m_allocs[_idx].max()
+                                  );
+
+                    return num;
+                }
+
+                /// Returns '_count' slots of class '_idx'.
+                void freeBatch(uint8_t _idx, void** _ptrs, uint32_t _count)
+                {
+                    for (uint32_t ii = 0; ii < _count; ++ii)
+                    {
+                        const uint32_t slot = getSlot(_idx, _ptrs[ii]);
+                        markDirty(_idx, slot);
+                        m_allocs[_idx].unset(slot);
+                    }
+                    trackUsed(_idx, -int32_t(_count));
+
+                    DM_PRINT_SMALL("~Small free batch: %u slots of %u.%uKB - %u/%u"
+                                  , _count
+                                  , dm::U_UKB(s_sizes[_idx])
+                                  , m_allocs[_idx].count(), m_allocs[_idx].max()
+                                  );
+                }
+
+                void* alloc(size_t _size)
+                {
+                    const uint8_t idx = getIdx(_size);
+
+                    // Allocate if there is an empty slot.
+                    const uint32_t slot = m_allocs[idx].setAny();
+                    if (slot != m_allocs[idx].max())
+                    {
+                        uint8_t* mem = (uint8_t*)m_begin[idx] + slot*s_sizes[idx];
+
+                        CS_CHECK(mem < (uint8_t*)m_mem + m_totalSize, "SegregatedLists::alloc | Allocating outside of bounds!");
+
+                        DM_PRINT_SMALL("Small alloc: %u.%uKB -> slot %u (%u.%uKB) - %u/%u - (0x%p)"
+                                      , dm::U_UKB(_size)
+                                      , slot
+                                      , dm::U_UKB(s_sizes[idx])
+                                      , m_allocs[idx].count(), m_allocs[idx].max()
+                                      , mem
+                                      );
+
+                        trackUsed(idx, 1);
+
+                        #if DM_ALLOC_PRINT_STATS
+                        dm::atomicFetchAndAdd32(&m_totalUsed[idx], 1);
+                        trackRequest(idx, _size);
+                        #endif //DM_ALLOC_PRINT_STATS
+
+                        return mem;
+                    }
+                    else
+                    {
+                        DM_PRINT_SMALL("Small alloc: All small lists of %uB are full. Requested %zuB.", s_sizes[idx], _size);
+
+                        dm::atomicFetchAndAdd64(&m_overflow[idx], 1);
+
+                        return NULL;
+                    }
+                }
+
+                void free(void* _ptr)
+                {
+                    const uint8_t  idx  = getIdxOf(_ptr);
+                    const uint32_t slot = getSlot(idx, _ptr);
+                    markDirty(idx, slot);
+                    m_allocs[idx].unset(slot);
+                    trackUsed(idx, -1);
+
+                    DM_PRINT_SMALL("~Small free: slot %u %u.%uKB %d/%d - (0x%p)"
+                                  , slot
+                                  , dm::U_UKB(s_sizes[idx])
+                                  , m_allocs[idx].count(), m_allocs[idx].max()
+                                  , _ptr
+                                  );
+                }
+
+                size_t getSize(void* _ptr) const
+                {
+                    return s_sizes[getIdxOf(_ptr)];
+                }
+
+                bool contains(void* _ptr) const
+                {
+                    return (m_mem <= _ptr && _ptr < ((uint8_t*)m_mem + m_totalSize));
+                }
+
+                /// A slot is dirty once it was freed, slots that were never handed out are still zero.
+                /// Marked before the slot is released, so that whoever takes it next sees the mark.
+                void markDirty(uint8_t _idx, uint32_t _slot)
+                {
+                    #if DM_MEM_TRACK_ZEROED
+                        volatile uint64_t* word = &m_dirty[m_dirtyBegin[_idx] + (_slot>>6)];
+                        const uint64_t bit = UINT64_C(1)<<(_slot&63);
+                        if (0 == (*word & bit))
+                        {
+                            dm::atomicFetchAndOr64(word, bit);
+                        }
+                    #else
+                        BX_UNUSED(_idx, _slot);
+                    #endif //DM_MEM_TRACK_ZEROED
+                }
+
+                bool isDirty(void* _ptr) const
+                {
+                    #if DM_MEM_TRACK_ZEROED
+                        const uint8_t  idx  = getIdxOf(_ptr);
+                        const uint32_t slot = getSlot(idx, _ptr);
+                        return 0 != (m_dirty[m_dirtyBegin[idx] + (slot>>6)] & (UINT64_C(1)<<(slot&63)));
+                    #else
+                        BX_UNUSED(_ptr);
+                        return true;
+                    #endif //DM_MEM_TRACK_ZEROED
+                }
+
+                /// Adds up to '_classes', so that lists of all segments can be summed.
+                void getStats(AllocStats::SmallClass* _classes) const
+                {
+                    for (uint8_t ii = 0; ii < Count; ++ii)
+                    {
+                        AllocStats::SmallClass& sc = _classes[ii];
+                        sc.m_size       = s_sizes[ii];
+                        sc.m_max       += m_allocs[ii].max();
+                        sc.m_used      += m_used[ii];
+                        sc.m_highWater += m_highWater[ii];
+                        sc.m_overflow  += m_overflow[ii];
+                    }
+                }
+
+                #if DM_ALLOC_PRINT_STATS
+                void trackRequest(uint8_t _idx, size_t _size)
+                {
+                    dm::atomicFetchAndAdd64(&m_numRequests[_idx], 1);
+                    dm::atomicFetchAndAdd64(&m_requestedSize[_idx], _size);
+                }
+
+                void printStats()
+                {
+                    printf("Small allocations:\n");
+
+                    uint32_t totalSize = 0;
+                    uint64_t totalRequested = 0;
+                    uint64_t totalGranted = 0;
+                    for (uint8_t ii = 0; ii < Count; ++ii)
+                    {
+                        const uint32_t used = m_allocs[ii].count();
+                        const uint32_t max  = m_allocs[ii].max();
+                        totalSize += s_sizes[ii]*used;
+                        printf("\t#%2d: Size: %5llu.%03lluKB, Used: %3d / %5d, High water: %5d, Overflow: %llu, Total: %d\n"
+                              , ii, dm::U_UKB(s_sizes[ii]), used, max, m_highWater[ii], (unsigned long long)m_overflow[ii], m_totalUsed[ii]);
+
+                        totalRequested += m_requestedSize[ii];
+                        totalGranted   += m_numRequests[ii]*s_sizes[ii];
+                    }
+                    printf("\t-------------------------\n");
+                    printf("\tTotal: %u.%uMB / %u.%uMB\n\n", dm::U_UMB(totalSize), dm::U_UMB(DataSize));
+
+                    // Internal fragmentation, measured over all allocations made so far.
+                    printf("Small allocations fragmentation:\n");
+                    for (uint8_t ii = 0; ii < Count; ++ii)
+                    {
+                        const uint64_t num = m_numRequests[ii];
+                        if (0 == num)
+                        {
+                            continue;
+                        }
+
+                        const uint64_t requested = m_requestedSize[ii];
+                        const uint64_t granted   = num*s_sizes[ii];
+                        printf("\t#%2d: Size: %5llu.%03lluKB, Requests: %8llu, Avg requested: %5u.%03uKB, Wasted: %5.2f%%\n"
+                              , ii, dm::U_UKB(s_sizes[ii]), (unsigned long long)num, dm::U_UKB(requested/num)
+                              , 100.0*double(granted-requested)/double(granted)
+                              );
+                    }
+                    printf("\t-------------------------\n");
+                    printf("\tTotal: Requested %u.%uMB, Granted %u.%uMB, Wasted: %5.2f%%\n\n"
+                          , dm::U_UMB(totalRequested), dm::U_UMB(totalGranted)
+                          , 0 == totalGranted ? 0.0 : 100.0*double(totalGranted-totalRequested)/double(totalGranted)
+                          );
+                }
+                #endif //DM_ALLOC_PRINT_STATS
+
+            private:
+                /// Relaxed, the high water mark may miss a concurrent peak by a few slots.
+                void trackUsed(uint8_t _idx, int32_t _num)
+                {
+                    const uint32_t used = dm::atomicFetchAndAdd32(&m_used[_idx], uint32_t(_num)) + uint32_t(_num);
+                    if (used > m_highWater[_idx])
+                    {
+                        m_highWater[_idx] = used;
+                    }
+                }
+
+                void*       m_mem;
+                size_t      m_totalSize;
+                // Lists:
+                void*              m_begin[Count];
+                uint64_t           m_reciprocal[Count];
+                uint8_t            m_binToIdx[NumBins];
+                uint8_t            m_granuleToIdx[NumGranules];
+                uint32_t           m_cacheMax[Count];
+                dm::AtomicBitArray m_allocs[Count];
+                uint8_t            m_allocsData[ListsSize];
+
+                volatile uint32_t m_used[Count];
+                volatile uint32_t m_highWater[Count];
+                volatile uint64_t m_overflow[Count];
+
+                #if DM_MEM_TRACK_ZEROED
+                uint32_t          m_dirtyBegin[Count]; // First word of each class in m_dirty.
+                volatile uint64_t m_dirty[DirtyWords]; // One bit per slot, see markDirty().
+                #endif //DM_MEM_TRACK_ZEROED
+
+                #if DM_ALLOC_PRINT_STATS
+                volatile uint32_t m_totalUsed[Count];
+                volatile uint64_t m_numRequests[Count];
+                volatile uint64_t m_requestedSize[Count];
+                #endif //DM_ALLOC_PRINT_STATS
+            };
+
+            #if DM_ALLOC_THREAD_CACHE
+            struct ThreadCache
+            {
+                enum
+                {
+                    MaxSlots  = DM_ALLOC_THREAD_CACHE_SIZE,
+                    BatchSize = (DM_ALLOC_THREAD_CACHE_SIZE+1)/2,
+                };
+
+                struct Magazine
+                {
+                    uint32_t m_count;
+                    void*    m_slots[MaxSlots];
+                };
+
+                // Thread-local, zero initialized, therefore no constructor.
+                Magazine m_magazines[SegregatedLists::Count];
+            };
+            static BX_THREAD ThreadCache s_threadCache;
+
+            void* smallAlloc(size_t _size)
+            {
+                const uint8_t idx = m_segregatedLists.getIdx(_size);
+                const uint32_t cacheMax = m_segregatedLists.getCacheMax(idx);
+                if (0 == cacheMax)
+                {
+                    return m_segregatedLists.alloc(_size);
+                }
+
+                ThreadCache::Magazine& magazine = s_threadCache.m_magazines[idx];
+                if (0 == magazine.m_count)
+                {
+                    if (s_threadExited)
+                    {
+                        return m_segregatedLists.alloc(_size);
+                    }
+
+                    registerThread();
+
+                    // Refill.
+                    const uint32_t num = dm::min(cacheMax, uint32_t(ThreadCache::BatchSize));
+                    magazine.m_count = m_segregatedLists.allocBatch(idx, magazine.m_slots, num);
+                    if (0 == magazine.m_count)
+                    {
+                        return NULL;
+                    }
+                }
+
+                #if DM_ALLOC_PRINT_STATS
+                m_segregatedLists.trackRequest(idx, _size);
+                #endif //DM_ALLOC_PRINT_STATS
+
+                return magazine.m_slots[--magazine.m_count];
+            }
+
+            void smallFree(void* _ptr)
+            {
+                const uint8_t idx = m_segregatedLists.getIdxOf(_ptr);
+                const uint32_t cacheMax = m_segregatedLists.getCacheMax(idx);
+                if (0 == cacheMax || s_threadExited)
+                {
+                    m_segregatedLists.free(_ptr);
+                    return;
+                }
+
+                // Cached slots skip SegregatedLists::free().
+                m_segregatedLists.markDirty(idx, m_segregatedLists.getSlot(idx, _ptr));
+
+                ThreadCache::Magazine& magazine = s_threadCache.m_magazines[idx];
+                if (magazine.m_count >= cacheMax)
+                {
+                    registerThread();
+
+                    // Flush the older half back to the shared lists.
+                    const uint32_t num = dm::min(cacheMax, uint32_t(ThreadCache::BatchSize));
+                    m_segregatedLists.freeBatch(idx, magazine.m_slots, num);
+
+                    magazine.m_count -= num;
+                    memmove(magazine.m_slots, &magazine.m_slots[num], magazine.m_count*sizeof(void*));
+                }
+
+                magazine.m_slots[magazine.m_count++] = _ptr;
+            }
+
+            void flushThreadCache()
+            {
+                for (uint8_t ii = 0; ii < SegregatedLists::Count; ++ii)
+                {
+                    ThreadCache::Magazine& magazine = s_threadCache.m_magazines[ii];
+                    if (0 != magazine.m_count)
+                    {
+                        m_segregatedLists.freeBatch(ii, magazine.m_slots, magazine.m_count);
+                        magazine.m_count = 0;
+                    }
+                }
+            }
+
+            #else
+            void* smallAlloc(size_t _size)
+            {
+                return m_segregatedLists.alloc(_size);
+            }
+
+            void smallFree(void* _ptr)
+            {
+                m_segregatedLists.free(_ptr);
+            }
+
+            void flushThreadCache()
+            {
+            }
+            #endif //DM_ALLOC_THREAD_CACHE
+
+            // Thread state.
+            //-----
+
+            /// Hands back cached slots and the scratch stack of the calling thread.
+            void threadShutdown()
+            {
+                flushThreadCache();
+                releaseThreadStack();
+            }
+
+            #if DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS
+            static BX_THREAD bool s_threadRegistered;
+            static BX_THREAD bool s_threadExited; // Past the exit hook. Other TLS destructors and thread teardown may still allocate, nothing is cached for them.
+
+            #if BX_PLATFORM_POSIX
+            static void threadExit(void* _memory)
+            {
+                s_threadExited = true;
+                ((Memory*)_memory)->threadShutdown();
+            }
+            #endif // BX_PLATFORM_POSIX
+
+            void registerThread()
+            {
+                // Makes sure thread state is handed back when the thread exits.
+                if (!s_threadRegistered)
+                {
+                    s_threadRegistered = true;
+
+                    #if BX_PLATFORM_POSIX
+                    pthread_setspecific(m_threadExitKey, (void*)this);
+                    #endif // BX_PLATFORM_POSIX
+                }
+            }
+            #endif // DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS
+
+            struct Heap
+            {
+                #define DM_HEAP_LIST_IMPL  (DM_ALLOCATOR_UNDERLYING_IMPL_LIST  == DM_ALLOCATOR_UNDERLYING_IMPL)
+                #define DM_HEAP_ARRAY_IMPL (DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY == DM_ALLOCATOR_UNDERLYING_IMPL)
+                #define DM_HEAP_TLSF_IMPL  (DM_ALLOCATOR_UNDERLYING_IMPL_TLSF  == DM_ALLOCATOR_UNDERLYING_IMPL)
+
+                #if !DM_HEAP_LIST_IMPL
+                #   define DM_UsedMask    0x8000000000000000UL
+                #   define DM_UsedShift   63UL
+                #   define DM_RelocMask   0x4000000000000000UL // Used block that compact() may move, see RelocEntry.
+                #   define DM_SizeMask    0x3fffffffffffffffUL
+                #   define DM_SizeShift   0UL
+                #else
+                #   define DM_UsedMask    0x8000000000000000UL
+                #   define DM_UsedShift   63UL
+                #   define DM_HandleMask  0x7fff000000000000UL
+                #   define DM_HandleShift 48UL
+                #   define DM_HandleMax   (DM_HandleMask>>DM_HandleShift)
+                #   define DM_GroupMask   0x0000fff000000000UL
+                #   define DM_GroupShift  36UL
+                #   define DM_GroupMax    (DM_GroupMask>>DM_GroupShift)
+                #   define DM_SizeMask    0x0000000fffffffffUL
+                #   define DM_SizeShift   0UL
+                #endif //!DM_HEAP_LIST_IMPL
+
+                enum
+                {
+                    HeaderSize = sizeof(uint64_t),
+                    FooterSize = sizeof(uint64_t),
+                    HeaderFooterSize = HeaderSize+FooterSize,
+
+                    MinimalSlotSize = HeaderFooterSize + 64,
+
+                    #define DM_ALLOC_CONFIG
+                    #include "allocator_config.h"
+                    NumRegions        = DM_ALLOC_NUM_REGIONS,
+                    NumSubRegions     = DM_ALLOC_NUM_SUB_REGIONS,
+                    SmallestRegion    = DM_ALLOC_SMALLEST_REGION,
+                    BiggestRegion     = DM_ALLOC_SMALLEST_REGION<<(DM_ALLOC_NUM_REGIONS-1),
+                    SmallestRegionPwr = dm::Log<2,(SmallestRegion>>20ul)>::value,
+
+                    #define DM_ALLOC_DEF(_regionIdx, _num) \
+                        NumSlots ## _regionIdx = _num,
+                    #include "allocator_config.h"
+
+                    #if DM_HEAP_LIST_IMPL
+                        TotalSlotCount = (0
+                        #define DM_ALLOC_DEF(_regionIdx, _num) \
+                            + NumSlots ## _regionIdx
+                        #include "allocator_config.h"
+                            ) * NumSubRegions, // TotalSlotCount.
+                    #endif //DM_HEAP_LIST_IMPL
+
+                    #if DM_HEAP_TLSF_IMPL
+                        TlsfSlCountLog2 = DM_ALLOC_TLSF_SL_COUNT_LOG2,
+                        TlsfSlCount     = 1<<TlsfSlCountLog2,
+                        TlsfAlignLog2   = 4, // Block sizes are multiples of 16.
+                        TlsfFlShift     = TlsfSlCountLog2+TlsfAlignLog2,
+                        TlsfSmallSize   = 1<<TlsfFlShift, // Smaller blocks are all binned linearly in the first list.
+                        TlsfFlMaxLog2   = 48,
+                        TlsfFlCount     = TlsfFlMaxLog2-TlsfFlShift+2,
+                    #endif //DM_HEAP_TLSF_IMPL
+                };
+
+                /// '_stackHighWater' points at the highest address the stack below the heap ever reached,
+                /// everything between it and the lowest heap boundary was never written, see callocZeroed().
+                void init(uint8_t** _stackPtr, uint8_t** _heap, size_t _pageSize, uint8_t** _stackHighWater)
+                {
+                    m_begin    = *_heap;
+                    m_end      = _heap;
+                    m_stackPtr = _stackPtr;
+                    m_stackHighWater = _stackHighWater;
+                    m_pageSize = _pageSize;
+                    m_remoteFree = NULL;
+
+                    #if DM_ALLOC_PRINT_STATS
+                    m_decommitted    = 0;
+                    m_reallocInPlace = 0;
+                    m_reallocMoved   = 0;
+                    m_reallocFailed  = 0;
+                    #endif //DM_ALLOC_PRINT_STATS
+
+                    *m_end -= 2*sizeof(uint64_t);
+                    uint64_t* terminator = (uint64_t*)*m_end;
+                    terminator[0] = UINT64_MAX;
+                    terminator[1] = UINT64_MAX;
+                    m_lowWater = *m_end;
+
+                    #if DM_HEAP_TLSF_IMPL
+                        m_tlsfFlBitmap = 0;
+                        memset(m_tlsfSlBitmap, 0, sizeof(m_tlsfSlBitmap));
+                        memset(m_tlsfBlocks,   0, sizeof(m_tlsfBlocks));
+                    #else
+                    m_freeTree      = NULL;
+                    m_freeTreeCount = 0;
+
+                    memset(m_regionInfo, 0xff, sizeof(m_regionInfo));
+                    memset(m_freeSlotsCount, 0, sizeof(m_freeSlotsCount));
+
+                    #if DM_HEAP_ARRAY_IMPL
+                        #define DM_ALLOC_DEF(_regionIdx, _num) \
+                            m_freeSlotsMax[_regionIdx] = NumSlots ## _regionIdx;
+                        #include "allocator_config.h"
+
+                        // Free slots size.
+
+                        memset(m_freeSlotsSize,  0, sizeof(m_freeSlotsSize));
+
+                        #define DM_ALLOC_DEF(_regionIdx, _num) \
+                            memset(m_freeSlotsSize ## _regionIdx, 0, sizeof(m_freeSlotsSize ## _regionIdx));
+                        #include "allocator_config.h"
+
+                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                        \
+                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                           \
+                            {                                                                                         \
+                                m_freeSlotsSize[_regionIdx*NumSubRegions+ii] = m_freeSlotsSize ## _regionIdx[ii]; \
+                            }
+                        #include "allocator_config.h"
+
+                        // Free slots ptr.
+
+                        memset(m_freeSlotsPtr,   0, sizeof(m_freeSlotsPtr));
+
+                        #define DM_ALLOC_DEF(_regionIdx, _num) \
+                            memset(m_freeSlotsPtr ## _regionIdx, 0, sizeof(m_freeSlotsPtr ## _regionIdx));
+                        #include "allocator_config.h"
+
+                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                      \
+                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                         \
+                            {                                                                                       \
+                                m_freeSlotsPtr[_regionIdx*NumSubRegions+ii] = m_freeSlotsPtr ## _regionIdx[ii]; \
+                            }
+                        #include "allocator_config.h"
+                    #else
+                        void* ptr = (void*)m_freeSlotsData;
+                        #define DM_ALLOC_DEF(_regionIdx, _num)                                                    \
+                            for (uint32_t ii = 0; ii < NumSubRegions; ++ii)                                       \
+                            {                                                                                     \
+                                ptr = m_freeSlots[_regionIdx*NumSubRegions+ii].init(NumSlots ## _regionIdx, ptr); \
+                            }
+                        #include "allocator_config.h"
+                    #endif //DM_HEAP_ARRAY_IMPL
+                    #endif //DM_HEAP_TLSF_IMPL
+                }
+
+                #if DM_HEAP_TLSF_IMPL
+                    // Two-level segregated fit index.
+                    //
+                    // Free blocks are binned by size. The first level is the power of two of the size,
+                    // the second level splits each power of two linearly into TlsfSlCount bins.
+                    // Each bin is a doubly linked list threaded through the free blocks themselves,
+                    // links are stored in the block payload, right after the header.
+                    // Non-empty bins are tracked by bitmaps, so finding a bin that fits is two bit scans.
+
+                    struct FreeLinks
+                    {
+                        void* m_prev;
+                        void* m_next;
+                    };
+
+                    FreeLinks* freeLinks(void* _beg) const
+                    {
+                        return (FreeLinks*)((uint64_t*)_beg+1);
+                    }
+
+                    void tlsfMapping(uint64_t _size, uint32_t& _fl, uint32_t& _sl) const
+                    {
+                        if (_size < TlsfSmallSize)
+                        {
+                            _fl = 0;
+                            _sl = uint32_t(_size>>TlsfAlignLog2);
+                        }
+                        else
+                        {
+                            const uint32_t log2 = 63 - uint32_t(bx::uint64_cntlz(_size));
+                            _fl = log2 - TlsfFlShift + 1;
+                            _sl = uint32_t(_size>>(log2-TlsfSlCountLog2)) - TlsfSlCount;
+                        }
+                    }
+
+                    /// Rounds '_size' up to the next bin boundary, any block from the resulting bin is big enough.
+                    void tlsfMappingSearch(uint64_t _size, uint32_t& _fl, uint32_t& _sl) const
+                    {
+                        if (_size >= TlsfSmallSize)
+                        {
+                            const uint32_t log2 = 63 - uint32_t(bx::uint64_cntlz(_size));
+                            _size += (UINT64_C(1)<<(log2-TlsfSlCountLog2)) - 1;
+                        }
+
+                        tlsfMapping(_size, _fl, _sl);
+                    }
+
+                    /// Returns the first free block from the smallest non-empty bin at or above [_fl][_sl], NULL if there is none.
+                    void* tlsfFindSuitable(uint32_t _fl, uint32_t _sl) const
+                    {
+                        if (_fl >= TlsfFlCount)
+                        {
+                            return NULL;
+                        }
+
+                        uint32_t fl = _fl;
+                        uint32_t slBitmap = m_tlsfSlBitmap[fl] & (UINT32_MAX<<_sl);
+                        if (0 == slBitmap)
+                        {
+                            const uint64_t flBitmap = m_tlsfFlBitmap & (UINT64_MAX<<(fl+1));
+                            if (0 == flBitmap)
+                            {
+                                return NULL;
+                            }
+
+                            fl = uint32_t(bx::uint64_cnttz(flBitmap));
+                            slBitmap = m_tlsfSlBitmap[fl];
+                        }
+
+                        const uint32_t sl = bx::uint32_cnttz(slBitmap);
+                        return m_tlsfBlocks[fl][sl];
+                    }
+
+                    void tlsfInsert(void* _beg, uint64_t _totalSize)
+                    {
+                        uint32_t fl, sl;
+                        tlsfMapping(_totalSize, fl, sl);
+                        CS_CHECK(fl < TlsfFlCount, "Free block is too big: %u.%uMB.", dm::U_UMB(_totalSize));
+
+                        void* head = m_tlsfBlocks[fl][sl];
+
+                        FreeLinks* links = freeLinks(_beg);
+                        links->m_prev = NULL;
+                        links->m_next = head;
+                        if (NULL != head)
+                        {
+                            freeLinks(head)->m_prev = _beg;
+                        }
+
+                        m_tlsfBlocks[fl][sl] = _beg;
+                        m_tlsfSlBitmap[fl] |= UINT32_C(1)<<sl;
+                        m_tlsfFlBitmap     |= UINT64_C(1)<<fl;
+                    }
+
+                    void tlsfRemove(void* _beg, uint64_t _totalSize)
+                    {
+                        uint32_t fl, sl;
+                        tlsfMapping(_totalSize, fl, sl);
+
+                        const FreeLinks* links = freeLinks(_beg);
+                        if (NULL != links->m_next)
+                        {
+                            freeLinks(links->m_next)->m_prev = links->m_prev;
+                        }
+
+                        if (NULL != links->m_prev)
+                        {
+                            freeLinks(links->m_prev)->m_next = links->m_next;
+                        }
+                        else
+                        {
+                            DM_CHECK(m_tlsfBlocks[fl][sl] == _beg, "Free block is not in its bin.");
+
+                            m_tlsfBlocks[fl][sl] = links->m_next;
+                            if (NULL == links->m_next)
+                            {
+                                m_tlsfSlBitmap[fl] &= ~(UINT32_C(1)<<sl);
+                                if (0 == m_tlsfSlBitmap[fl])
+                                {
+                                    m_tlsfFlBitmap &= ~(UINT64_C(1)<<fl);
+                                }
+                            }
+                        }
+                    }
+
+                    void addSpace(void* _ptr, uint64_t _size)
+                    {
+                        DM_CHECK(_size >= MinimalSlotSize, "Error _size param is invalid.");
+
+                        writeHeaderFooter(_ptr, _size, false);
+                        tlsfInsert(_ptr, _size);
+                    }
+
+                    /// Takes a free block big enough for '_totalSize' out of the index. Returns NULL if there is none.
+                    void* findFreeSpace(uint64_t _totalSize, uint64_t& _slotSize)
+                    {
+                        uint32_t fl, sl;
+                        tlsfMappingSearch(_totalSize, fl, sl);
+
+                        void* beg = tlsfFindSuitable(fl, sl);
+                        if (NULL == beg)
+                        {
+                            // Bins above are empty, blocks in the request's own bin may still fit.
+                            tlsfMapping(_totalSize, fl, sl);
+                            beg = (fl < TlsfFlCount) ? m_tlsfBlocks[fl][sl] : NULL;
+                            while (NULL != beg && unpackSize(readHeader(beg)) + HeaderFooterSize < _totalSize)
+                            {
+                                beg = freeLinks(beg)->m_next;
+                            }
+                        }
+
+                        if (NULL != beg)
+                        {
+                            _slotSize = unpackSize(readHeader(beg)) + HeaderFooterSize;
+                            tlsfRemove(beg, _slotSize);
+                        }
+
+                        return beg;
+                    }
+
+                    void* consumeFreeSpace(void* _beg, uint64_t _slotSize, uint64_t _consume)
+                    {
+                        const uint64_t remainingSize = _slotSize - _consume;
+                        if (remainingSize > MinimalSlotSize)
+                        {
+                            // Consume and add leftover.
+                            void* ptr = writeHeaderFooter(_beg, _consume);
+                            addSpace((uint8_t*)_beg + _consume, remainingSize);
+
+                            return ptr;
+                        }
+
+                        // Consume entire slot.
+                        return writeHeaderFooter(_beg, _slotSize);
+                    }
+                #else
+
+                uint16_t getRegion(uint16_t _slotGroup)
+                {
+                    return _slotGroup/NumSubRegions;
+                }
+
+                uint16_t nextSlotGroup(uint16_t _slotGroup)
+                {
+                    const uint16_t region = getRegion(_slotGroup);
+
+                    const uint16_t incr = _slotGroup+1;
+                    const uint16_t end  = region*NumSubRegions + NumSubRegions;
+                    if (incr < end)
+                    {
+                        return incr;
+                    }
+                    else
+                    {
+                        const uint16_t nextRegion = m_regionInfo[region].m_next;
+                        if (UINT16_MAX == nextRegion)
+                        {
+                            return UINT16_MAX;
+                        }
+                        else
+                        {
+                            const uint16_t first = m_regionInfo[nextRegion].m_first;
+                            if (UINT16_MAX == first)
+                            {
+                                return UINT16_MAX;
+                            }
+
+                            return nextRegion*NumSubRegions + first;
+                        }
+                    }
+                }
+
+                void registerSlotGroup(uint16_t _slotGroup)
+                {
+                    const uint16_t region = getRegion(_slotGroup);
+                    for (uint16_t ii = region; ii--; )
+                    {
+                        if (m_regionInfo[ii].m_next > region)
+                        {
+                            m_regionInfo[ii].m_next = region;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    const uint16_t subRegion = _slotGroup - region*NumSubRegions;
+                    if (m_regionInfo[region].m_first > subRegion)
+                    {
+                        m_regionInfo[region].m_first = subRegion;
+                    }
+                }
+
+                void unregisterSlotGroup(uint16_t _slotGroup)
+                {
+                    if (0 != m_freeSlotsCount[_slotGroup])
+                    {
+                        return;
+                    }
+
+                    const uint16_t region    = getRegion(_slotGroup);
+                    const uint16_t subRegion = _slotGroup - region*NumSubRegions;
+
+                    uint16_t first = m_regionInfo[region].m_first;
+                    if (subRegion == first)
+                    {
+                        // Find and assign first.
+                        for (uint16_t ii = subRegion+1; ii < NumSubRegions; ++ii)
+                        {
+                            if (m_freeSlotsCount[region*NumSubRegions+ii] > 0)
+                            {
+                                first = ii;
+                                break;
+                            }
+                        }
+
+                        if (subRegion == first)
+                        {
+                            // Region is empty.
+                            m_regionInfo[region].m_first = UINT16_MAX;
+
+                            // Reassign pointers to point to the next one.
+                            const uint16_t nextRegion = m_regionInfo[region].m_next;
+                            for (uint16_t ii = region; ii--; )
+                            {
+                                if (m_regionInfo[ii].m_next == region)
+                                {
+                                    m_regionInfo[ii].m_next = nextRegion;
+                                }
+                                else
+                                {
+                                    break;
+                                }
+                            }
+                        }
+                        else
+                        {
+                            m_regionInfo[region].m_first = first;
+                        }
+                    }
+                }
+
+                uint16_t getSlotGroup(uint32_t _size)
+                {
+                    const uint32_t sizePwrTwo   = dm::nextPowTwo(_size);
+                    const uint32_t sizePwrTwoMB = sizePwrTwo >> 20;
+
+                    if (0 == sizePwrTwoMB)
+                    {
+                        return 0;
+                    }
+
+                    // Determine region.
+                    const uint32_t region = dm::max(0, int32_t(bx::uint32_cnttz(sizePwrTwoMB)) - SmallestRegionPwr);
+
+                    // Determine subRegion.
+                    uint32_t subRegion = 0;
+                    const uint32_t leftover = sizePwrTwo - _size;
+                    if (0 != leftover)
+                    {
+                        const uint32_t subRegionSize = (sizePwrTwo - (sizePwrTwo>>1))/NumSubRegions;
+                        subRegion = leftover/subRegionSize;
+                    }
+
+                    // Determine slot group.
+                    const uint32_t slotGroup = region*NumSubRegions+subRegion;
+
+                    CS_CHECK(slotGroup < NumRegions*NumSubRegions, "Invalid slot group %d/%d [slotGroup][max].", slotGroup, NumRegions*NumSubRegions);
+
+                    return uint16_t(slotGroup);
+                }
+
+                void addFreeSpace(void* _ptr, uint32_t _size)
+                {
+                    DM_CHECK(_size >= HeaderFooterSize, "Error _size param is invalid.");
+
+                    const uint16_t group = getSlotGroup(_size);
+
+                    #if DM_HEAP_ARRAY_IMPL
+                        const uint16_t count = m_freeSlotsCount[group];
+                        const uint16_t max   = m_freeSlotsMax[group/NumSubRegions];
+                        writeHeaderFooter(_ptr, (uint64_t)_size, false);
+                        if (max > count)
+                        {
+                            registerSlotGroup(group);
+
+                            const uint32_t last = m_freeSlotsCount[group]++;
+                            m_freeSlotsSize[group][last] = _size;
+                            m_freeSlotsPtr [group][last] = _ptr;
+                        }
+                        else
+                        {
+                            // Group is full, track it along with the big spans.
+                            treeInsert(_ptr);
+                        }
+                    #else
+                        if (m_freeSlots[group].count() < m_freeSlots[group].max())
+                        {
+                            registerSlotGroup(group);
+
+                            FreeSlot* freeSlot = m_freeSlots[group].addNew();
+                            freeSlot->m_size = _size;
+                            freeSlot->m_ptr  = _ptr;
+                            const uint16_t handle = m_freeSlots[group].getHandleOf(freeSlot);
+                            writeHeaderFooter(_ptr, (uint64_t)_size, group, handle, false);
+                        }
+                        else
+                        {
+                            // Group is full, track it along with the big spans.
+                            writeHeaderFooter(_ptr, (uint64_t)_size, group, DM_HandleMax, false);
+                            treeInsert(_ptr);
+                        }
+                    #endif //DM_HEAP_ARRAY_IMPL
+                }
+
+                void addBigFreeSpace(void* _ptr, uint64_t _size)
+                {
+                    writeHeaderFooter(_ptr, _size, false);
+                    treeInsert(_ptr);
+                }
+
+                void addSpace(void* _ptr, uint64_t _size)
+                {
+                    if (_size <= BiggestRegion)
+                    {
+                        addFreeSpace(_ptr, uint32_t(_size));
+                    }
+                    else
+                    {
+                        addBigFreeSpace(_ptr, _size);
+                    }
+                }
+
+                void removeFreeSlot(uint16_t _group, uint32_t _idx)
+                {
+                    #if DM_HEAP_ARRAY_IMPL
+                        const uint32_t last = --m_freeSlotsCount[_group];
+                        m_freeSlotsSize[_group][_idx] = m_freeSlotsSize[_group][last];
+                        m_freeSlotsPtr [_group][_idx] = m_freeSlotsPtr [_group][last];
+                    #else
+                        m_freeSlots[_group].removeAt(_idx);
+                    #endif //DM_HEAP_ARRAY_IMPL
+
+                    unregisterSlotGroup(_group);
+                }
+
+                // Free spans that do not fit the slot groups are kept in an AVL tree ordered by size, then address.
+                // Tree nodes are stored in the span payload, right after the header, so the tree has no capacity limit.
+
+                struct TreeNode
+                {
+                    void*    m_left;
+                    void*    m_right;
+                    uint32_t m_height;
+                };
+
+                TreeNode* treeNode(void* _beg) const
+                {
+                    return (TreeNode*)((uint64_t*)_beg+1);
+                }
+
+                bool treeLess(void* _a, void* _b) const
+                {
+                    const uint64_t sizeA = unpackSize(readHeader(_a));
+                    const uint64_t sizeB = unpackSize(readHeader(_b));
+                    return sizeA < sizeB || (sizeA == sizeB && _a < _b);
+                }
+
+                uint32_t treeHeight(void* _node) const
+                {
+                    return (NULL == _node) ? 0 : treeNode(_node)->m_height;
+                }
+
+                void treeUpdate(void* _node)
+                {
+                    TreeNode* node = treeNode(_node);
+                    node->m_height = dm::max(treeHeight(node->m_left), treeHeight(node->m_right)) + 1;
+                }
+
+                void* treeRotateLeft(void* _node)
+                {
+                    void* right = treeNode(_node)->m_right;
+                    treeNode(_node)->m_right = treeNode(right)->m_left;
+                    treeNode(right)->m_left  = _node;
+                    treeUpdate(_node);
+                    treeUpdate(right);
+                    return right;
+                }
+
+                void* treeRotateRight(void* _node)
+                {
+                    void* left = treeNode(_node)->m_left;
+                    treeNode(_node)->m_left  = treeNode(left)->m_right;
+                    treeNode(left)->m_right = _node;
+                    treeUpdate(_node);
+                    treeUpdate(left);
+                    return left;
+                }
+
+                void* treeBalance(void* _node)
+                {
+                    treeUpdate(_node);
+
+                    TreeNode* node = treeNode(_node);
+                    const int32_t balance = int32_t(treeHeight(node->m_left)) - int32_t(treeHeight(node->m_right));
+                    if (balance > 1)
+                    {
+                        if (treeHeight(treeNode(node->m_left)->m_left) < treeHeight(treeNode(node->m_left)->m_right))
+                        {
+                            node->m_left = treeRotateLeft(node->m_left);
+                        }
+                        return treeRotateRight(_node);
+                    }
+                    else if (balance < -1)
+                    {
+                        if (treeHeight(treeNode(node->m_right)->m_right) < treeHeight(treeNode(node->m_right)->m_left))
+                        {
+                            node->m_right = treeRotateRight(node->m_right);
+                        }
+                        return treeRotateLeft(_node);
+                    }
+
+                    return _node;
+                }
+
+                void* treeInsert(void* _root, void* _beg)
+                {
+                    if (NULL == _root)
+                    {
+                        TreeNode* node = treeNode(_beg);
+                        node->m_left   = NULL;
+                        node->m_right  = NULL;
+                        node->m_height = 1;
+                        return _beg;
+                    }
+
+                    TreeNode* root = treeNode(_root);
+                    if (treeLess(_beg, _root))
+                    {
+                        root->m_left = treeInsert(root->m_left, _beg);
+                    }
+                    else
+                    {
+                        root->m_right = treeInsert(root->m_right, _beg);
+                    }
+
+                    return treeBalance(_root);
+                }
+
+                void* treeRemoveMin(void* _root, void*& _min)
+                {
+                    TreeNode* root = treeNode(_root);
+                    if (NULL == root->m_left)
+                    {
+                        _min = _root;
+                        return root->m_right;
+                    }
+
+                    root->m_left = treeRemoveMin(root->m_left, _min);
+                    return treeBalance(_root);
+                }
+
+                void* treeRemove(void* _root, void* _beg)
+                {
+                    DM_CHECK(NULL != _root, "Free span is not in the tree.");
+
+                    TreeNode* root = treeNode(_root);
+                    if (_root == _beg)
+                    {
+                        if (NULL == root->m_right)
+                        {
+                            return root->m_left;
+                        }
+
+                        void* min;
+                        void* right = treeRemoveMin(root->m_right, min);
+                        treeNode(min)->m_left  = root->m_left;
+                        treeNode(min)->m_right = right;
+                        return treeBalance(min);
+                    }
+
+                    if (treeLess(_beg, _root))
+                    {
+                        root->m_left = treeRemove(root->m_left, _beg);
+                    }
+                    else
+                    {
+                        root->m_right = treeRemove(root->m_right, _beg);
+                    }
+
+                    return treeBalance(_root);
+                }
+
+                /// Expects the header to be written.
+                void treeInsert(void* _beg)
+                {
+                    m_freeTree = treeInsert(m_freeTree, _beg);
+                    m_freeTreeCount++;
+                }
+
+                /// Expects the header to be unchanged since insertion.
+                void treeRemove(void* _beg)
+                {
+                    m_freeTree = treeRemove(m_freeTree, _beg);
+                    m_freeTreeCount--;
+                }
+
+                /// Returns the smallest span that fits '_totalSize', the lowest one among equally sized. NULL if there is none.
+                void* treeFindBestFit(uint64_t _totalSize) const
+                {
+                    void* best = NULL;
+                    void* node = m_freeTree;
+                    while (NULL != node)
+                    {
+                        const uint64_t totalSize = unpackSize(readHeader(node)) + HeaderFooterSize;
+                        if (totalSize >= _totalSize)
+                        {
+                            best = node;
+                            node = treeNode(node)->m_left;
+                        }
+                        else
+                        {
+                            node = treeNode(node)->m_right;
+                        }
+                    }
+
+                    return best;
+                }
+
+                #if DM_HEAP_ARRAY_IMPL
+                    bool removeFreeSpaceRef(void* _ptr, uint32_t _size)
+                    {
+                        uint16_t group = getSlotGroup(_size);
+                        do
                         {
-                            return UINT16_MAX;
+                            for (uint32_t ii = 0, end = m_freeSlotsCount[group]; ii < end; ++ii)
+                            {
+                                if (m_freeSlotsPtr[group][ii] == _ptr)
+                                {
+                                    removeFreeSlot(group, ii);
+
+                                    return true;
+                                }
+                            }
+
+                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
+
+                        return false;
+                    }
+
+                    bool removeFreeSpaceSSE(void* _ptr, uint32_t _size)
+                    {
+                        const __m128i ptrsplat = _mm_set1_epi64x(int64_t(_ptr));
+
+                        uint16_t group = getSlotGroup(_size);
+                        do
+                        {
+                            int32_t ii = 0;
+                            const int32_t count = (int32_t)m_freeSlotsCount[group];
+                            for (int32_t end = count-1; ii < end; ii+=2)
+                            {
+                                const __m128i  ptrs = _mm_load_si128((__m128i*)&m_freeSlotsPtr[group][ii]);
+                                const __m128i  cmp  = _mm_cmpeq_epi64(ptrsplat, ptrs);
+                                const uint32_t mask = _mm_movemask_epi8(cmp);
+                                if (mask != 0)
+                                {
+                                    const uint32_t index = ii + (0xff00 == mask); // 'mask' can be either 0xff (0) or 0xff00 (1).
+                                    removeFreeSlot(group, index);
+
+                                    return true;
+                                }
+                            }
+                            for (int32_t end = count; ii < end; ++ii)
+                            {
+                                if (m_freeSlotsPtr[group][ii] == _ptr)
+                                {
+                                    removeFreeSlot(group, ii);
+
+                                    return true;
+                                }
+                            }
+
+                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
+
+                        return false;
+                    }
+
+                    bool removeFreeSpace(void* _ptr, uint32_t _size)
+                    {
+                        return removeFreeSpaceSSE(_ptr, _size);
+                    }
+                #else
+                    bool removeFreeSpace(uint16_t _group, uint16_t _handle)
+                    {
+                        if (_handle < DM_HandleMax)
+                        {
+                            m_freeSlots[_group].remove(_handle);
+                            unregisterSlotGroup(_group);
+                            return true;
                         }
-                        else
+
+                        return false;
+                    }
+                #endif //DM_HEAP_ARRAY_IMPL
+
+                #endif //DM_HEAP_TLSF_IMPL
+
+                uint64_t packHeader(bool _used, uint64_t _size) const
+                {
+                    return 0
+                         | ((uint64_t(_size)<<DM_SizeShift)&DM_SizeMask)
+                         | ((uint64_t(_used)<<DM_UsedShift)&DM_UsedMask)
+                         ;
+                }
+
+                #if DM_HEAP_LIST_IMPL
+                    uint64_t packHeader(bool _used, uint16_t _group, uint16_t _handle, uint64_t _size) const
+                    {
+                        return 0
+                             | ((uint64_t(_size)<<DM_SizeShift)&DM_SizeMask)
+                             | ((uint64_t(_handle)<<DM_HandleShift)&DM_HandleMask)
+                             | ((uint64_t(_group)<<DM_GroupShift)&DM_GroupMask)
+                             | ((uint64_t(_used)<<DM_UsedShift)&DM_UsedMask)
+                             ;
+                    }
+                #endif //DM_HEAP_LIST_IMPL
+
+                bool unpackUsed(uint64_t _header) const
+                {
+                    return DM_BOOL((_header&DM_UsedMask)>>DM_UsedShift);
+                }
+
+                #if DM_HEAP_LIST_IMPL
+                    uint16_t unpackHandle(uint64_t _header) const
+                    {
+                        return uint16_t((_header&DM_HandleMask)>>DM_HandleShift);
+                    }
+
+                    uint16_t unpackGroup(uint64_t _header) const
+                    {
+                        return uint16_t((_header&DM_GroupMask)>>DM_GroupShift);
+                    }
+                #endif //DM_HEAP_LIST_IMPL
+
+                uint64_t unpackSize(uint64_t _header) const
+                {
+                    return uint64_t((_header&DM_SizeMask)>>DM_SizeShift);
+                }
+
+                void* writeHeaderFooter(void* _begin, uint64_t _totalSize, bool _used = true)
+                {
+                    uint8_t* end = (uint8_t*)_begin+_totalSize;
+
+                    uint64_t* header = (uint64_t*)_begin;
+                    void*     data   = (uint64_t*)_begin+1;
+                    uint64_t* footer = (uint64_t*)end-1;
+
+                    const uint64_t allocSize = _totalSize - HeaderFooterSize;
+                    const uint64_t headerData = packHeader(_used, allocSize);
+                    *header = headerData;
+                    *footer = headerData;
+
+                    return data;
+                }
+
+                #if DM_HEAP_LIST_IMPL
+                    void* writeHeaderFooter(const void* _begin, uint64_t _totalSize, uint16_t _group, uint16_t _handle, bool _used = true)
+                    {
+                        uint8_t* end = (uint8_t*)_begin+_totalSize;
+
+                        uint64_t* header = (uint64_t*)_begin;
+                        void*     data   = (uint64_t*)_begin+1;
+                        uint64_t* footer = (uint64_t*)end-1;
+
+                        const uint64_t allocSize = _totalSize - HeaderFooterSize;
+                        const uint64_t headerData = packHeader(_used, _group, _handle, allocSize);
+                        *header = headerData;
+                        *footer = headerData;
+
+                        return data;
+                    }
+                #endif //DM_HEAP_LIST_IMPL
+
+                bool isFree(uint64_t _header)
+                {
+                    return (UINT64_MAX != _header && !unpackUsed(_header));
+                }
+
+                void* ptrToBegin(void* _ptr) const
+                {
+                    uint64_t* begin = (uint64_t*)_ptr-1;
+                    return (void*)begin;
+                }
+
+                uint64_t readHeader(const void* _beg) const
+                {
+                    const uint64_t* header = (const uint64_t*)_beg;
+                    return *header;
+                }
+
+                uint64_t readLeftHeader(const void* _beg) const
+                {
+                    const uint64_t* usedSize = (const uint64_t*)_beg-1;
+                    return *usedSize;
+                }
+
+                /// Takes a free block, identified by its header, out of the free space index.
+                void removeSpace(void* _beg, uint64_t _header)
+                {
+                    const uint64_t totalSize = unpackSize(_header) + HeaderFooterSize;
+
+                    #if DM_HEAP_TLSF_IMPL
+                        tlsfRemove(_beg, totalSize);
+                    #else
+                        bool removed = false;
+                        if (totalSize <= BiggestRegion)
                         {
-                            const uint16_t first = m_regionInfo[nextRegion].m_first;
-                            if (UINT16_MAX == first)
+                            #if DM_HEAP_ARRAY_IMPL
+                                removed = removeFreeSpace(_beg, uint32_t(totalSize));
+                            #else
+                                const uint16_t group  = unpackGroup(_header);
+                                const uint16_t handle = unpackHandle(_header);
+                                removed = removeFreeSpace(group, handle);
+                            #endif //DM_HEAP_ARRAY_IMPL
+                        }
+
+                        if (!removed)
+                        {
+                            treeRemove(_beg);
+                        }
+                    #endif //DM_HEAP_TLSF_IMPL
+                }
+
+                #if !DM_HEAP_TLSF_IMPL
+                void* consumeFreeSpace(uint32_t _group, uint32_t _idx, uint32_t _slotSize, uint32_t _consume)
+                {
+                    #if DM_HEAP_ARRAY_IMPL
+                        void* beg = m_freeSlotsPtr[_group][_idx];
+                    #else
+                        void* beg = m_freeSlots[_group][_idx].m_ptr;
+                    #endif //DM_HEAP_ARRAY_IMPL
+                    void* ptr;
+
+                    const uint32_t remainingSize = _slotSize - _consume;
+                    if (remainingSize > MinimalSlotSize)
+                    {
+                        // Consume.
+                        ptr = writeHeaderFooter(beg, uint64_t(_consume));
+                        removeFreeSlot(_group, _idx);
+
+                        // Leftover.
+                        void* next = (uint8_t*)beg + _consume;
+                        addFreeSpace(next, remainingSize);
+                    }
+                    else
+                    {
+                        // Consume entire slot.
+                        ptr = writeHeaderFooter(beg, uint64_t(_slotSize));
+                        removeFreeSlot(_group, _idx);
+                    }
+
+                    return ptr;
+                }
+
+                void* consumeBigFreeSpace(void* _beg, uint64_t _consume)
+                {
+                    const uint64_t slotSize = unpackSize(readHeader(_beg)) + HeaderFooterSize;
+                    treeRemove(_beg);
+
+                    const uint64_t remainingSize = slotSize - _consume;
+                    if (remainingSize > MinimalSlotSize)
+                    {
+                        // Consume and add leftover.
+                        void* ptr = writeHeaderFooter(_beg, _consume);
+                        addSpace((uint8_t*)_beg + _consume, remainingSize);
+
+                        return ptr;
+                    }
+
+                    // Consume entire slot.
+                    return writeHeaderFooter(_beg, slotSize);
+                }
+                #endif //!DM_HEAP_TLSF_IMPL
+
+                /// Gives pages of a big free span back to the OS. Header and footer stay intact.
+                /// Free spans this big had their pages decommitted when they became free.
+                static inline bool isDecommitted(uint64_t _totalSize)
+                {
+                    return _totalSize >= DM_MEM_DECOMMIT_THRESHOLD;
+                }
+
+                /// Gives pages of the free span [_beg, _beg+_totalSize) back to the OS, if the span is big enough.
+                /// Only [_dirtyBeg, _dirtyEnd) may still be committed, the rest of the span was merged from decommitted spans.
+                /// Pages the range shares with the rest of the span are free too, so the range is widened to whole pages.
+                void decommitFreeSpace(void* _beg, uint64_t _totalSize, void* _dirtyBeg, void* _dirtyEnd)
+                {
+                    #if DM_MEM_ARENA == DM_MEM_ARENA_VMEM
+                        if (isDecommitted(_totalSize))
+                        {
+                            const uintptr_t mask = uintptr_t(m_pageSize-1);
+                            uint8_t* spanBeg = (uint8_t*)_beg + HeaderSize;
+                            uint8_t* spanEnd = (uint8_t*)_beg + _totalSize - FooterSize;
+                            uint8_t* beg = dm::max(spanBeg, (uint8_t*)(uintptr_t(_dirtyBeg) & ~mask));
+                            uint8_t* end = dm::min(spanEnd, (uint8_t*)((uintptr_t(_dirtyEnd) + mask) & ~mask));
+                            if (beg >= end)
                             {
-                                return UINT16_MAX;
+                                return;
                             }
 
-                            return nextRegion*NumSubRegions + first;
-                        }
-                    }
+                            const size_t size = dm::vmemDecommit(beg, size_t(end - beg), m_pageSize);
+                            DM_PRINT_HEAP("Heap decommit: %u.%uMB - (0x%p)", dm::U_UMB(size), beg);
+                            BX_UNUSED(size);
+
+                            #if DM_ALLOC_PRINT_STATS
+                            m_decommitted += size;
+                            #endif //DM_ALLOC_PRINT_STATS
+                        }
+                    #else
+                        BX_UNUSED(_beg, _totalSize, _dirtyBeg, _dirtyEnd);
+                    #endif //DM_MEM_ARENA == DM_MEM_ARENA_VMEM
+                }
+
+                void* expandHeap(uint64_t _size)
+                {
+                    *m_end -= _size;
+                    uint64_t* terminator = (uint64_t*)*m_end;
+                    *terminator = UINT64_MAX;
+                    trackLowWater();
+
+                    uint8_t* beg = *m_end+sizeof(uint64_t);
+                    void* ptr = writeHeaderFooter(beg, _size);
+
+                    return ptr;
+                }
+
+                inline void trackLowWater()
+                {
+                    if (*m_end < m_lowWater)
+                    {
+                        m_lowWater = *m_end;
+                    }
+                }
+
+                static inline size_t totalSizeFor(size_t _size)
+                {
+                    const size_t alignedSize = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
+                    return dm::max(alignedSize + HeaderFooterSize, size_t(MinimalSlotSize)); // Free blocks need room for their links.
+                }
+
+                void* alloc(size_t _size)
+                {
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
+
+                    return allocLocked(totalSizeFor(_size));
                 }
 
-                void registerSlotGroup(uint16_t _slotGroup)
+                /// Same as alloc(), the block is zeroed. Blocks carved from space the heap never reached before,
+                /// neither the stack, are zero already and only the rest of the block is cleared.
+                /// Space given back by freeLocked() counts as used, decommitted pages are not assumed to be zero.
+                void* callocZeroed(size_t _size)
                 {
-                    const uint16_t region = getRegion(_slotGroup);
-                    for (uint16_t ii = region; ii--; )
+                    uint8_t* ptr;
+                    uint8_t* lowWater;
                     {
-                        if (m_regionInfo[ii].m_next > region)
-                        {
-                            m_regionInfo[ii].m_next = region;
-                        }
-                        else
+                        bx::LwMutexScope lock(m_mutex);
+                        drainRemoteFrees();
+
+                        lowWater = m_lowWater;
+                        ptr = (uint8_t*)allocLocked(totalSizeFor(_size));
+                    }
+
+                    if (NULL == ptr)
+                    {
+                        return NULL;
+                    }
+
+                    #if DM_MEM_TRACK_ZEROED
+                        // The stack may have touched the space before the heap got there, its high water is only raised, reading it late is safe.
+                        uint8_t* end      = ptr + _size;
+                        uint8_t* cleanBeg = (NULL != m_stackHighWater) ? dm::max(ptr, *m_stackHighWater) : ptr;
+                        uint8_t* cleanEnd = dm::min(end, lowWater);
+                        if (cleanBeg < cleanEnd)
                         {
-                            break;
+                            memset(ptr,      0, size_t(cleanBeg - ptr));
+                            memset(cleanEnd, 0, size_t(end - cleanEnd));
+                            return ptr;
                         }
+                    #else
+                        BX_UNUSED(lowWater);
+                    #endif //DM_MEM_TRACK_ZEROED
+
+                    memset(ptr, 0, _size);
+
+                    return ptr;
+                }
+
+                /// '_align' must be a power of two.
+                /// The block is over-allocated, leftovers in front of the aligned pointer and after the block are freed.
+                void* alignedAlloc(size_t _size, size_t _align)
+                {
+                    if (_align <= DM_NATURAL_ALIGNMENT)
+                    {
+                        return alloc(_size);
                     }
 
-                    const uint16_t subRegion = _slotGroup - region*NumSubRegions;
-                    if (m_regionInfo[region].m_first > subRegion)
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
+
+                    // Leading leftover needs to be big enough to become a free block.
+                    const size_t totalSize = totalSizeFor(_size);
+                    uint8_t* ptr = (uint8_t*)allocLocked(totalSize + _align + MinimalSlotSize);
+                    if (NULL == ptr)
                     {
-                        m_regionInfo[region].m_first = subRegion;
+                        return NULL;
+                    }
+
+                    uint8_t* aligned = (uint8_t*)dm::alignPtrNext(ptr, _align);
+                    if (aligned != ptr && size_t(aligned - ptr) < MinimalSlotSize)
+                    {
+                        aligned = (uint8_t*)dm::alignPtrNext(ptr + MinimalSlotSize, _align);
+                    }
+
+                    uint8_t* beg = (uint8_t*)ptrToBegin(ptr);
+                    uint64_t blockSize = unpackSize(readHeader(beg)) + HeaderFooterSize;
+
+                    const uint64_t leadSize = uint64_t(aligned - ptr);
+                    if (0 != leadSize)
+                    {
+                        writeHeaderFooter(beg, leadSize);
+                        writeHeaderFooter(beg + leadSize, blockSize - leadSize);
+                        freeLocked(ptr);
+
+                        beg       += leadSize;
+                        blockSize -= leadSize;
                     }
+
+                    const uint64_t trailSize = blockSize - totalSize;
+                    if (trailSize > MinimalSlotSize)
+                    {
+                        writeHeaderFooter(beg, totalSize);
+                        writeHeaderFooter(beg + totalSize, trailSize);
+                        freeLocked(beg + totalSize + HeaderSize);
+                    }
+
+                    return aligned;
                 }
 
-                void unregisterSlotGroup(uint16_t _slotGroup)
+                /// Expects m_mutex to be locked.
+                void* allocLocked(size_t _totalSize)
                 {
-                    const uint16_t region    = getRegion(_slotGroup);
-                    const uint16_t subRegion = _slotGroup - region*NumSubRegions;
+                    #if DM_HEAP_TLSF_IMPL
+                    // Search for free space.
+                    uint64_t slotSize;
+                    void* beg = findFreeSpace(_totalSize, slotSize);
+                    if (NULL != beg)
+                    {
+                        void* ptr = consumeFreeSpace(beg, slotSize, _totalSize);
 
-                    uint16_t first = m_regionInfo[region].m_first;
-                    if (subRegion == first)
+                        return ptr;
+                    }
+                    #else
+                    // Search for free space.
+                    if (_totalSize <= BiggestRegion)
                     {
-                        // Find and assign first.
-                        for (uint16_t ii = subRegion+1; ii < NumSubRegions; ++ii)
+                        uint16_t group = getSlotGroup(uint32_t(_totalSize));
+                        do
                         {
-                            if (m_freeSlotsCount[ii] > 0)
-                            {
-                                first = ii;
-                                break;
-                            }
-                        }
+                            #if DM_HEAP_ARRAY_IMPL
+                                const uint16_t count = m_freeSlotsCount[group];
+                                const __m128i totalSizeSplat = _mm_set1_epi32(uint32_t(_totalSize));
 
-                        if (subRegion == first)
-                        {
-                            // Region is empty.
-                            m_regionInfo[region].m_first = UINT16_MAX;
+                                uint16_t ii = 0;
+                                for (uint16_t end = ((count>>2)<<2); ii < end; ii+=4)
+                                {
+                                    const __m128i  sizes = _mm_load_si128((__m128i*)&m_freeSlotsSize[group][ii]);
+                                    const __m128i  cmp   = _mm_cmpgt_epi32(sizes, totalSizeSplat);
+                                    const uint32_t mask  = _mm_movemask_epi8(cmp);
+                                    if (mask != 0)
+                                    {
+                                        const int32_t idx = ii + (bx::uint32_cnttz(mask)/4);
+                                        const uint32_t slotSize = m_freeSlotsSize[group][idx];
+                                        void* ptr = consumeFreeSpace(group, idx, uint32_t(slotSize), uint32_t(_totalSize));
 
-                            // Reassign pointers to point to the next one.
-                            const uint16_t nextRegion = m_regionInfo[region].m_next;
-                            for (uint16_t ii = 0; ii < region; ++ii)
-                            {
-                                if (m_regionInfo[ii].m_next == region)
+                                        return ptr;
+                                    }
+                                }
+
+                                for (uint16_t end = count; ii < end; ++ii)
                                 {
-                                    m_regionInfo[ii].m_next = nextRegion;
+                                    const uint32_t slotSize = m_freeSlotsSize[group][ii];
+                                    if (slotSize >= uint32_t(_totalSize))
+                                    {
+                                        void* ptr = consumeFreeSpace(group, ii, uint32_t(slotSize), uint32_t(_totalSize));
+
+                                        return ptr;
+                                    }
                                 }
-                                else
+                            #else
+                                FreeSlotList& freeSlotList = m_freeSlots[group];
+                                for (uint16_t ii = 0, end = freeSlotList.count(); ii < end; ++ii)
                                 {
-                                    break;
+                                    FreeSlot& slot = freeSlotList[ii];
+                                    if (slot.m_size > uint32_t(_totalSize))
+                                    {
+                                        void* ptr = consumeFreeSpace(group, ii, slot.m_size, uint32_t(_totalSize));
+
+                                        return ptr;
+                                    }
+
                                 }
-                            }
-                        }
-                        else
-                        {
-                            m_regionInfo[region].m_first = first;
-                        }
+                            #endif //DM_HEAP_ARRAY_IMPL
+
+                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
+                    }
+
+                    // Search for big space.
+                    void* beg = treeFindBestFit(_totalSize);
+                    if (NULL != beg)
+                    {
+                        void* ptr = consumeBigFreeSpace(beg, _totalSize);
+
+                        return ptr;
                     }
+                    #endif //DM_HEAP_TLSF_IMPL
+
+                    // Expand heap.
+                    if (getRemainingSpace() >= _totalSize)
+                    {
+                        void* ptr = expandHeap(_totalSize);
+
+                        return ptr;
+                    }
+
+                    return NULL;
                 }
 
-                uint16_t getSlotGroup(uint32_t _size)
+                void* realloc(void* _ptr, size_t _size)
                 {
-                    const uint32_t sizePwrTwo   = dm::nextPowTwo(_size);
-                    const uint32_t sizePwrTwoMB = sizePwrTwo >> 20;
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
 
-                    if (0 == sizePwrTwoMB)
+                    void* beg = ptrToBegin(_ptr);
+
+                    // Current size.
+                    const uint64_t currHeader    = readHeader(beg);
+                    const uint64_t currSize      = unpackSize(currHeader);
+                    const uint64_t currTotalSize = currSize + HeaderFooterSize;
+
+                    // Requested size.
+                    const size_t reqTotalSize = totalSizeFor(_size);
+
+                    if (reqTotalSize == currTotalSize)
                     {
-                        return 0;
+                        return _ptr;
                     }
 
-                    // Determine region.
-                    const uint32_t region = dm::max(0, int32_t(bx::uint32_cnttz(sizePwrTwoMB)) - SmallestRegionPwr);
+                    void*          rightBeg    = (uint8_t*)beg + currTotalSize;
+                    const uint64_t rightHeader = readHeader(rightBeg);
+                    const bool     rightFree   = isFree(rightHeader);
+                    const uint64_t rightTotalSize = rightFree ? unpackSize(rightHeader) + HeaderFooterSize : 0;
 
-                    // Determine subRegion.
-                    uint32_t subRegion = 0;
-                    const uint32_t leftover = sizePwrTwo - _size;
-                    if (0 != leftover)
+                    if (reqTotalSize < currTotalSize)
                     {
-                        const uint32_t subRegionSize = (sizePwrTwo - (sizePwrTwo>>1))/NumSubRegions;
-                        subRegion = leftover/subRegionSize;
-                    }
+                        // Shrink, the tail is merged with a free right neighbour.
 
-                    // Determine slot group.
-                    const uint32_t slotGroup = region*NumSubRegions+subRegion;
+                        uint64_t leftoverSize = currTotalSize - reqTotalSize;
+                        uint8_t* dirtyEnd     = (uint8_t*)rightBeg;
+                        if (rightFree)
+                        {
+                            removeSpace(rightBeg, rightHeader);
+                            leftoverSize += rightTotalSize;
+                            dirtyEnd     += isDecommitted(rightTotalSize) ? 0 : rightTotalSize;
+                        }
 
-                    CS_CHECK(slotGroup < NumRegions*NumSubRegions, "Invalid slot group %d/%d [slotGroup][max].", slotGroup, NumRegions*NumSubRegions);
+                        if (leftoverSize > MinimalSlotSize)
+                        {
+                            // Consume and add leftover.
+                            writeHeaderFooter(beg, reqTotalSize);
 
-                    return uint16_t(slotGroup);
-                }
+                            void* leftoverBeg = (uint8_t*)beg + reqTotalSize;
+                            decommitFreeSpace(leftoverBeg, leftoverSize, leftoverBeg, dirtyEnd);
+                            addSpace(leftoverBeg, leftoverSize);
+                        }
+                        else
+                        {
+                            // Consume entire slot.
+                            writeHeaderFooter(beg, reqTotalSize + leftoverSize);
+                        }
 
-                void addFreeSpace(void* _ptr, uint32_t _size)
-                {
-                    DM_CHECK(_size >= HeaderFooterSize, "Error _size param is invalid.");
+                        #if DM_ALLOC_PRINT_STATS
+                        m_reallocInPlace++;
+                        #endif //DM_ALLOC_PRINT_STATS
 
-                    const uint16_t group = getSlotGroup(_size);
+                        return _ptr;
+                    }
 
-                    #if DM_HEAP_ARRAY_IMPL
-                        const uint16_t count = m_freeSlotsCount[group];
-                        const uint16_t max   = m_freeSlotsMax[group/NumRegions];
-                        //TODO: Print warning if count >= max.
-                        if (max > count)
+                    // Grow into a free right neighbour.
+                    const uint64_t expandSize = reqTotalSize - currTotalSize;
+                    if (rightTotalSize >= expandSize)
+                    {
+                        removeSpace(rightBeg, rightHeader);
+
+                        const uint64_t leftoverSize = rightTotalSize - expandSize;
+                        if (leftoverSize > MinimalSlotSize)
                         {
-                            registerSlotGroup(group);
+                            // Consume and add leftover.
+                            writeHeaderFooter(beg, reqTotalSize);
 
-                            const uint32_t last = m_freeSlotsCount[group]++;
-                            m_freeSlotsSize[group][last] = _size;
-                            m_freeSlotsPtr [group][last] = _ptr;
+                            void* leftoverBeg = (uint8_t*)rightBeg + expandSize;
+                            addSpace(leftoverBeg, leftoverSize);
                         }
-                        writeHeaderFooter(_ptr, (uint64_t)_size, false);
-                    #else
-                        //TODO: Print warning if count >= max.
-                        if (m_freeSlots[group].count() < m_freeSlots[group].max())
+                        else
                         {
-                            registerSlotGroup(group);
+                            // Consume entire slot.
+                            writeHeaderFooter(beg, currTotalSize + rightTotalSize);
+                        }
 
-                            FreeSlot* freeSlot = m_freeSlots[group].addNew();
-                            freeSlot->m_size = _size;
-                            freeSlot->m_ptr  = _ptr;
-                            const uint16_t handle = m_freeSlots[group].getHandleOf(freeSlot);
-                            writeHeaderFooter(_ptr, (uint64_t)_size, group, handle, false);
+                        #if DM_ALLOC_PRINT_STATS
+                        m_reallocInPlace++;
+                        #endif //DM_ALLOC_PRINT_STATS
+
+                        return _ptr;
+                    }
+
+                    // Grow at the heap boundary. The heap grows toward lower addresses, so the block
+                    // takes the newly expanded space and its payload is moved down, within the same span.
+                    if (UINT64_MAX == readLeftHeader(beg))
+                    {
+                        const uint64_t missingSize = expandSize - rightTotalSize;
+                        if (getRemainingSpace() >= missingSize)
+                        {
+                            if (rightFree)
+                            {
+                                removeSpace(rightBeg, rightHeader);
+                            }
+
+                            *m_end -= missingSize;
+                            uint64_t* terminator = (uint64_t*)*m_end;
+                            *terminator = UINT64_MAX;
+                            trackLowWater();
+
+                            uint8_t* newBeg = *m_end+sizeof(uint64_t);
+                            memmove(newBeg+HeaderSize, _ptr, size_t(currSize));
+                            void* ptr = writeHeaderFooter(newBeg, reqTotalSize);
+
+                            #if DM_ALLOC_PRINT_STATS
+                            m_reallocMoved++;
+                            #endif //DM_ALLOC_PRINT_STATS
+
+                            return ptr;
                         }
-                        else
+                    }
+
+                    #if DM_ALLOC_PRINT_STATS
+                    m_reallocFailed++;
+                    #endif //DM_ALLOC_PRINT_STATS
+
+                    return NULL;
+                }
+
+                void free(void* _ptr)
+                {
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
+
+                    freeLocked(_ptr);
+                }
+
+                /// Returns the number of blocks allocated, stops at the first failure.
+                uint32_t allocBatch(size_t _size, uint32_t _count, void** _ptrs)
+                {
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
+
+                    const size_t totalSize = totalSizeFor(_size);
+
+                    uint32_t num = 0;
+                    for (; num < _count; ++num)
+                    {
+                        _ptrs[num] = allocLocked(totalSize);
+                        if (NULL == _ptrs[num])
+                        {
+                            break;
+                        }
+                    }
+
+                    return num;
+                }
+
+                void freeBatch(void** _ptrs, uint32_t _count)
+                {
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees();
+
+                    for (uint32_t ii = 0; ii < _count; ++ii)
+                    {
+                        freeLocked(_ptrs[ii]);
+                    }
+                }
+
+                /// Used for blocks freed by threads that do not own this heap.
+                /// Lock-free, the block is linked through its payload and released by the next thread that locks the heap.
+                void remoteFree(void* _ptr)
+                {
+                    for (;;)
+                    {
+                        void* head = m_remoteFree;
+                        *(void**)_ptr = head;
+                        if (head == dm::atomicCompareAndSwapPtr(&m_remoteFree, head, _ptr))
                         {
-                            writeHeaderFooter(_ptr, (uint64_t)_size, group, DM_HandleMax, false);
+                            return;
                         }
-                    #endif //DM_HEAP_ARRAY_IMPL
+                    }
                 }
 
-                void addBigFreeSpace(void* _ptr, uint64_t _size)
+                /// Expects m_mutex to be locked.
+                /// Takes the whole list at once, pushes never compete with a pop of a single element, so there is no ABA.
+                void drainRemoteFrees()
                 {
-                    CS_CHECK(m_bigFreeSlotsCount < 32
-                           , "There are not enough slots big allocations. %d/%d", m_bigFreeSlotsCount, 32);
+                    if (NULL == m_remoteFree)
+                    {
+                        return;
+                    }
 
-                    const uint32_t last = m_bigFreeSlotsCount++;
-                    m_bigFreeSlotsSize[last] = _size;
-                    m_bigFreeSlotsPtr [last] = _ptr;
-                    writeHeaderFooter(_ptr, _size, false);
+                    void* ptr = dm::atomicExchangePtr(&m_remoteFree, NULL);
+                    while (NULL != ptr)
+                    {
+                        void* next = *(void**)ptr;
+                        freeLocked(ptr);
+                        ptr = next;
+                    }
                 }
 
-                void addSpace(void* _ptr, uint64_t _size)
+                void freeLocked(void* _ptr)
                 {
-                    if (_size <= BiggestRegion)
+                    void* beg = ptrToBegin(_ptr);
+
+                    const uint64_t usedSize = readHeader(beg);
+                    const uint64_t size = unpackSize(usedSize);
+                    const uint64_t totalSize = size + HeaderFooterSize;
+
+                    uint64_t freeSize = totalSize;
+                    uint8_t* freePtr  = (uint8_t*)beg;
+
+                    // Only the block and neighbours too small to have been decommitted may hold committed pages.
+                    uint8_t* dirtyBeg = (uint8_t*)beg;
+                    uint8_t* dirtyEnd = (uint8_t*)beg + totalSize;
+
+                    // Right.
+                    void*    rightBeg = (uint8_t*)beg + totalSize;
+                    uint64_t rightHeader = readHeader(rightBeg);
+                    if (isFree(rightHeader))
                     {
-                        addFreeSpace(_ptr, uint32_t(_size));
+                        const uint64_t rightSize      = unpackSize(rightHeader);
+                        const uint64_t rightTotalSize = rightSize + HeaderFooterSize;
+
+                        removeSpace(rightBeg, rightHeader);
+
+                        freeSize += rightTotalSize;
+                        dirtyEnd += isDecommitted(rightTotalSize) ? 0 : rightTotalSize;
                     }
-                    else
+
+                    // Left.
+                    const uint64_t leftHeader = readLeftHeader(beg);
+                    if (UINT64_MAX == leftHeader)
                     {
-                        addBigFreeSpace(_ptr, _size);
+                        decommitFreeSpace(*m_end, freeSize, dirtyBeg, dirtyEnd);
+
+                        *m_end += freeSize;
+
+                        uint64_t* terminator = (uint64_t*)*m_end;
+                        *terminator = UINT64_MAX;
+
+                        return;
                     }
-                }
+                    else
+                    {
+                        const bool leftUsed = unpackUsed(leftHeader);
+                        if (!leftUsed)
+                        {
+                            const uint64_t leftSize      = unpackSize(leftHeader);
+                            const uint64_t leftTotalSize = leftSize + HeaderFooterSize;
 
-                void removeFreeSlot(uint16_t _group, uint32_t _idx)
-                {
-                    #if DM_HEAP_ARRAY_IMPL
-                        const uint32_t last = --m_freeSlotsCount[_group];
-                        m_freeSlotsSize[_group][_idx] = m_freeSlotsSize[_group][last];
-                        m_freeSlotsPtr [_group][_idx] = m_freeSlotsPtr [_group][last];
-                    #else
-                        m_freeSlots[_group].removeAt(_idx);
-                    #endif //DM_HEAP_ARRAY_IMPL
+                            void* leftBeg = (uint8_t*)beg - leftTotalSize;
+                            removeSpace(leftBeg, leftHeader);
 
-                    unregisterSlotGroup(_group);
-                }
+                            freeSize += leftTotalSize;
+                            freePtr  -= leftTotalSize;
+                            dirtyBeg  = isDecommitted(leftTotalSize) ? dirtyBeg : freePtr;
+                        }
+                    }
 
-                void removeBigFreeSlot(uint32_t _idx)
-                {
-                    const uint32_t last = --m_bigFreeSlotsCount;
-                    m_bigFreeSlotsSize[_idx] = m_bigFreeSlotsSize[last];
-                    m_bigFreeSlotsPtr [_idx] = m_bigFreeSlotsPtr [last];
+                    decommitFreeSpace(freePtr, freeSize, dirtyBeg, dirtyEnd);
+                    addSpace(freePtr, freeSize);
                 }
 
-                #if DM_HEAP_ARRAY_IMPL
-                    bool removeFreeSpaceRef(void* _ptr, uint32_t _size)
+                // Relocation.
+                //-----
+
+                #if !DM_HEAP_LIST_IMPL
+                    /// The block starts with a link to '_entry', the returned pointer follows it. Sets '_entry->m_ptr'.
+                    void* allocRelocatable(size_t _size, RelocEntry* _entry)
                     {
-                        uint16_t group = getSlotGroup(_size);
-                        do
+                        bx::LwMutexScope lock(m_mutex);
+                        drainRemoteFrees();
+
+                        uint8_t* ptr = (uint8_t*)allocLocked(totalSizeFor(_size + RelocEntry::PrefixSize));
+                        if (NULL == ptr)
                         {
-                            for (uint32_t ii = 0, end = m_freeSlotsCount[group]; ii < end; ++ii)
-                            {
-                                if (m_freeSlotsPtr[group][ii] == _ptr)
-                                {
-                                    removeFreeSlot(group, ii);
+                            return NULL;
+                        }
 
-                                    return true;
-                                }
-                            }
+                        uint64_t* header = (uint64_t*)ptrToBegin(ptr);
+                        uint64_t* footer = (uint64_t*)(ptr + unpackSize(*header));
+                        *header |= DM_RelocMask;
+                        *footer |= DM_RelocMask;
 
-                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
+                        // Set under the lock, compact() may move the block right after.
+                        *(RelocEntry**)ptr = _entry;
+                        _entry->m_ptr = ptr + RelocEntry::PrefixSize;
 
-                        return false;
+                        return _entry->m_ptr;
                     }
 
-                    bool removeFreeSpaceSSE(void* _ptr, uint32_t _size)
+                    /// Walks down from m_begin and moves unpinned relocatable blocks to the right, over the free blocks next to them.
+                    /// Free space gathers towards the low boundary, where freeLocked() hands it back to the stack region.
+                    /// Stops once '_budget' bytes are moved or memTimeNs() passes '_deadline' (0 for none), returns the number of bytes moved.
+                    size_t compact(size_t _budget, uint64_t _deadline)
                     {
-                        const __m128i ptrsplat = _mm_set1_epi64x(int64_t(_ptr));
+                        bx::LwMutexScope lock(m_mutex);
+                        drainRemoteFrees();
 
-                        uint16_t group = getSlotGroup(_size);
-                        do
+                        size_t moved = 0;
+                        uint32_t steps = 0;
+                        uint8_t* beg = (uint8_t*)m_begin - sizeof(uint64_t); // Right terminator.
+                        while (moved < _budget)
                         {
-                            int32_t ii = 0;
-                            const int32_t count = (int32_t)m_freeSlotsCount[group];
-                            for (int32_t end = count-1; ii < end; ii+=2)
+                            if (0 != _deadline && 0 == (++steps&255) && memTimeNs() >= _deadline)
                             {
-                                const __m128i  ptrs = _mm_load_si128((__m128i*)&m_freeSlotsPtr[group][ii]);
-                                const __m128i  cmp  = _mm_cmpeq_epi64(ptrsplat, ptrs);
-                                const uint32_t mask = _mm_movemask_epi8(cmp);
-                                if (mask != 0)
-                                {
-                                    const uint32_t index = ii + (0xff00 == mask); // 'mask' can be either 0xff (0) or 0xff00 (1).
-                                    removeFreeSlot(group, index);
+                                break;
+                            }
 
-                                    return true;
-                                }
+                            const uint64_t leftHeader = readLeftHeader(beg);
+                            if (UINT64_MAX == leftHeader)
+                            {
+                                break;
                             }
-                            for (int32_t end = count; ii < end; ++ii)
+
+                            const uint64_t leftTotalSize = unpackSize(leftHeader) + HeaderFooterSize;
+                            uint8_t* leftBeg = beg - leftTotalSize;
+
+                            const uint64_t header = readHeader(beg);
+                            if (isFree(header) && unpackUsed(leftHeader) && 0 != (leftHeader&DM_RelocMask))
                             {
-                                if (m_freeSlotsPtr[group][ii] == _ptr)
+                                const uint64_t freeTotalSize = unpackSize(header) + HeaderFooterSize;
+                                if (relocate(leftBeg, leftTotalSize, freeTotalSize))
                                 {
-                                    removeFreeSlot(group, ii);
+                                    moved += size_t(leftTotalSize);
+                                    steps |= 255; // Check the time after every move.
 
-                                    return true;
+                                    // Space left behind is merged with the free block before it by now, continue from there.
+                                    beg = leftBeg + freeTotalSize;
+                                    continue;
                                 }
                             }
 
-                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
-
-                        return false;
-                    }
-
-                    bool removeFreeSpace(void* _ptr, uint32_t _size)
-                    {
-                        return removeFreeSpaceSSE(_ptr, _size);
-                    }
-                #else
-                    bool removeFreeSpace(uint16_t _group, uint16_t _handle)
-                    {
-                        if (_handle < DM_HandleMax)
-                        {
-                            m_freeSlots[_group].remove(_handle);
-                            unregisterSlotGroup(_group);
-                            return true;
+                            beg = leftBeg;
                         }
 
-                        return false;
+                        return moved;
                     }
-                #endif //DM_HEAP_ARRAY_IMPL
 
-                bool removeBigFreeSpaceRef(void* _ptr)
-                {
-                    for (uint32_t ii = 0, end = m_bigFreeSlotsCount; ii < end; ++ii)
+                    /// Expects m_mutex to be locked. Moves the relocatable block at '_beg' by '_offset', over the free block right of it.
+                    /// Returns false if the block is pinned or being freed.
+                    bool relocate(uint8_t* _beg, uint64_t _totalSize, uint64_t _offset)
                     {
-                        if (m_bigFreeSlotsPtr[ii] == _ptr)
-                        {
-                            removeBigFreeSlot(ii);
+                        // Relocatable blocks are freed under m_mutex, never remotely, and their entries only after that.
+                        // A used block with DM_RelocMask therefore links to a valid entry.
+                        RelocEntry* entry = *(RelocEntry**)(_beg + HeaderSize);
+                        DM_CHECK(entry->m_ptr == _beg + HeaderSize + RelocEntry::PrefixSize, "Heap::relocate | Entry does not point back to the block.");
 
-                            return true;
+                        if (0 != dm::atomicCompareAndSwap64(&entry->m_state, 0, RelocEntry::Moving))
+                        {
+                            return false;
                         }
-                    }
 
-                    return false;
-                }
+                        uint8_t* rightBeg = _beg + _totalSize;
+                        removeSpace(rightBeg, readHeader(rightBeg));
 
-                bool removeBigFreeSpaceSSE(void* _ptr)
-                {
-                    const __m128i ptrsplat = _mm_set1_epi64x(int64_t(_ptr));
+                        uint8_t* newBeg = _beg + _offset;
+                        memmove(newBeg, _beg, size_t(_totalSize));
+                        entry->m_ptr = newBeg + HeaderSize + RelocEntry::PrefixSize;
+                        dm::atomicFetchAndAnd64(&entry->m_state, ~RelocEntry::Moving);
 
-                    int32_t ii = 0;
-                    const int32_t count = m_bigFreeSlotsCount;
-                    DM_CHECK(0 != count, "There are no big free spaces for removal!");
-                    for (int32_t end = count-1; ii <= end; ii+=2)
-                    {
-                        const __m128i  ptrs = _mm_load_si128((__m128i*)&m_bigFreeSlotsPtr[ii]);
-                        const __m128i  cmp  = _mm_cmpeq_epi64(ptrsplat, ptrs);
-                        const uint32_t mask = _mm_movemask_epi8(cmp);
-                        if (mask != 0)
-                        {
-                            const uint32_t index = ii + (0xff00 == mask); // 'mask' can be either 0xff (0) or 0xff00 (1).
-                            removeBigFreeSlot(index);
+                        // Merges with a free left neighbour, or shrinks the heap when at the boundary.
+                        writeHeaderFooter(_beg, _offset);
+                        freeLocked(_beg + HeaderSize);
 
-                            return true;
-                        }
+                        return true;
                     }
-                    for (int32_t end = count; ii < end; ++ii)
+                #else
+                    // Header bits are taken by the group and handle, nothing is relocatable.
+                    void* allocRelocatable(size_t /*_size*/, RelocEntry* /*_entry*/)
                     {
-                        if (m_bigFreeSlotsPtr[ii] == _ptr)
-                        {
-                            removeBigFreeSlot(ii);
+                        return NULL;
+                    }
 
-                            return true;
-                        }
+                    size_t compact(size_t /*_budget*/, uint64_t /*_deadline*/)
+                    {
+                        return 0;
                     }
+                #endif //!DM_HEAP_LIST_IMPL
 
-                    return false;
+                size_t getSize(void* _ptr) const
+                {
+                    const void* beg = ptrToBegin(_ptr);
+                    const uint64_t header = readHeader(beg);
+                    const uint64_t size = unpackSize(header);
+
+                    return size_t(size);
                 }
 
-                bool removeBigFreeSpace(void* _ptr)
+                size_t getRemainingSpace() const
                 {
-                    return removeBigFreeSpaceSSE(_ptr);
+                    return size_t((uint8_t*)*m_end - *m_stackPtr - sizeof(uint64_t)); //Between stack and heap.
                 }
 
-                uint64_t packHeader(bool _used, uint64_t _size) const
+                size_t total() const
                 {
-                    return 0
-                         | ((uint64_t(_size)<<DM_SizeShift)&DM_SizeMask)
-                         | ((uint64_t(_used)<<DM_UsedShift)&DM_UsedMask)
-                         ;
+                    return (uint8_t*)m_begin - *m_end - 2*sizeof(uint64_t);
                 }
 
-                #if !DM_HEAP_ARRAY_IMPL
-                    uint64_t packHeader(bool _used, uint16_t _group, uint16_t _handle, uint64_t _size) const
-                    {
-                        return 0
-                             | ((uint64_t(_size)<<DM_SizeShift)&DM_SizeMask)
-                             | ((uint64_t(_handle)<<DM_HandleShift)&DM_HandleMask)
-                             | ((uint64_t(_group)<<DM_GroupShift)&DM_GroupMask)
-                             | ((uint64_t(_used)<<DM_UsedShift)&DM_UsedMask)
-                             ;
-                    }
-                #endif //DM_HEAP_ARRAY_IMPL
-
-                bool unpackUsed(uint64_t _header) const
+                bool contains(void* _ptr) const
                 {
-                    return DM_BOOL((_header&DM_UsedMask)>>DM_UsedShift);
+                    return (*m_end <= _ptr && _ptr < m_begin);
                 }
 
-                #if !DM_HEAP_ARRAY_IMPL
-                    uint16_t unpackHandle(uint64_t _header) const
+                /// Walks all blocks, adds up to '_stats'. Blocks freed by other threads and not collected yet count as used.
+                void getStats(AllocStats& _stats)
+                {
+                    bx::LwMutexScope lock(m_mutex);
+                    drainRemoteFrees(); // Blocks freed from other arenas count as free.
+
+                    for (uint8_t* beg = *m_end + sizeof(uint64_t);; )
                     {
-                        return uint16_t((_header&DM_HandleMask)>>DM_HandleShift);
+                        const uint64_t header = readHeader(beg);
+                        if (UINT64_MAX == header)
+                        {
+                            break;
+                        }
+
+                        const uint64_t totalSize = unpackSize(header) + HeaderFooterSize;
+                        if (unpackUsed(header))
+                        {
+                            _stats.m_heapUsed += totalSize;
+                        }
+                        else
+                        {
+                            _stats.m_heapFree += totalSize;
+                            _stats.m_heapLargestFree = dm::max(_stats.m_heapLargestFree, totalSize);
+                            _stats.m_heapFreeBlocks++;
+                        }
+                        _stats.m_heapSize += totalSize;
+
+                        beg += totalSize;
                     }
+                }
 
-                    uint16_t unpackGroup(uint64_t _header) const
+                #if DM_ALLOC_PRINT_STATS
+                void printStats()
+                {
+                    printf("Heap:\n");
+                    #if DM_HEAP_TLSF_IMPL
+                    uint32_t freeBlocks = 0;
+                    for (uint32_t fl = 0; fl < TlsfFlCount; ++fl)
                     {
-                        return uint16_t((_header&DM_GroupMask)>>DM_GroupShift);
+                        for (uint32_t sl = 0; sl < TlsfSlCount; ++sl)
+                        {
+                            for (void* beg = m_tlsfBlocks[fl][sl]; NULL != beg; beg = freeLinks(beg)->m_next)
+                            {
+                                ++freeBlocks;
+                            }
+                        }
                     }
-                #endif //DM_HEAP_ARRAY_IMPL
 
-                uint64_t unpackSize(uint64_t _header) const
-                {
-                    return uint64_t((_header&DM_SizeMask)>>DM_SizeShift);
+                    printf("\tTotal: %u.%uMB, Remaining: %u.%uMB, Free blocks: %u, Decommitted: %u.%uMB\n"
+                          , dm::U_UMB(total()), dm::U_UMB(getRemainingSpace())
+                          , freeBlocks
+                          , dm::U_UMB(m_decommitted)
+                          );
+                    #else
+                    printf("\tTotal: %u.%uMB, Remaining: %u.%uMB, Big free spans: %u, Decommitted: %u.%uMB\n"
+                          , dm::U_UMB(total()), dm::U_UMB(getRemainingSpace())
+                          , m_freeTreeCount
+                          , dm::U_UMB(m_decommitted)
+                          );
+                    #endif //DM_HEAP_TLSF_IMPL
+
+                    printf("\tRealloc: %u in place, %u moved within the heap boundary, %u copied\n\n"
+                          , m_reallocInPlace, m_reallocMoved, m_reallocFailed
+                          );
                 }
+                #endif //DM_ALLOC_PRINT_STATS
 
-                void* writeHeaderFooter(void* _begin, uint64_t _totalSize, bool _used = true)
-                {
-                    uint8_t* end = (uint8_t*)_begin+_totalSize;
+                bx::LwMutex m_mutex;
+                void* volatile m_remoteFree;
+                void*     m_begin;
+                uint8_t** m_end;
+                uint8_t** m_stackPtr;
+                uint8_t** m_stackHighWater;
+                uint8_t*  m_lowWater; // Lowest heap boundary so far, space below it was never used by the heap.
+                size_t    m_pageSize;
 
-                    uint64_t* header = (uint64_t*)_begin;
-                    void*     data   = (uint64_t*)_begin+1;
-                    uint64_t* footer = (uint64_t*)end-1;
+                #if DM_ALLOC_PRINT_STATS
+                uint64_t m_decommitted;
+                uint32_t m_reallocInPlace; // Grown or shrunk without moving.
+                uint32_t m_reallocMoved;   // Grown at the heap boundary, payload moved within its own span.
+                uint32_t m_reallocFailed;  // Copied to a new allocation by Memory::realloc().
+                #endif //DM_ALLOC_PRINT_STATS
 
-                    const uint64_t allocSize = _totalSize - HeaderFooterSize;
-                    const uint64_t headerData = packHeader(_used, allocSize);
-                    *header = headerData;
-                    *footer = headerData;
+                #if DM_HEAP_TLSF_IMPL
+                uint64_t m_tlsfFlBitmap;
+                uint32_t m_tlsfSlBitmap[TlsfFlCount];
+                void*    m_tlsfBlocks[TlsfFlCount][TlsfSlCount];
+                #else
+                void*    m_freeTree;
+                uint32_t m_freeTreeCount;
 
-                    return data;
-                }
+                struct RegionInfo
+                {
+                    uint16_t m_first;
+                    uint16_t m_next;
+                };
+                RegionInfo m_regionInfo[NumRegions];
+
+                uint16_t m_freeSlotsCount[NumRegions*NumSubRegions];
 
-                #if !DM_HEAP_ARRAY_IMPL
-                    void* writeHeaderFooter(const void* _begin, uint64_t _totalSize, uint16_t _group, uint16_t _handle, bool _used = true)
-                    {
-                        uint8_t* end = (uint8_t*)_begin+_totalSize;
+                #if DM_HEAP_ARRAY_IMPL
+                    uint16_t m_freeSlotsMax[NumRegions];
 
-                        uint64_t* header = (uint64_t*)_begin;
-                        void*     data   = (uint64_t*)_begin+1;
-                        uint64_t* footer = (uint64_t*)end-1;
+                    BX_ALIGN_DECL_16(uint32_t* m_freeSlotsSize[NumRegions*NumSubRegions]);
+                    #define DM_ALLOC_DEF(_regionIdx, _num) \
+                        BX_ALIGN_DECL_16(uint32_t m_freeSlotsSize ## _regionIdx [NumSubRegions][NumSlots ## _regionIdx]);
+                    #include "allocator_config.h"
 
-                        const uint64_t allocSize = _totalSize - HeaderFooterSize;
-                        const uint64_t headerData = packHeader(_used, _group, _handle, allocSize);
-                        *header = headerData;
-                        *footer = headerData;
+                    BX_ALIGN_DECL_16(void** m_freeSlotsPtr[NumRegions*NumSubRegions]);
+                    #define DM_ALLOC_DEF(_regionIdx, _num) \
+                        BX_ALIGN_DECL_16(void* m_freeSlotsPtr ## _regionIdx [NumSubRegions][NumSlots ## _regionIdx]);
+                    #include "allocator_config.h"
+                #else
+                    struct FreeSlot
+                    {
+                        uint32_t m_size;
+                        void*    m_ptr;
+                    };
+                    typedef dm::List<FreeSlot> FreeSlotList;
 
-                        return data;
-                    }
+                    FreeSlotList m_freeSlots[NumRegions*NumSubRegions];
+                    uint8_t m_freeSlotsData[TotalSlotCount*FreeSlotList::SizePerElement];
                 #endif //DM_HEAP_ARRAY_IMPL
+                #endif //DM_HEAP_TLSF_IMPL
+            };
 
-                bool isFree(uint64_t _header)
+            /// Additional memory, mapped once the arena is exhausted.
+            /// Segment object is placed at the beginning of its own memory:
+            ///
+            ///  Begin                                                               End
+            ///    .___.___________._________________________________________________.
+            ///    |Seg||||Small||||                          |..|  |..| <- Heap |...|
+            ///    |___|||||||||||||_________________________________________________|
+            ///
+            struct Segment
+            {
+                static size_t headerSize()
                 {
-                    return (UINT64_MAX != _header && !unpackUsed(_header));
+                    return dm::alignSizeNext(sizeof(Segment), SegregatedLists::GranuleSize);
                 }
 
-                void* ptrToBegin(void* _ptr) const
+                /// Biggest heap allocation that fits in an empty segment, slightly underestimated.
+                static size_t heapSize()
                 {
-                    uint64_t* begin = (uint64_t*)_ptr-1;
-                    return (void*)begin;
+                    const size_t used = headerSize() + SegregatedLists::DataSize + DM_KILOBYTES(1);
+                    return (DM_MEM_SEGMENT_SIZE > used) ? DM_MEM_SEGMENT_SIZE - used : 0;
                 }
 
-                uint64_t readHeader(const void* _beg) const
+                void init(void* _mem, size_t _size, size_t _pageSize)
                 {
-                    const uint64_t* header = (const uint64_t*)_beg;
-                    return *header;
-                }
+                    CS_CHECK(0 != heapSize(), "Segment::init | DM_MEM_SEGMENT_SIZE is too small.");
 
-                uint64_t readLeftHeader(const void* _beg) const
-                {
-                    const uint64_t* usedSize = (const uint64_t*)_beg-1;
-                    return *usedSize;
+                    m_mem  = _mem;
+                    m_size = _size;
+
+                    void* ptr = (uint8_t*)_mem + headerSize();
+                    ptr = m_segregatedLists.init(ptr, SegregatedLists::DataSize);
+
+                    // Heap grows backward from the end until it reaches the small lists.
+                    m_heapLimit = (uint8_t*)dm::alignPtrNext(ptr, DM_NATURAL_ALIGNMENT);
+                    m_heapEnd   = (uint8_t*)dm::alignPtrPrev((uint8_t*)_mem + _size, DM_NATURAL_ALIGNMENT);
+                    m_heap.init(&m_heapLimit, &m_heapEnd, _pageSize, &m_heapLimit);
                 }
 
-                void* consumeFreeSpace(uint32_t _group, uint32_t _idx, uint32_t _slotSize, uint32_t _consume)
+                /// '_zeroed' expects natural alignment, see Memory::callocZeroed().
+                void* alloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT, bool _zeroed = false)
                 {
-                    #if DM_HEAP_ARRAY_IMPL
-                        void* beg = m_freeSlotsPtr[_group][_idx];
-                    #else
-                        void* beg = m_freeSlots[_group][_idx].m_ptr;
-                    #endif //DM_HEAP_ARRAY_IMPL
-                    void* ptr;
-
-                    const uint32_t remainingSize = _slotSize - _consume;
-                    if (remainingSize > MinimalSlotSize)
+                    const uint32_t smallSize = m_segregatedLists.getAlignedSize(_size, _align);
+                    if (0 != smallSize)
                     {
-                        // Consume.
-                        ptr = writeHeaderFooter(beg, uint64_t(_consume));
-                        removeFreeSlot(_group, _idx);
+                        void* ptr = m_segregatedLists.alloc(smallSize);
+                        if (NULL != ptr)
+                        {
+                            if (_zeroed && m_segregatedLists.isDirty(ptr))
+                            {
+                                memset(ptr, 0, _size);
+                            }
 
-                        // Leftover.
-                        void* next = (uint8_t*)beg + _consume;
-                        addFreeSpace(next, remainingSize);
-                    }
-                    else
-                    {
-                        // Consume entire slot.
-                        ptr = writeHeaderFooter(beg, uint64_t(_slotSize));
-                        removeFreeSlot(_group, _idx);
+                            return ptr;
+                        }
                     }
 
-                    return ptr;
+                    return _zeroed ? m_heap.callocZeroed(_size) : m_heap.alignedAlloc(_size, _align);
                 }
 
-                void* consumeBigFreeSpace(uint32_t _idx, uint64_t _consume)
+                size_t getSize(void* _ptr) const
                 {
-                    // Consume.
-                    void* beg = m_bigFreeSlotsPtr[_idx];
-                    void* ptr = writeHeaderFooter(beg, _consume);
-
-                    // Leftover.
-                    void* next = (uint8_t*)beg + _consume;
-                    const uint64_t remainingSize = m_bigFreeSlotsSize[_idx] - _consume;
-
-                    if (remainingSize <= BiggestRegion)
+                    if (m_segregatedLists.contains(_ptr))
                     {
-                        removeBigFreeSlot(_idx);
-                        addBigFreeSpace(next, remainingSize);
+                        return m_segregatedLists.getSize(_ptr);
                     }
-                    else
+                    else if (m_heap.contains(_ptr))
                     {
-                        m_bigFreeSlotsSize[_idx] = remainingSize;
-                        m_bigFreeSlotsPtr [_idx] = next;
+                        return m_heap.getSize(_ptr);
                     }
 
-                    return ptr;
+                    return 0;
                 }
 
-                void* expandHeap(uint64_t _size)
+                SegregatedLists m_segregatedLists;
+                Heap            m_heap;
+                uint8_t* m_heapLimit; // Stays in place, same role as Memory::m_stackPtr.
+                uint8_t* m_heapEnd;
+                void*    m_mem;
+                size_t   m_size;
+            };
+
+            /// Allocations of at least DM_MEM_LARGE_OBJECT_THRESHOLD, each one in its own mapping.
+            /// Realloc remaps the pages instead of copying them, free gives the memory straight back to the OS.
+            /// Mappings are tracked in an open addressing hash table, which grows as needed.
+            /// They are page aligned, other pointers are rejected without taking the lock.
+            struct LargeObjects
+            {
+                struct Entry
                 {
-                    *m_end -= _size;
-                    uint64_t* terminator = (uint64_t*)*m_end;
-                    *terminator = UINT64_MAX;
+                    void*  m_ptr;
+                    size_t m_size;
+                };
 
-                    uint8_t* beg = *m_end+sizeof(uint64_t);
-                    void* ptr = writeHeaderFooter(beg, _size);
+                void init(size_t _pageSize)
+                {
+                    m_pageSize  = _pageSize;
+                    m_entries   = NULL;
+                    m_capacity  = 0;
+                    m_count     = 0;
+                    m_totalSize = 0;
 
-                    return ptr;
+                    #if DM_ALLOC_PRINT_STATS
+                    m_remaps    = 0;
+                    #endif //DM_ALLOC_PRINT_STATS
                 }
 
-                void* alloc(size_t _size)
+                /// Mappings are page aligned, a bigger '_align' needs to be a power of two.
+                void* alloc(size_t _size, size_t _align = 0)
                 {
-                    bx::LwMutexScope lock(m_mutex);
+                    const size_t size = dm::alignSizeNext(_size, m_pageSize);
 
-                    const size_t alignedSize = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
-                    const size_t totalSize   = alignedSize + HeaderFooterSize;
+                    bx::LwMutexScope lock(m_mutex);
 
-                    // Search for free space.
-                    if (totalSize <= BiggestRegion)
+                    if (!reserve())
                     {
-                        uint16_t group = getSlotGroup(uint32_t(totalSize));
-                        do
-                        {
-                            #if DM_HEAP_ARRAY_IMPL
-                                const uint16_t count = m_freeSlotsCount[group];
-                                const __m128i totalSizeSplat = _mm_set1_epi32(uint32_t(totalSize));
+                        return NULL;
+                    }
 
-                                uint16_t ii = 0;
-                                for (uint16_t end = ((count>>2)<<2); ii < end; ii+=4)
-                                {
-                                    const __m128i  sizes = _mm_load_si128((__m128i*)&m_freeSlotsSize[group][ii]);
-                                    const __m128i  cmp   = _mm_cmpgt_epi32(sizes, totalSizeSplat);
-                                    const uint32_t mask  = _mm_movemask_epi8(cmp);
-                                    if (mask != 0)
-                                    {
-                                        const int32_t idx = ii + (bx::uint32_cnttz(mask)/4);
-                                        const uint32_t slotSize = m_freeSlotsSize[group][idx];
-                                        void* ptr = consumeFreeSpace(group, idx, uint32_t(slotSize), uint32_t(totalSize));
+                    void* ptr = (_align > m_pageSize) ? dm::vmemReserveAligned(size, _align) : dm::vmemReserve(size);
+                    if (NULL == ptr)
+                    {
+                        return NULL;
+                    }
 
-                                        return ptr;
-                                    }
-                                }
+                    insert(ptr, size);
 
-                                for (uint16_t end = count; ii < end; ++ii)
-                                {
-                                    const uint32_t slotSize = m_freeSlotsSize[group][ii];
-                                    if (slotSize >= uint32_t(totalSize))
-                                    {
-                                        void* ptr = consumeFreeSpace(group, ii, uint32_t(slotSize), uint32_t(totalSize));
+                    DM_PRINT_EXT("LARGE ALLOC: %u.%uMB - (0x%p)", dm::U_UMB(size), ptr);
 
-                                        return ptr;
-                                    }
-                                }
-                            #else
-                                FreeSlotList& freeSlotList = m_freeSlots[group];
-                                for (uint16_t ii = 0, end = freeSlotList.count(); ii < end; ++ii)
-                                {
-                                    FreeSlot& slot = freeSlotList[ii];
-                                    if (slot.m_size > uint32_t(totalSize))
-                                    {
-                                        void* ptr = consumeFreeSpace(group, ii, slot.m_size, uint32_t(totalSize));
+                    return ptr;
+                }
 
-                                        return ptr;
-                                    }
+                /// Expects '_ptr' to be a large object. Returns NULL on failure, '_ptr' stays valid then.
+                void* realloc(void* _ptr, size_t _size)
+                {
+                    const size_t size = dm::alignSizeNext(_size, m_pageSize);
 
-                                }
-                            #endif //DM_HEAP_ARRAY_IMPL
+                    bx::LwMutexScope lock(m_mutex);
 
-                        } while (UINT16_MAX != (group = nextSlotGroup(group)));
-                    }
+                    const uint32_t idx = find(_ptr);
+                    CS_CHECK(UINT32_MAX != idx, "LargeObjects::realloc | Invalid pointer.");
 
-                    // Search for big space.
-                    for (uint8_t ii = m_bigFreeSlotsCount; ii--; )
+                    const size_t currSize = m_entries[idx].m_size;
+                    if (size == currSize)
                     {
-                        if (m_bigFreeSlotsSize[ii] >= totalSize)
-                        {
-                            void* ptr = consumeBigFreeSpace(ii, totalSize);
-
-                            return ptr;
-                        }
+                        return _ptr;
                     }
 
-                    // Expand heap.
-                    if (getRemainingSpace() >= totalSize)
+                    void* ptr = dm::vmemRemap(_ptr, currSize, size);
+                    if (NULL == ptr)
                     {
-                        void* ptr = expandHeap(totalSize);
-
-                        return ptr;
+                        return NULL;
                     }
 
-                    return NULL;
-                }
-
-                void* realloc(void* _ptr, size_t _size)
-                {
-                    bx::LwMutexScope lock(m_mutex);
+                    // Removal never fails and frees the entry for the insertion.
+                    removeAt(idx);
+                    insert(ptr, size);
 
-                    void* beg = ptrToBegin(_ptr);
+                    #if DM_ALLOC_PRINT_STATS
+                    m_remaps++;
+                    #endif //DM_ALLOC_PRINT_STATS
 
-                    // Current size.
-                    const uint64_t currHeader    = readHeader(beg);
-                    const uint64_t currSize      = unpackSize(currHeader);
-                    const uint64_t currTotalSize = currSize + HeaderFooterSize;
+                    DM_PRINT_EXT("LARGE REALLOC: %u.%uMB - (0x%p - 0x%p)", dm::U_UMB(size), _ptr, ptr);
 
-                    // Requested size.
-                    const size_t reqSize      = dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT);
-                    const size_t reqTotalSize = reqSize + HeaderFooterSize;
+                    return ptr;
+                }
 
-                    if (reqTotalSize == currTotalSize)
+                /// Returns false if '_ptr' is not a large object.
+                bool free(void* _ptr)
+                {
+                    if (!isPageAligned(_ptr))
                     {
-                        return _ptr;
+                        return false;
                     }
 
-                    if (reqTotalSize <= currTotalSize)
+                    size_t size;
                     {
-                        // Shrink.
-
-                        const size_t remainingSize = currTotalSize - reqTotalSize;
-                        if (remainingSize > MinimalSlotSize)
-                        {
-                            // Consume and add leftover.
-                            writeHeaderFooter(beg, reqTotalSize);
+                        bx::LwMutexScope lock(m_mutex);
 
-                            const uint64_t leftoverSize = currTotalSize - reqTotalSize;
-                            void*          leftoverBeg  = (uint8_t*)beg + reqTotalSize;
-                            addSpace(leftoverBeg, leftoverSize);
-                        }
-                        else
+                        const uint32_t idx = find(_ptr);
+                        if (UINT32_MAX == idx)
                         {
-                            // Consume entire slot.
-                            writeHeaderFooter(beg, currTotalSize);
+                            return false;
                         }
 
-                        return _ptr;
+                        size = m_entries[idx].m_size;
+                        removeAt(idx);
                     }
-                    else /*(reqTotalSize > currTotalSize).*/
-                    {
-                        // Try to expand.
 
-                        void*    rightBeg = (uint8_t*)beg + currTotalSize;
-                        uint64_t rightHeader = readHeader(rightBeg);
-                        if (isFree(rightHeader))
-                        {
-                            const uint64_t rightSize      = unpackSize(rightHeader);
-                            const uint64_t rightTotalSize = rightSize + HeaderFooterSize;
+                    dm::vmemRelease(_ptr, size);
 
-                            const uint64_t expandSize = reqTotalSize - currTotalSize;
+                    DM_PRINT_EXT("~LARGE FREE: %u.%uMB - (0x%p)", dm::U_UMB(size), _ptr);
 
-                            if (rightTotalSize >= expandSize)
-                            {
-                                if (rightTotalSize <= BiggestRegion)
-                                {
-                                    #if DM_HEAP_ARRAY_IMPL
-                                        removeFreeSpace(rightBeg, uint32_t(rightTotalSize));
-                                    #else
-                                        const uint16_t group  = unpackGroup(rightHeader);
-                                        const uint16_t handle = unpackHandle(rightHeader);
-                                        removeFreeSpace(group, handle);
-                                    #endif //DM_HEAP_ARRAY_IMPL
-                                }
-                                else
-                                {
-                                    removeBigFreeSpace(rightBeg);
-                                }
+                    return true;
+                }
 
-                                const size_t remainingSize = rightTotalSize - expandSize;
-                                if (remainingSize > MinimalSlotSize)
-                                {
-                                    // Consume and add leftover.
-                                    writeHeaderFooter(beg, reqTotalSize);
+                /// Returns 0 if '_ptr' is not a large object.
+                size_t getSize(void* _ptr)
+                {
+                    if (!isPageAligned(_ptr))
+                    {
+                        return 0;
+                    }
 
-                                    const uint64_t leftoverSize = rightTotalSize     - expandSize;
-                                    void*          leftoverBeg  = (uint8_t*)rightBeg + expandSize;
-                                    addSpace(leftoverBeg, leftoverSize);
-                                }
-                                else
-                                {
-                                    // Consume entire slot.
-                                    writeHeaderFooter(beg, rightTotalSize);
-                                }
+                    bx::LwMutexScope lock(m_mutex);
 
-                                return _ptr;
-                            }
-                        }
-                    }
+                    const uint32_t idx = find(_ptr);
+                    return (UINT32_MAX == idx) ? 0 : m_entries[idx].m_size;
+                }
 
-                    return NULL;
+                bool contains(void* _ptr)
+                {
+                    return 0 != getSize(_ptr);
                 }
 
-                void free(void* _ptr)
+                void getStats(AllocStats& _stats)
                 {
                     bx::LwMutexScope lock(m_mutex);
 
-                    void* beg = ptrToBegin(_ptr);
-
-                    const uint64_t usedSize = readHeader(beg);
-                    const uint64_t size = unpackSize(usedSize);
-                    const uint64_t totalSize = size + HeaderFooterSize;
-
-                    uint64_t freeSize = totalSize;
-                    uint8_t* freePtr  = (uint8_t*)beg;
-
-                    // Right.
-                    void*    rightBeg = (uint8_t*)beg + totalSize;
-                    uint64_t rightHeader = readHeader(rightBeg);
-                    if (isFree(rightHeader))
-                    {
-                        const uint64_t rightSize      = unpackSize(rightHeader);
-                        const uint64_t rightTotalSize = rightSize + HeaderFooterSize;
-
-                        if (rightTotalSize <= BiggestRegion)
-                        {
-                            #if DM_HEAP_ARRAY_IMPL
-                                removeFreeSpace(rightBeg, uint32_t(rightTotalSize));
-                            #else
-                                const uint16_t group  = unpackGroup(rightHeader);
-                                const uint16_t handle = unpackHandle(rightHeader);
-                                removeFreeSpace(group, handle);
-                            #endif //DM_HEAP_ARRAY_IMPL
-                        }
-                        else
-                        {
-                            removeBigFreeSpace(rightBeg);
-                        }
+                    _stats.m_largeObjects     = m_count;
+                    _stats.m_largeObjectBytes = m_totalSize;
+                }
 
-                        freeSize += rightTotalSize;
-                    }
+                #if DM_ALLOC_PRINT_STATS
+                void printStats()
+                {
+                    bx::LwMutexScope lock(m_mutex);
 
-                    // Left.
-                    const uint64_t leftHeader = readLeftHeader(beg);
-                    if (UINT64_MAX == leftHeader)
-                    {
-                        *m_end += freeSize;
+                    printf("Large objects: %u, total %u.%uMB, remapped %u times\n\n"
+                          , m_count, dm::U_UMB(m_totalSize), m_remaps
+                          );
+                }
+                #endif //DM_ALLOC_PRINT_STATS
 
-                        uint64_t* terminator = (uint64_t*)*m_end;
-                        *terminator = UINT64_MAX;
+            private:
+                bool isPageAligned(const void* _ptr) const
+                {
+                    return (NULL != _ptr && 0 == (uintptr_t(_ptr) & (m_pageSize-1)));
+                }
 
-                        return;
+                uint32_t slotOf(const void* _ptr) const
+                {
+                    const uint64_t key = uint64_t(uintptr_t(_ptr)/m_pageSize);
+                    return uint32_t((key*UINT64_C(0x9e3779b97f4a7c15))>>32) & (m_capacity-1);
+                }
+
+                /// Returns UINT32_MAX if not found.
+                uint32_t find(const void* _ptr) const
+                {
+                    if (0 == m_capacity)
+                    {
+                        return UINT32_MAX;
                     }
-                    else
+
+                    const uint32_t mask = m_capacity-1;
+                    for (uint32_t ii = slotOf(_ptr); NULL != m_entries[ii].m_ptr; ii = (ii+1)&mask)
                     {
-                        const bool leftUsed = unpackUsed(leftHeader);
-                        if (!leftUsed)
+                        if (_ptr == m_entries[ii].m_ptr)
                         {
-                            const uint64_t leftSize      = unpackSize(leftHeader);
-                            const uint64_t leftTotalSize = leftSize + HeaderFooterSize;
-
-                            void* leftBeg = (uint8_t*)beg - leftTotalSize;
-                            if (leftTotalSize <= BiggestRegion)
-                            {
-                                #if DM_HEAP_ARRAY_IMPL
-                                    removeFreeSpace(leftBeg, uint32_t(leftTotalSize));
-                                #else
-                                    const uint16_t group  = unpackGroup(leftHeader);
-                                    const uint16_t handle = unpackHandle(leftHeader);
-                                    removeFreeSpace(group, handle);
-                                #endif //DM_HEAP_ARRAY_IMPL
-                            }
-                            else
-                            {
-                                removeBigFreeSpace(leftBeg);
-                            }
-
-                            freeSize += leftTotalSize;
-                            freePtr  -= leftTotalSize;
+                            return ii;
                         }
                     }
 
-                    addSpace(freePtr, freeSize);
+                    return UINT32_MAX;
                 }
 
-                size_t getSize(void* _ptr) const
+                /// Expects reserve() to be called first.
+                void insert(void* _ptr, size_t _size)
                 {
-                    const void* beg = ptrToBegin(_ptr);
-                    const uint64_t header = readHeader(beg);
-                    const uint64_t size = unpackSize(header);
+                    const uint32_t mask = m_capacity-1;
 
-                    return size_t(size);
-                }
+                    uint32_t ii = slotOf(_ptr);
+                    while (NULL != m_entries[ii].m_ptr)
+                    {
+                        ii = (ii+1)&mask;
+                    }
 
-                size_t getRemainingSpace() const
-                {
-                    return size_t((uint8_t*)*m_end - *m_stackPtr - sizeof(uint64_t)); //Between stack and heap.
+                    m_entries[ii].m_ptr  = _ptr;
+                    m_entries[ii].m_size = _size;
+                    m_count++;
+                    m_totalSize += _size;
                 }
 
-                size_t total() const
+                /// Entries following the removed one are shifted back, so that lookups never stop early.
+                void removeAt(uint32_t _idx)
                 {
-                    return (uint8_t*)m_begin - *m_end - 2*sizeof(uint64_t);
-                }
+                    m_totalSize -= m_entries[_idx].m_size;
 
-                bool contains(void* _ptr) const
-                {
-                    return (*m_end <= _ptr && _ptr < m_begin);
-                }
+                    const uint32_t mask = m_capacity-1;
 
-                bx::LwMutex m_mutex;
-                void*     m_begin;
-                uint8_t** m_end;
-                uint8_t** m_stackPtr;
+                    uint32_t hole = _idx;
+                    for (uint32_t ii = (_idx+1)&mask; NULL != m_entries[ii].m_ptr; ii = (ii+1)&mask)
+                    {
+                        // Move the entry to the hole, unless the hole is before its home slot.
+                        const uint32_t home = slotOf(m_entries[ii].m_ptr);
+                        if (((ii-home)&mask) >= ((ii-hole)&mask))
+                        {
+                            m_entries[hole] = m_entries[ii];
+                            hole = ii;
+                        }
+                    }
 
-                uint8_t  m_bigFreeSlotsCount;
-                uint64_t m_bigFreeSlotsSize[MaxBigFreeSlots];
-                void*    m_bigFreeSlotsPtr [MaxBigFreeSlots];
+                    m_entries[hole].m_ptr = NULL;
+                    m_count--;
+                }
 
-                struct RegionInfo
+                /// Makes room for one more entry, keeping the table at most half full.
+                bool reserve()
                 {
-                    uint16_t m_first;
-                    uint16_t m_next;
-                };
-                RegionInfo m_regionInfo[NumRegions];
+                    if (2*(m_count+1) <= m_capacity)
+                    {
+                        return true;
+                    }
 
-                uint16_t m_freeSlotsCount[NumRegions*NumSubRegions];
+                    const uint32_t capacity = (0 == m_capacity) ? 64 : m_capacity*2;
+                    const size_t   size     = dm::alignSizeNext(capacity*sizeof(Entry), m_pageSize);
+                    Entry* entries = (Entry*)dm::vmemReserve(size);
+                    if (NULL == entries)
+                    {
+                        return false;
+                    }
+                    memset(entries, 0, capacity*sizeof(Entry));
 
-                #if DM_HEAP_ARRAY_IMPL
-                    uint16_t m_freeSlotsMax[NumRegions];
+                    Entry*         prevEntries  = m_entries;
+                    const uint32_t prevCapacity = m_capacity;
 
-                    BX_ALIGN_DECL_16(uint32_t* m_freeSlotsSize[NumRegions*NumSubRegions]);
-                    #define DM_ALLOC_DEF(_regionIdx, _num) \
-                        BX_ALIGN_DECL_16(uint32_t m_freeSlotsSize ## _regionIdx [NumSubRegions][NumSlots ## _regionIdx]);
-                    #include "allocator_config.h"
+                    m_entries   = entries;
+                    m_capacity  = capacity;
+                    m_count     = 0;
+                    m_totalSize = 0;
 
-                    BX_ALIGN_DECL_16(void** m_freeSlotsPtr[NumRegions*NumSubRegions]);
-                    #define DM_ALLOC_DEF(_regionIdx, _num) \
-                        BX_ALIGN_DECL_16(void* m_freeSlotsPtr ## _regionIdx [NumSubRegions][NumSlots ## _regionIdx]);
-                    #include "allocator_config.h"
-                #else
-                    struct FreeSlot
+                    for (uint32_t ii = 0; ii < prevCapacity; ++ii)
                     {
-                        uint32_t m_size;
-                        void*    m_ptr;
-                    };
-                    typedef dm::List<FreeSlot> FreeSlotList;
+                        if (NULL != prevEntries[ii].m_ptr)
+                        {
+                            insert(prevEntries[ii].m_ptr, prevEntries[ii].m_size);
+                        }
+                    }
 
-                    FreeSlotList m_freeSlots[NumRegions*NumSubRegions];
-                    uint8_t m_freeSlotsData[TotalSlotCount*FreeSlotList::SizePerElement];
-                #endif //DM_HEAP_ARRAY_IMPL
+                    if (NULL != prevEntries)
+                    {
+                        dm::vmemRelease(prevEntries, dm::alignSizeNext(prevCapacity*sizeof(Entry), m_pageSize));
+                    }
+
+                    return true;
+                }
+
+                bx::LwMutex m_mutex;
+                Entry*      m_entries;
+                uint32_t    m_capacity;
+                uint32_t    m_count;
+                size_t      m_pageSize;
+                uint64_t    m_totalSize;
+
+                #if DM_ALLOC_PRINT_STATS
+                uint32_t m_remaps;
+                #endif //DM_ALLOC_PRINT_STATS
             };
 
+            void* largeRealloc(void* _ptr, size_t _size)
+            {
+                if (_size >= DM_MEM_LARGE_OBJECT_THRESHOLD)
+                {
+                    void* ptr = m_largeObjects.realloc(_ptr, _size);
+                    if (NULL != ptr)
+                    {
+                        return ptr;
+                    }
+                }
+
+                // Leaves the tier, or remapping failed.
+                void* newPtr = this->alloc(_size);
+                if (NULL == newPtr)
+                {
+                    newPtr = externalAlloc(_size);
+                    if (NULL == newPtr)
+                    {
+                        return NULL;
+                    }
+                }
+
+                const size_t currSize = m_largeObjects.getSize(_ptr);
+                memcpy(newPtr, _ptr, dm::min(currSize, _size));
+                m_largeObjects.free(_ptr);
+
+                return newPtr;
+            }
+
             StaticStorage   m_staticStorage;
             SegregatedLists m_segregatedLists;
             DynamicStack    m_stack;
             Heap            m_heap;
+            LargeObjects    m_largeObjects;
+
+            #if DM_ALLOC_THREAD_STACKS
+            bx::LwMutex  m_threadStackMutex;
+            ThreadStack* m_threadStackPool;
+            ThreadStack* m_threadStacks;
+            static BX_THREAD ThreadStack* s_threadStack;
+            static BX_THREAD bool         s_mainThread; // Set for the thread that called init(), it uses m_stack.
+            #endif //DM_ALLOC_THREAD_STACKS
+
+            bx::LwMutex       m_segmentsMutex;
+            volatile uint32_t m_numSegments;
+            Segment*          m_segments[DM_MEM_MAX_SEGMENTS+1];
+
+            #if DM_ALLOC_HEAP_ARENAS > 1
+            volatile uint32_t   m_nextArena;
+            Segment* volatile   m_arenas[DM_ALLOC_HEAP_ARENAS];
+            static BX_THREAD uint32_t s_threadArena; // Assigned arena index + 1, 0 if not assigned yet.
+            #endif //DM_ALLOC_HEAP_ARENAS > 1
 
             uint8_t* m_stackPtr;
             uint8_t* m_heapEnd;
+            uint8_t* m_stackHighWater; // Highest m_stackPtr so far, see Heap::callocZeroed().
             void*    m_memory;
             size_t   m_size;
+            size_t   m_pageSize;
+            dm::PageMode::Enum m_pageMode;
             void*    m_orig;
-            #if DM_ALLOC_PRINT_STATS
-            uint16_t m_externalAlloc;
-            uint16_t m_externalFree;
-            size_t   m_externalSize;
-            #endif //DM_ALLOC_PRINT_STATS
+            #if (DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS) && BX_PLATFORM_POSIX
+            pthread_key_t m_threadExitKey;
+            #endif // (DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS) && BX_PLATFORM_POSIX
+            volatile uint64_t m_externalAlloc;
+            volatile uint64_t m_externalFree;
+            volatile uint64_t m_externalSize;
         };
         static Memory s_memory;
 
+        const uint32_t Memory::SegregatedLists::s_sizes[Memory::SegregatedLists::Count] =
+        {
+            #define DM_SMALL_ALLOC_DEF(_idx, _size, _num) \
+                _size,
+            #include "allocator_config.h"
+        };
+
+        #if DM_ALLOC_THREAD_CACHE
+        BX_THREAD Memory::ThreadCache Memory::s_threadCache;
+        #endif //DM_ALLOC_THREAD_CACHE
+
+        #if DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS
+        BX_THREAD bool Memory::s_threadRegistered;
+        BX_THREAD bool Memory::s_threadExited;
+        #endif // DM_ALLOC_THREAD_CACHE || DM_ALLOC_THREAD_STACKS
+
+        #if DM_ALLOC_THREAD_STACKS
+        BX_THREAD Memory::ThreadStack* Memory::s_threadStack;
+        BX_THREAD bool Memory::s_mainThread;
+        #endif //DM_ALLOC_THREAD_STACKS
+
+        #if DM_ALLOC_HEAP_ARENAS > 1
+        BX_THREAD uint32_t Memory::s_threadArena;
+        #endif //DM_ALLOC_HEAP_ARENAS > 1
+
         template <typename StackTy>
         struct StackAllocatorImpl : public dm::StackAllocatorI
         {
@@ -1747,12 +4450,12 @@ namespace dm
 
             virtual void* alloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT, const char* _file = NULL, uint32_t _line = 0) BX_OVERRIDE
             {
-                BX_UNUSED(_align, _file, _line);
+                BX_UNUSED(_file, _line);
 
-                void* ptr = m_stack.alloc(_size);
+                void* ptr = m_stack.alloc(_size, _align);
                 if (NULL == ptr)
                 {
-                    ptr = s_memory.alloc(_size);
+                    ptr = s_memory.alignedAlloc(_size, _align);
                 }
 
                 return ptr;
@@ -1770,12 +4473,12 @@ namespace dm
 
             virtual void* realloc(void* _ptr, size_t _size, size_t _align = DM_NATURAL_ALIGNMENT, const char* _file = NULL, uint32_t _line = 0) BX_OVERRIDE
             {
-                BX_UNUSED(_ptr, _size, _align, _file, _line);
+                BX_UNUSED(_file, _line);
 
-                void* ptr = m_stack.realloc(_ptr, _size);
+                void* ptr = m_stack.realloc(_ptr, _size, _align);
                 if (NULL == ptr)
                 {
-                    ptr = s_memory.realloc(_ptr, _size);
+                    ptr = s_memory.alignedRealloc(_ptr, _size, _align);
                 }
 
                 return ptr;
@@ -1791,6 +4494,16 @@ namespace dm
                 m_stack.pop();
             }
 
+            virtual StackMarker getMarker() BX_OVERRIDE
+            {
+                return m_stack.getMarker();
+            }
+
+            virtual void rewind(const StackMarker& _marker) BX_OVERRIDE
+            {
+                m_stack.rewind(_marker);
+            }
+
             StackTy m_stack;
         };
 
@@ -1817,9 +4530,9 @@ namespace dm
             {
             }
 
-            void init(uint8_t** _stackPtr, uint8_t** _stackLimit)
+            void init(uint8_t** _stackPtr, uint8_t** _stackLimit, uint8_t** _highWater = NULL)
             {
-                m_stack.init(_stackPtr, _stackLimit);
+                m_stack.init(_stackPtr, _stackLimit, _highWater);
             }
         };
 
@@ -1870,10 +4583,11 @@ namespace dm
 
                 // Advance stack pointer to point at split point.
                 s_memory.m_stackPtr = split;
+                s_memory.m_stackHighWater = dm::max(s_memory.m_stackHighWater, split);
 
                 // Init a new stack that will take the second split.
                 DynamicStackAllocator* stack = m_dynamicStacks.addNew();
-                stack->init(&s_memory.m_stackPtr, &s_memory.m_heapEnd);
+                stack->init(&s_memory.m_stackPtr, &s_memory.m_heapEnd, &s_memory.m_stackHighWater);
 
                 DM_PRINT_STACK("Stack split: %u.%uMB and %u.%uMB."
                              , dm::U_UMB(s_memory.sizeBetweenStackAndHeap())
@@ -1897,7 +4611,7 @@ namespace dm
                         s_memory.m_stackPtr = prev.getStackPtr();
 
                         // Make previous stack use it.
-                        prev.setExternal(&s_memory.m_stackPtr, &s_memory.m_heapEnd);
+                        prev.setExternal(&s_memory.m_stackPtr, &s_memory.m_heapEnd, &s_memory.m_stackHighWater);
 
                         DM_PRINT_STACK("Stack split freed: Available %u.%uMB.", dm::U_UMB(s_memory.sizeBetweenStackAndHeap()));
 
@@ -1914,6 +4628,19 @@ namespace dm
                 freeFixed(_stackAlloc) || freeDynamic(_stackAlloc);
             }
 
+            void getStats(AllocStats& _stats)
+            {
+                for (uint16_t ii = 0, end = m_fixedStacks.count(); ii < end; ++ii)
+                {
+                    Memory::addStackStats(_stats, m_fixedStacks.getAt(ii)->m_stack);
+                }
+
+                for (uint16_t ii = 0, end = m_dynamicStacks.count(); ii < end; ++ii)
+                {
+                    Memory::addStackStats(_stats, m_dynamicStacks.getAt(ii)->m_stack);
+                }
+            }
+
         private:
             enum { MaxFixedStacks   = 4 };
             enum { MaxDynamicStacks = 4 };
@@ -1938,13 +4665,13 @@ namespace dm
 
             virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
             {
-                BX_UNUSED(_align, _file, _line);
+                BX_UNUSED(_file, _line);
 
                 #if DM_ALLOC_PRINT_STATS
                 m_allocCount++;
                 #endif //DM_ALLOC_PRINT_STATS
 
-                return s_memory.staticAlloc(_size);
+                return s_memory.staticAlloc(_size, _align);
             }
 
             virtual void free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
@@ -1956,9 +4683,9 @@ namespace dm
 
             virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
             {
-                BX_UNUSED(_ptr, _size, _align, _file, _line);
+                BX_UNUSED(_file, _line);
 
-                return s_memory.staticRealloc(_ptr, _size);
+                return s_memory.staticRealloc(_ptr, _size, _align);
             }
 
             #if DM_ALLOC_PRINT_STATS
@@ -1974,84 +4701,393 @@ namespace dm
         };
         static StaticAllocator s_staticAllocator;
 
-        struct StackAllocator : public dm::StackAllocatorI
-        {
-            StackAllocator()
-            {
-                #if DM_ALLOC_PRINT_STATS
-                m_alloc   = 0;
-                m_realloc = 0;
-                #endif //DM_ALLOC_PRINT_STATS
+        struct StackAllocator : public dm::StackAllocatorI
+        {
+            StackAllocator()
+            {
+                #if DM_ALLOC_PRINT_STATS
+                m_alloc   = 0;
+                m_realloc = 0;
+                #endif //DM_ALLOC_PRINT_STATS
+            }
+
+            virtual ~StackAllocator()
+            {
+            }
+
+            virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            {
+                BX_UNUSED(_file, _line);
+
+                #if DM_ALLOC_PRINT_STATS
+                m_alloc++;
+                #endif //DM_ALLOC_PRINT_STATS
+
+                return s_memory.stackAlloc(_size, _align);
+            }
+
+            virtual void free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            {
+                BX_UNUSED(_align, _file, _line);
+
+                s_memory.stackFree(_ptr);
+            }
+
+            virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            {
+                BX_UNUSED(_file, _line);
+
+                #if DM_ALLOC_PRINT_STATS
+                m_realloc++;
+                #endif //DM_ALLOC_PRINT_STATS
+
+                return s_memory.stackRealloc(_ptr, _size, _align);
+            }
+
+            virtual void push() BX_OVERRIDE
+            {
+                s_memory.stackPush();
+            }
+
+            virtual void pop() BX_OVERRIDE
+            {
+                s_memory.stackPop();
+            }
+
+            virtual StackMarker getMarker() BX_OVERRIDE
+            {
+                return s_memory.stackGetMarker();
+            }
+
+            virtual void rewind(const StackMarker& _marker) BX_OVERRIDE
+            {
+                s_memory.stackRewind(_marker);
+            }
+
+            #if DM_ALLOC_PRINT_STATS
+            void printStats()
+            {
+                fprintf(stderr
+                      , "Stack allocator:\n"
+                        "\t%4d (alloc)\n"
+                        "\t%4d (realloc)\n\n"
+                      , m_alloc
+                      , m_realloc
+                      );
+            }
+            #endif //DM_ALLOC_PRINT_STATS
+
+        private:
+            #if DM_ALLOC_PRINT_STATS
+            uint32_t m_alloc;
+            uint32_t m_realloc;
+            #endif //DM_ALLOC_PRINT_STATS
+        };
+        static StackAllocator s_stackAllocator;
+
+        #if DM_ALLOC_PROFILE
+        struct Profiler
+        {
+            Profiler()
+            {
+                memset((void*)m_filter, 0, sizeof(m_filter));
+                memset(m_siteIdx, 0, sizeof(m_siteIdx));
+                memset(m_sites,   0, sizeof(m_sites));
+                memset(m_live,    0, sizeof(m_live));
+                m_numSites = 0; // Known sites, site 0 is the unknown one.
+                m_numLive  = 0;
+                m_dropped  = 0;
+            }
+
+            /// Exponentially distributed with a mean of DM_ALLOC_PROFILE_SAMPLE_RATE, which makes sampling points
+            /// a Poisson process over the bytes allocated. A fixed interval keeps picking the same site of a periodic pattern.
+            static inline int64_t nextSampleInterval()
+            {
+                // xorshift64*, seeded from the address of the thread local state so that threads differ.
+                if (0 == s_sampleRand)
+                {
+                    s_sampleRand = (uint64_t(uintptr_t(&s_sampleRand))*UINT64_C(0x9e3779b97f4a7c15)) | 1;
+                }
+                s_sampleRand ^= s_sampleRand>>12;
+                s_sampleRand ^= s_sampleRand<<25;
+                s_sampleRand ^= s_sampleRand>>27;
+
+                const double uniform = double((s_sampleRand*UINT64_C(0x2545f4914f6cdd1d))>>11)*(1.0/9007199254740992.0); // [0, 1)
+                return int64_t(-log(1.0 - uniform)*double(DM_ALLOC_PROFILE_SAMPLE_RATE)) + 1;
+            }
+
+            static inline bool sample(size_t _size)
+            {
+                if (0 == DM_ALLOC_PROFILE_SAMPLE_RATE)
+                {
+                    return true;
+                }
+
+                // The first allocation of a thread draws its interval, so that it is not always sampled.
+                if (0 == s_sampleRand)
+                {
+                    s_bytesUntilSample = nextSampleInterval();
+                }
+
+                s_bytesUntilSample -= int64_t(_size);
+                if (s_bytesUntilSample > 0)
+                {
+                    return false;
+                }
+
+                // Keep the overshoot, an allocation spanning several sampling points is still sampled once.
+                do
+                {
+                    s_bytesUntilSample += nextSampleInterval();
+                } while (s_bytesUntilSample <= 0);
+
+                return true;
+            }
+
+            void onAlloc(void* _ptr, size_t _size, const char* _file, uint32_t _line)
+            {
+                if (NULL == _ptr || !sample(_size))
+                {
+                    return;
+                }
+
+                // Sampled with probability 1-exp(-size/rate), weight it back by the inverse.
+                int64_t count = 1;
+                int64_t bytes = int64_t(_size);
+                if (0 != DM_ALLOC_PROFILE_SAMPLE_RATE)
+                {
+                    const double probability = 1.0 - exp(-double(_size)/double(DM_ALLOC_PROFILE_SAMPLE_RATE));
+                    count = dm::max(int64_t(1.0/probability + 0.5), int64_t(1));
+                    bytes = int64_t(double(_size)/probability + 0.5);
+                }
+
+                const bool external = !s_memory.contains(_ptr);
+
+                bx::LwMutexScope lock(m_mutex);
+
+                if (m_numLive >= MaxLive - MaxLive/4)
+                {
+                    m_dropped++;
+                    return;
+                }
+
+                const uint32_t site = findSite(_file, _line);
+                AllocSite& as = m_sites[site];
+                as.m_allocCount += count;
+                as.m_allocBytes += bytes;
+                as.m_liveCount  += count;
+                as.m_liveBytes  += bytes;
+                as.m_external   += uint32_t(external);
+
+                uint32_t idx = hashPtr(_ptr) & (MaxLive-1);
+                while (NULL != m_live[idx].m_ptr)
+                {
+                    idx = (idx+1) & (MaxLive-1);
+                }
+                m_live[idx].m_ptr   = _ptr;
+                m_live[idx].m_site  = site;
+                m_live[idx].m_count = count;
+                m_live[idx].m_bytes = bytes;
+                m_numLive++;
+
+                m_filter[filterIdx(_ptr)]++;
             }
 
-            virtual ~StackAllocator()
+            void onFree(void* _ptr)
             {
+                // Most pointers were never sampled, skip them without locking.
+                if (NULL == _ptr || 0 == m_filter[filterIdx(_ptr)])
+                {
+                    return;
+                }
+
+                bx::LwMutexScope lock(m_mutex);
+
+                uint32_t idx = hashPtr(_ptr) & (MaxLive-1);
+                for (; NULL != m_live[idx].m_ptr; idx = (idx+1) & (MaxLive-1))
+                {
+                    if (_ptr == m_live[idx].m_ptr)
+                    {
+                        const Live& live = m_live[idx];
+                        AllocSite& as = m_sites[live.m_site];
+                        as.m_liveCount -= live.m_count;
+                        as.m_liveBytes -= live.m_bytes;
+
+                        removeLive(idx);
+                        m_filter[filterIdx(_ptr)]--;
+                        return;
+                    }
+                }
             }
 
-            virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            uint32_t snapshot(AllocSite* _sites, uint32_t _max)
             {
-                BX_UNUSED(_align, _file, _line);
+                bx::LwMutexScope lock(m_mutex);
 
-                #if DM_ALLOC_PRINT_STATS
-                m_alloc++;
-                #endif //DM_ALLOC_PRINT_STATS
+                const uint32_t num = dm::min(m_numSites+1, _max);
+                memcpy(_sites, m_sites, num*sizeof(AllocSite));
 
-                return s_memory.stackAlloc(_size);
+                return num;
             }
 
-            virtual void free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            /// Layout, little endian:
+            ///     "DMAP", uint32_t version, uint64_t sample rate, uint32_t dropped samples
+            ///     uint32_t num sites, per site: uint32_t line, uint32_t external, int64_t allocCount, allocBytes, liveCount, liveBytes, uint32_t file length, file
+            ///     uint32_t num live, per live sample: uint64_t ptr, uint32_t site index, int64_t bytes
+            bool dump(const char* _path)
             {
-                BX_UNUSED(_align, _file, _line);
+                FILE* file = fopen(_path, "wb");
+                if (NULL == file)
+                {
+                    return false;
+                }
+
+                bx::LwMutexScope lock(m_mutex);
+
+                const uint32_t magic   = BX_MAKEFOURCC('D', 'M', 'A', 'P');
+                const uint32_t version = 1;
+                const uint64_t rate    = DM_ALLOC_PROFILE_SAMPLE_RATE;
+                fwrite(&magic,      sizeof(magic),      1, file);
+                fwrite(&version,    sizeof(version),    1, file);
+                fwrite(&rate,       sizeof(rate),       1, file);
+                fwrite(&m_dropped,  sizeof(m_dropped),  1, file);
+                const uint32_t numSites = m_numSites+1;
+                fwrite(&numSites,   sizeof(numSites),   1, file);
 
-                if (!s_memory.fromStackRegion(_ptr))
+                for (uint32_t ii = 0; ii < numSites; ++ii)
                 {
-                    s_memory.free(_ptr);
+                    const AllocSite& as = m_sites[ii];
+                    const uint32_t len = (NULL == as.m_file) ? 0 : uint32_t(strlen(as.m_file));
+                    fwrite(&as.m_line,       sizeof(as.m_line),       1, file);
+                    fwrite(&as.m_external,   sizeof(as.m_external),   1, file);
+                    fwrite(&as.m_allocCount, sizeof(as.m_allocCount), 1, file);
+                    fwrite(&as.m_allocBytes, sizeof(as.m_allocBytes), 1, file);
+                    fwrite(&as.m_liveCount,  sizeof(as.m_liveCount),  1, file);
+                    fwrite(&as.m_liveBytes,  sizeof(as.m_liveBytes),  1, file);
+                    fwrite(&len,             sizeof(len),             1, file);
+                    fwrite(as.m_file,        1,                     len, file);
+                }
+
+                fwrite(&m_numLive, sizeof(m_numLive), 1, file);
+                for (uint32_t ii = 0; ii < MaxLive; ++ii)
+                {
+                    const Live& live = m_live[ii];
+                    if (NULL != live.m_ptr)
+                    {
+                        const uint64_t ptr = uint64_t(uintptr_t(live.m_ptr));
+                        fwrite(&ptr,          sizeof(ptr),          1, file);
+                        fwrite(&live.m_site,  sizeof(live.m_site),  1, file);
+                        fwrite(&live.m_bytes, sizeof(live.m_bytes), 1, file);
+                    }
                 }
+
+                const bool result = (0 == ferror(file));
+                fclose(file);
+
+                return result;
             }
 
-            virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+        private:
+            enum
             {
-                BX_UNUSED(_align, _file, _line);
+                MaxSites   = DM_ALLOC_PROFILE_MAX_SITES,
+                MaxLive    = DM_ALLOC_PROFILE_MAX_LIVE,
+                FilterSize = DM_ALLOC_PROFILE_MAX_LIVE*4,
+            };
 
-                #if DM_ALLOC_PRINT_STATS
-                m_realloc++;
-                #endif //DM_ALLOC_PRINT_STATS
+            struct Live
+            {
+                void*    m_ptr;
+                uint32_t m_site;
+                int64_t  m_count;
+                int64_t  m_bytes;
+            };
 
-                return s_memory.stackRealloc(_ptr, _size);
+            static inline uint32_t hashPtr(const void* _ptr)
+            {
+                // Fibonacci hashing, low bits of allocations are mostly zero.
+                const uint64_t key = uint64_t(uintptr_t(_ptr));
+                return uint32_t((key*UINT64_C(0x9e3779b97f4a7c15))>>32);
             }
 
-            virtual void push() BX_OVERRIDE
+            static inline uint32_t filterIdx(const void* _ptr)
             {
-                s_memory.stackPush();
+                return (hashPtr(_ptr)>>16) & (FilterSize-1);
             }
 
-            virtual void pop() BX_OVERRIDE
+            uint32_t findSite(const char* _file, uint32_t _line)
             {
-                s_memory.stackPop();
+                if (NULL == _file)
+                {
+                    return 0;
+                }
+
+                const uint32_t hash = hashPtr(_file) ^ (_line*0x9e3779b9u);
+                for (uint32_t ii = 0; ii < MaxSites; ++ii)
+                {
+                    const uint32_t idx = (hash+ii) & (MaxSites-1);
+                    const uint32_t site = m_siteIdx[idx];
+                    if (0 == site)
+                    {
+                        // Keep the table at most half full, probing stays short.
+                        if (m_numSites >= MaxSites/2)
+                        {
+                            return 0;
+                        }
+
+                        const uint32_t newSite = ++m_numSites;
+                        m_siteIdx[idx] = newSite;
+                        m_sites[newSite].m_file = _file;
+                        m_sites[newSite].m_line = _line;
+                        return newSite;
+                    }
+
+                    if (_file == m_sites[site].m_file && _line == m_sites[site].m_line)
+                    {
+                        return site;
+                    }
+                }
+
+                return 0;
             }
 
-            #if DM_ALLOC_PRINT_STATS
-            void printStats()
+            void removeLive(uint32_t _idx)
             {
-                fprintf(stderr
-                      , "Stack allocator:\n"
-                        "\t%4d (alloc)\n"
-                        "\t%4d (realloc)\n\n"
-                      , m_alloc
-                      , m_realloc
-                      );
+                // Shift following entries of the probe sequence back, so that lookups do not need tombstones.
+                uint32_t hole = _idx;
+                for (uint32_t idx = (hole+1) & (MaxLive-1); NULL != m_live[idx].m_ptr; idx = (idx+1) & (MaxLive-1))
+                {
+                    const uint32_t home = hashPtr(m_live[idx].m_ptr) & (MaxLive-1);
+                    const bool movable = (hole <= idx) ? (home <= hole || home > idx) : (home <= hole && home > idx);
+                    if (movable)
+                    {
+                        m_live[hole] = m_live[idx];
+                        hole = idx;
+                    }
+                }
+
+                m_live[hole].m_ptr = NULL;
+                m_numLive--;
             }
-            #endif //DM_ALLOC_PRINT_STATS
 
-        private:
-            #if DM_ALLOC_PRINT_STATS
-            uint32_t m_alloc;
-            uint32_t m_realloc;
-            #endif //DM_ALLOC_PRINT_STATS
+            bx::LwMutex m_mutex;
+            uint32_t    m_numSites;
+            uint32_t    m_numLive;
+            uint32_t    m_dropped;
+            uint32_t    m_siteIdx[MaxSites];
+            AllocSite   m_sites[MaxSites/2+1];
+            Live        m_live[MaxLive];
+            volatile uint16_t m_filter[FilterSize]; // Live samples per pointer hash, read without locking.
+
+            static BX_THREAD int64_t  s_bytesUntilSample;
+            static BX_THREAD uint64_t s_sampleRand; // 0 until the first allocation of the thread.
         };
-        static StackAllocator s_stackAllocator;
+        static Profiler s_profiler;
+        BX_THREAD int64_t  Profiler::s_bytesUntilSample;
+        BX_THREAD uint64_t Profiler::s_sampleRand;
+        #endif //DM_ALLOC_PROFILE
 
-        struct MainAllocator : public bx::ReallocatorI
+        struct MainAllocator : public ZeroAllocatorI
         {
             virtual ~MainAllocator()
             {
@@ -2059,23 +5095,58 @@ namespace dm
 
             virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
             {
-                BX_UNUSED(_align, _file, _line);
+                BX_UNUSED(_file, _line);
+
+                void* ptr = s_memory.alignedAlloc(_size, _align);
 
-                return s_memory.alloc(_size);
+                #if DM_ALLOC_PROFILE
+                s_profiler.onAlloc(ptr, _size, _file, _line);
+                #endif //DM_ALLOC_PROFILE
+
+                return ptr;
             }
 
             virtual void free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
             {
                 BX_UNUSED(_align, _file, _line);
 
+                #if DM_ALLOC_PROFILE
+                s_profiler.onFree(_ptr);
+                #endif //DM_ALLOC_PROFILE
+
                 s_memory.free(_ptr);
             }
 
             virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
             {
-                BX_UNUSED(_align, _file, _line);
+                BX_UNUSED(_file, _line);
+
+                // Counted as a free followed by an alloc. The old sample is dropped first, once realloc() frees
+                // the old block, its address may be handed out and sampled by another thread.
+                #if DM_ALLOC_PROFILE
+                s_profiler.onFree(_ptr);
+                #endif //DM_ALLOC_PROFILE
+
+                void* ptr = s_memory.alignedRealloc(_ptr, _size, _align);
+
+                #if DM_ALLOC_PROFILE
+                s_profiler.onAlloc(ptr, _size, _file, _line);
+                #endif //DM_ALLOC_PROFILE
+
+                return ptr;
+            }
+
+            virtual void* callocZeroed(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+            {
+                BX_UNUSED(_file, _line);
 
-                return s_memory.realloc(_ptr, _size);
+                void* ptr = s_memory.callocZeroed(_size, _align);
+
+                #if DM_ALLOC_PROFILE
+                s_profiler.onAlloc(ptr, _size, _file, _line);
+                #endif //DM_ALLOC_PROFILE
+
+                return ptr;
             }
         };
         static MainAllocator s_mainAllocator;
@@ -2196,22 +5267,31 @@ namespace dm
 
     #endif // !DM_ALLOCATOR
 
-    struct CrtAllocator : public bx::ReallocatorI
+    struct CrtAllocator : public ZeroAllocatorI
     {
         virtual ~CrtAllocator()
         {
         }
 
+        // Aligned allocations carry an offset header (bx::alignedAlloc()), they need to be freed with the same alignment.
+
         virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
         {
-            BX_UNUSED(_align, _file, _line);
+            if (_align > DM_NATURAL_ALIGNMENT)
+            {
+                return bx::alignedAlloc(this, _size, _align, _file, _line);
+            }
 
             return ::malloc(_size);
         }
 
         virtual void free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
         {
-            BX_UNUSED(_align, _file, _line);
+            if (_align > DM_NATURAL_ALIGNMENT)
+            {
+                bx::alignedFree(this, _ptr, _align, _file, _line);
+                return;
+            }
 
             #if DM_ALLOCATOR
                 if (s_memory.contains(_ptr))
@@ -2229,7 +5309,10 @@ namespace dm
 
         virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
         {
-            BX_UNUSED(_align, _file, _line);
+            if (_align > DM_NATURAL_ALIGNMENT)
+            {
+                return bx::alignedRealloc(this, _ptr, _size, _align, _file, _line);
+            }
 
             #if DM_ALLOCATOR
                 if (s_memory.contains(_ptr))
@@ -2244,6 +5327,22 @@ namespace dm
                 return ::realloc(_ptr, _size);
             #endif // DM_ALLOCATOR
         }
+
+        virtual void* callocZeroed(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE
+        {
+            if (_align > DM_NATURAL_ALIGNMENT)
+            {
+                void* ptr = bx::alignedAlloc(this, _size, _align, _file, _line);
+                if (NULL != ptr)
+                {
+                    memset(ptr, 0, _size);
+                }
+
+                return ptr;
+            }
+
+            return ::calloc(1, _size);
+        }
     };
     static CrtAllocator s_crtAllocator;
 
@@ -2327,6 +5426,33 @@ namespace dm
             m_stackFrame--;
         }
 
+        virtual StackMarker getMarker() BX_OVERRIDE
+        {
+            StackMarker marker;
+            marker.m_pos      = m_pointers[m_stackFrame].count();
+            marker.m_frame    = 0;
+            marker.m_depth    = m_stackFrame;
+            marker.m_overflow = 0;
+            return marker;
+        }
+
+        virtual void rewind(const StackMarker& _marker) BX_OVERRIDE
+        {
+            DM_CHECK(_marker.m_depth <= m_stackFrame, "CrtStackAllocator::rewind | Marker frame was already popped!");
+
+            while (m_stackFrame > _marker.m_depth)
+            {
+                pop();
+            }
+
+            PtrArray& ptrArray = m_pointers[m_stackFrame];
+            for (uint32_t ii = ptrArray.count(); ii-- > uint32_t(_marker.m_pos); )
+            {
+                ::free(ptrArray[ii]);
+            }
+            ptrArray.cut(uint32_t(_marker.m_pos));
+        }
+
         #if DM_ALLOC_PRINT_STATS
         void printStats()
         {
@@ -2397,6 +5523,13 @@ namespace dm
         #endif //DM_ALLOCATOR
     }
 
+    void allocThreadShutdown()
+    {
+        #if DM_ALLOCATOR
+            s_memory.threadShutdown();
+        #endif //DM_ALLOCATOR
+    }
+
     void allocPrintStats()
     {
         #if DM_ALLOCATOR
@@ -2406,7 +5539,6 @@ namespace dm
             printf("----------------------------------------------\n\n");
             s_staticAllocator.printStats();
             s_stackAllocator.printStats();
-            s_bgfxAllocator.printStats();
             #endif //DM_ALLOC_PRINT_STATS
 
             s_memory.printStats();
@@ -2417,6 +5549,204 @@ namespace dm
         #endif //DM_ALLOCATOR
     }
 
+    uint32_t allocProfileSnapshot(AllocSite* _sites, uint32_t _max)
+    {
+        #if DM_ALLOCATOR && DM_ALLOC_PROFILE
+            return s_profiler.snapshot(_sites, _max);
+        #else
+            BX_UNUSED(_sites, _max);
+            return 0;
+        #endif //DM_ALLOCATOR && DM_ALLOC_PROFILE
+    }
+
+    uint32_t allocProfileDiff(AllocSite* _out, uint32_t _max, const AllocSite* _before, uint32_t _numBefore, const AllocSite* _after, uint32_t _numAfter)
+    {
+        uint32_t num = 0;
+        for (uint32_t ii = 0; ii < _numAfter && num < _max; ++ii)
+        {
+            AllocSite site = _after[ii];
+
+            // The same file may be referenced through different string literals.
+            for (uint32_t jj = 0; jj < _numBefore; ++jj)
+            {
+                const AllocSite& before = _before[jj];
+                const bool sameFile = (site.m_file == before.m_file)
+                                   || (NULL != site.m_file && NULL != before.m_file && 0 == strcmp(site.m_file, before.m_file));
+                if (sameFile && site.m_line == before.m_line)
+                {
+                    site.m_external   -= before.m_external;
+                    site.m_allocCount -= before.m_allocCount;
+                    site.m_allocBytes -= before.m_allocBytes;
+                    site.m_liveCount  -= before.m_liveCount;
+                    site.m_liveBytes  -= before.m_liveBytes;
+                    break;
+                }
+            }
+
+            if (0 != site.m_allocCount || 0 != site.m_liveCount)
+            {
+                _out[num++] = site;
+            }
+        }
+
+        return num;
+    }
+
+    bool allocProfileDump(const char* _path)
+    {
+        #if DM_ALLOCATOR && DM_ALLOC_PROFILE
+            return s_profiler.dump(_path);
+        #else
+            BX_UNUSED(_path);
+            return false;
+        #endif //DM_ALLOCATOR && DM_ALLOC_PROFILE
+    }
+
+    void allocGetStats(AllocStats* _stats)
+    {
+        memset(_stats, 0, sizeof(AllocStats));
+
+        #if DM_ALLOCATOR
+            s_memory.getStats(*_stats);
+            s_stackList.getStats(*_stats);
+        #endif //DM_ALLOCATOR
+    }
+
+    void allocFreeSized(void* _ptr, size_t _size)
+    {
+        #if DM_ALLOCATOR
+            #if DM_ALLOC_PROFILE
+            s_profiler.onFree(_ptr);
+            #endif //DM_ALLOC_PROFILE
+
+            s_memory.freeSized(_ptr, _size);
+        #else
+            BX_UNUSED(_size);
+            ::free(_ptr);
+        #endif //DM_ALLOCATOR
+    }
+
+    uint32_t allocBatch(size_t _size, uint32_t _count, void** _ptrs)
+    {
+        #if DM_ALLOCATOR
+            const uint32_t num = s_memory.allocBatch(_size, _count, _ptrs);
+
+            #if DM_ALLOC_PROFILE
+            for (uint32_t ii = 0; ii < num; ++ii)
+            {
+                s_profiler.onAlloc(_ptrs[ii], _size, NULL, 0);
+            }
+            #endif //DM_ALLOC_PROFILE
+
+            return num;
+        #else
+            uint32_t num = 0;
+            for (; num < _count; ++num)
+            {
+                _ptrs[num] = ::malloc(_size);
+                if (NULL == _ptrs[num])
+                {
+                    break;
+                }
+            }
+
+            return num;
+        #endif //DM_ALLOCATOR
+    }
+
+    void allocFreeBatch(void** _ptrs, uint32_t _count)
+    {
+        #if DM_ALLOCATOR
+            #if DM_ALLOC_PROFILE
+            for (uint32_t ii = 0; ii < _count; ++ii)
+            {
+                s_profiler.onFree(_ptrs[ii]);
+            }
+            #endif //DM_ALLOC_PROFILE
+
+            s_memory.freeBatch(_ptrs, _count);
+        #else
+            for (uint32_t ii = 0; ii < _count; ++ii)
+            {
+                ::free(_ptrs[ii]);
+            }
+        #endif //DM_ALLOCATOR
+    }
+
+    RelocHandle allocRelocatable(size_t _size)
+    {
+        #if DM_ALLOCATOR
+            return s_memory.relocAlloc(_size);
+        #else
+            RelocEntry* entry = (RelocEntry*)::malloc(sizeof(RelocEntry));
+            if (NULL == entry)
+            {
+                return NULL;
+            }
+
+            entry->m_ptr = ::malloc(_size);
+            if (NULL == entry->m_ptr)
+            {
+                ::free(entry);
+                return NULL;
+            }
+            entry->m_state = 0;
+
+            return entry;
+        #endif //DM_ALLOCATOR
+    }
+
+    void allocFreeRelocatable(RelocHandle _handle)
+    {
+        if (NULL == _handle)
+        {
+            return;
+        }
+
+        #if DM_ALLOCATOR
+            s_memory.relocFree(_handle);
+        #else
+            DM_CHECK(0 == _handle->m_state, "allocFreeRelocatable | Handle is pinned (0x%p).", _handle);
+            ::free(_handle->m_ptr);
+            ::free(_handle);
+        #endif //DM_ALLOCATOR
+    }
+
+    void* allocPin(RelocHandle _handle)
+    {
+        for (;;)
+        {
+            const uint64_t state = _handle->m_state;
+            DM_CHECK(0 == (state&RelocEntry::Freed), "allocPin | Handle is freed (0x%p).", _handle);
+
+            if (0 != (state&RelocEntry::Moving))
+            {
+                bx::yield();
+            }
+            else if (state == dm::atomicCompareAndSwap64(&_handle->m_state, state, state+1))
+            {
+                return _handle->m_ptr;
+            }
+        }
+    }
+
+    void allocUnpin(RelocHandle _handle)
+    {
+        DM_CHECK(0 != (_handle->m_state&RelocEntry::PinMask), "allocUnpin | Handle is not pinned (0x%p).", _handle);
+
+        dm::atomicFetchAndAdd64(&_handle->m_state, UINT64_MAX);
+    }
+
+    size_t allocCompact(size_t _budget, uint32_t _microseconds)
+    {
+        #if DM_ALLOCATOR
+            return s_memory.relocCompact(_budget, _microseconds);
+        #else
+            BX_UNUSED(_budget, _microseconds);
+            return 0;
+        #endif //DM_ALLOCATOR
+    }
+
     StackAllocatorI* allocCreateStack(size_t _size)
     {
         #if DM_ALLOCATOR
@@ -2452,15 +5782,15 @@ namespace dm
     #if DM_ALLOCATOR
         bx::ReallocatorI* staticAlloc = &s_staticAllocator;
         StackAllocatorI*  stackAlloc  = &s_stackAllocator;
-        bx::ReallocatorI* mainAlloc   = &s_mainAllocator;
+        ZeroAllocatorI*   mainAlloc   = &s_mainAllocator;
     #else
         bx::ReallocatorI* staticAlloc = &s_crtAllocator;
         StackAllocatorI*  stackAlloc  = &s_crtStackAllocator;
-        bx::ReallocatorI* mainAlloc   = &s_crtAllocator;
+        ZeroAllocatorI*   mainAlloc   = &s_crtAllocator;
     #endif //DM_ALLOCATOR
 
 } //namespace dm
 
-#endif //DM_ALLOCATOR_IMPL
+#endif //defined(DM_ALLOCATOR_IMPL) && !defined(DM_ALLOCATOR_IMPL_GUARD)
 
 /* vim: set sw=4 ts=4 expandtab: */
@@ -6,28 +6,96 @@
 // Small alloc config.
 //-----
 
+// Small allocation size classes are spaced by a quarter of a power of two (like jemalloc and mimalloc):
+//     16, 32, 48, 64 | 80, 96, 112, 128 | 160, 192, 224, 256 | 320, ... | ..., 448KB, 512KB
+// This keeps the internal fragmentation of each allocation below 25%.
+//
+// Each class gets DM_SMALL_ALLOC_BUDGET bytes worth of slots, but at least DM_SMALL_ALLOC_MIN_SLOTS slots.
+//
+// To use a custom table instead:
+//     #define DM_SMALL_ALLOC_CUSTOM_CONFIG "my_small_alloc_config.h"
+// The file should contain one DM_SMALL_ALLOC_DEF(_idx, _size, _num) line per class.
+// Sizes are expected to be increasing multiples of 16, the last one being the biggest small allocation size.
+
+#ifndef DM_SMALL_ALLOC_BUDGET
+    #define DM_SMALL_ALLOC_BUDGET DM_MEGABYTES(1)
+#endif //DM_SMALL_ALLOC_BUDGET
+
+#ifndef DM_SMALL_ALLOC_MIN_SLOTS
+    #define DM_SMALL_ALLOC_MIN_SLOTS 8
+#endif //DM_SMALL_ALLOC_MIN_SLOTS
+
+#ifndef DM_SMALL_ALLOC_SIZE
+    #define DM_SMALL_ALLOC_SIZE(_idx) ((_idx) < 4 ? ((_idx)+1)<<4 : (5+(((_idx)-4)&3))<<((((_idx)-4)>>2)+4))
+    #define DM_SMALL_ALLOC_NUM(_idx)  (DM_SMALL_ALLOC_BUDGET/DM_SMALL_ALLOC_SIZE(_idx) > DM_SMALL_ALLOC_MIN_SLOTS \
+                                      ? DM_SMALL_ALLOC_BUDGET/DM_SMALL_ALLOC_SIZE(_idx) : DM_SMALL_ALLOC_MIN_SLOTS)
+#endif //DM_SMALL_ALLOC_SIZE
+
 #if !defined(DM_SMALL_ALLOC_DEF)
     #define DM_SMALL_ALLOC_DEF(_idx, _size, _num)
 #endif //!defined(DM_SMALL_ALLOC_DEF)
-DM_SMALL_ALLOC_DEF(0,                16,  16*1024)
-DM_SMALL_ALLOC_DEF(1,                32,  16*1024)
-DM_SMALL_ALLOC_DEF(2,                64, 512*1024) // Std containers use lots of these!
-DM_SMALL_ALLOC_DEF(3,               256,  16*1024)
-DM_SMALL_ALLOC_DEF(4,               512,   8*1024)
-DM_SMALL_ALLOC_DEF(5, DM_KILOBYTES(  1),   8*1024)
-DM_SMALL_ALLOC_DEF(6, DM_KILOBYTES( 16),       64)
-DM_SMALL_ALLOC_DEF(7, DM_KILOBYTES( 64),       64)
-DM_SMALL_ALLOC_DEF(8, DM_KILOBYTES(256),       32)
-DM_SMALL_ALLOC_DEF(9, DM_KILOBYTES(512),       32) // -> DM_SMALL_ALLOC_BIGGEST_SIZE
-/* -> DM_SMALL_ALLOC_COUNT */
+#if defined(DM_SMALL_ALLOC_CUSTOM_CONFIG)
+    #include DM_SMALL_ALLOC_CUSTOM_CONFIG
+#else
+DM_SMALL_ALLOC_DEF( 0, DM_SMALL_ALLOC_SIZE( 0), DM_SMALL_ALLOC_NUM( 0)) // 16B
+DM_SMALL_ALLOC_DEF( 1, DM_SMALL_ALLOC_SIZE( 1), DM_SMALL_ALLOC_NUM( 1)) // 32B
+DM_SMALL_ALLOC_DEF( 2, DM_SMALL_ALLOC_SIZE( 2), DM_SMALL_ALLOC_NUM( 2)) // 48B
+DM_SMALL_ALLOC_DEF( 3, DM_SMALL_ALLOC_SIZE( 3),         512*1024) // 64B - Std containers use lots of these!
+DM_SMALL_ALLOC_DEF( 4, DM_SMALL_ALLOC_SIZE( 4), DM_SMALL_ALLOC_NUM( 4)) // 80B
+DM_SMALL_ALLOC_DEF( 5, DM_SMALL_ALLOC_SIZE( 5), DM_SMALL_ALLOC_NUM( 5)) // 96B
+DM_SMALL_ALLOC_DEF( 6, DM_SMALL_ALLOC_SIZE( 6), DM_SMALL_ALLOC_NUM( 6)) // 112B
+DM_SMALL_ALLOC_DEF( 7, DM_SMALL_ALLOC_SIZE( 7), DM_SMALL_ALLOC_NUM( 7)) // 128B
+DM_SMALL_ALLOC_DEF( 8, DM_SMALL_ALLOC_SIZE( 8), DM_SMALL_ALLOC_NUM( 8)) // 160B
+DM_SMALL_ALLOC_DEF( 9, DM_SMALL_ALLOC_SIZE( 9), DM_SMALL_ALLOC_NUM( 9)) // 192B
+DM_SMALL_ALLOC_DEF(10, DM_SMALL_ALLOC_SIZE(10), DM_SMALL_ALLOC_NUM(10)) // 224B
+DM_SMALL_ALLOC_DEF(11, DM_SMALL_ALLOC_SIZE(11), DM_SMALL_ALLOC_NUM(11)) // 256B
+DM_SMALL_ALLOC_DEF(12, DM_SMALL_ALLOC_SIZE(12), DM_SMALL_ALLOC_NUM(12)) // 320B
+DM_SMALL_ALLOC_DEF(13, DM_SMALL_ALLOC_SIZE(13), DM_SMALL_ALLOC_NUM(13)) // 384B
+DM_SMALL_ALLOC_DEF(14, DM_SMALL_ALLOC_SIZE(14), DM_SMALL_ALLOC_NUM(14)) // 448B
+DM_SMALL_ALLOC_DEF(15, DM_SMALL_ALLOC_SIZE(15), DM_SMALL_ALLOC_NUM(15)) // 512B
+DM_SMALL_ALLOC_DEF(16, DM_SMALL_ALLOC_SIZE(16), DM_SMALL_ALLOC_NUM(16)) // 640B
+DM_SMALL_ALLOC_DEF(17, DM_SMALL_ALLOC_SIZE(17), DM_SMALL_ALLOC_NUM(17)) // 768B
+DM_SMALL_ALLOC_DEF(18, DM_SMALL_ALLOC_SIZE(18), DM_SMALL_ALLOC_NUM(18)) // 896B
+DM_SMALL_ALLOC_DEF(19, DM_SMALL_ALLOC_SIZE(19), DM_SMALL_ALLOC_NUM(19)) // 1KB
+DM_SMALL_ALLOC_DEF(20, DM_SMALL_ALLOC_SIZE(20), DM_SMALL_ALLOC_NUM(20)) // 1.25KB
+DM_SMALL_ALLOC_DEF(21, DM_SMALL_ALLOC_SIZE(21), DM_SMALL_ALLOC_NUM(21)) // 1.5KB
+DM_SMALL_ALLOC_DEF(22, DM_SMALL_ALLOC_SIZE(22), DM_SMALL_ALLOC_NUM(22)) // 1.75KB
+DM_SMALL_ALLOC_DEF(23, DM_SMALL_ALLOC_SIZE(23), DM_SMALL_ALLOC_NUM(23)) // 2KB
+DM_SMALL_ALLOC_DEF(24, DM_SMALL_ALLOC_SIZE(24), DM_SMALL_ALLOC_NUM(24)) // 2.5KB
+DM_SMALL_ALLOC_DEF(25, DM_SMALL_ALLOC_SIZE(25), DM_SMALL_ALLOC_NUM(25)) // 3KB
+DM_SMALL_ALLOC_DEF(26, DM_SMALL_ALLOC_SIZE(26), DM_SMALL_ALLOC_NUM(26)) // 3.5KB
+DM_SMALL_ALLOC_DEF(27, DM_SMALL_ALLOC_SIZE(27), DM_SMALL_ALLOC_NUM(27)) // 4KB
+DM_SMALL_ALLOC_DEF(28, DM_SMALL_ALLOC_SIZE(28), DM_SMALL_ALLOC_NUM(28)) // 5KB
+DM_SMALL_ALLOC_DEF(29, DM_SMALL_ALLOC_SIZE(29), DM_SMALL_ALLOC_NUM(29)) // 6KB
+DM_SMALL_ALLOC_DEF(30, DM_SMALL_ALLOC_SIZE(30), DM_SMALL_ALLOC_NUM(30)) // 7KB
+DM_SMALL_ALLOC_DEF(31, DM_SMALL_ALLOC_SIZE(31), DM_SMALL_ALLOC_NUM(31)) // 8KB
+DM_SMALL_ALLOC_DEF(32, DM_SMALL_ALLOC_SIZE(32), DM_SMALL_ALLOC_NUM(32)) // 10KB
+DM_SMALL_ALLOC_DEF(33, DM_SMALL_ALLOC_SIZE(33), DM_SMALL_ALLOC_NUM(33)) // 12KB
+DM_SMALL_ALLOC_DEF(34, DM_SMALL_ALLOC_SIZE(34), DM_SMALL_ALLOC_NUM(34)) // 14KB
+DM_SMALL_ALLOC_DEF(35, DM_SMALL_ALLOC_SIZE(35), DM_SMALL_ALLOC_NUM(35)) // 16KB
+DM_SMALL_ALLOC_DEF(36, DM_SMALL_ALLOC_SIZE(36), DM_SMALL_ALLOC_NUM(36)) // 20KB
+DM_SMALL_ALLOC_DEF(37, DM_SMALL_ALLOC_SIZE(37), DM_SMALL_ALLOC_NUM(37)) // 24KB
+DM_SMALL_ALLOC_DEF(38, DM_SMALL_ALLOC_SIZE(38), DM_SMALL_ALLOC_NUM(38)) // 28KB
+DM_SMALL_ALLOC_DEF(39, DM_SMALL_ALLOC_SIZE(39), DM_SMALL_ALLOC_NUM(39)) // 32KB
+DM_SMALL_ALLOC_DEF(40, DM_SMALL_ALLOC_SIZE(40), DM_SMALL_ALLOC_NUM(40)) // 40KB
+DM_SMALL_ALLOC_DEF(41, DM_SMALL_ALLOC_SIZE(41), DM_SMALL_ALLOC_NUM(41)) // 48KB
+DM_SMALL_ALLOC_DEF(42, DM_SMALL_ALLOC_SIZE(42), DM_SMALL_ALLOC_NUM(42)) // 56KB
+DM_SMALL_ALLOC_DEF(43, DM_SMALL_ALLOC_SIZE(43), DM_SMALL_ALLOC_NUM(43)) // 64KB
+DM_SMALL_ALLOC_DEF(44, DM_SMALL_ALLOC_SIZE(44), DM_SMALL_ALLOC_NUM(44)) // 80KB
+DM_SMALL_ALLOC_DEF(45, DM_SMALL_ALLOC_SIZE(45), DM_SMALL_ALLOC_NUM(45)) // 96KB
+DM_SMALL_ALLOC_DEF(46, DM_SMALL_ALLOC_SIZE(46), DM_SMALL_ALLOC_NUM(46)) // 112KB
+DM_SMALL_ALLOC_DEF(47, DM_SMALL_ALLOC_SIZE(47), DM_SMALL_ALLOC_NUM(47)) // 128KB
+DM_SMALL_ALLOC_DEF(48, DM_SMALL_ALLOC_SIZE(48), DM_SMALL_ALLOC_NUM(48)) // 160KB
+DM_SMALL_ALLOC_DEF(49, DM_SMALL_ALLOC_SIZE(49), DM_SMALL_ALLOC_NUM(49)) // 192KB
+DM_SMALL_ALLOC_DEF(50, DM_SMALL_ALLOC_SIZE(50), DM_SMALL_ALLOC_NUM(50)) // 224KB
+DM_SMALL_ALLOC_DEF(51, DM_SMALL_ALLOC_SIZE(51), DM_SMALL_ALLOC_NUM(51)) // 256KB
+DM_SMALL_ALLOC_DEF(52, DM_SMALL_ALLOC_SIZE(52), DM_SMALL_ALLOC_NUM(52)) // 320KB
+DM_SMALL_ALLOC_DEF(53, DM_SMALL_ALLOC_SIZE(53), DM_SMALL_ALLOC_NUM(53)) // 384KB
+DM_SMALL_ALLOC_DEF(54, DM_SMALL_ALLOC_SIZE(54), DM_SMALL_ALLOC_NUM(54)) // 448KB
+DM_SMALL_ALLOC_DEF(55, DM_SMALL_ALLOC_SIZE(55), DM_SMALL_ALLOC_NUM(55)) // 512KB -> Biggest small allocation size.
+#endif // defined(DM_SMALL_ALLOC_CUSTOM_CONFIG)
 #undef DM_SMALL_ALLOC_DEF
 
-#ifdef DM_SMALL_ALLOC_CONFIG
-    #define DM_SMALL_ALLOC_COUNT        10
-    #define DM_SMALL_ALLOC_BIGGEST_SIZE DM_KILOBYTES(512)
-#endif // DM_SMALL_ALLOC_CONFIG
-#undef DM_SMALL_ALLOC_CONFIG
-
 // Alloc config.
 //-----
 
@@ -51,7 +119,7 @@ DM_ALLOC_DEF(9,   32) // for region: 1024MB
     #define DM_ALLOC_NUM_REGIONS        10
     #define DM_ALLOC_NUM_SUB_REGIONS    8
     #define DM_ALLOC_SMALLEST_REGION    DM_MEGABYTES(2)
-    #define DM_ALLOC_MAX_BIG_FREE_SLOTS 32
+    #define DM_ALLOC_TLSF_SL_COUNT_LOG2 5 // DM_ALLOCATOR_UNDERLYING_IMPL_TLSF only, each power of two is split into 2^x bins. Max 5.
 #endif // DM_ALLOC_CONFIG
 #undef DM_ALLOC_CONFIG
 
@@ -71,17 +139,126 @@ DM_ALLOC_DEF(9,   32) // for region: 1024MB
     //     #define DM_MEM_SIZE_FUNC memSizeFunc
     //     size_t memSizeFunc() { return DM_GIGABYTES(1); }
 
+    #define DM_MEM_ARENA_MALLOC 0 // malloc() and touch the entire arena at startup.
+    #define DM_MEM_ARENA_VMEM   1 // Reserve address space, pages are committed on first touch - recommended!
+
+    #ifndef DM_MEM_ARENA
+        #define DM_MEM_ARENA DM_MEM_ARENA_VMEM
+    #endif //DM_MEM_ARENA
+
+    #ifndef DM_MEM_SEGMENT_SIZE
+        #define DM_MEM_SEGMENT_SIZE DM_MEGABYTES(512) // Size of each additional arena segment, mapped once the arena is exhausted. Power of two.
+    #endif //DM_MEM_SEGMENT_SIZE
+
+    #ifndef DM_MEM_MAX_SEGMENTS
+        #define DM_MEM_MAX_SEGMENTS 64 // Use 0 to fall back to ::malloc() as soon as the arena is exhausted.
+    #endif //DM_MEM_MAX_SEGMENTS
+
+    #ifndef DM_MEM_LARGE_OBJECT_THRESHOLD
+        #define DM_MEM_LARGE_OBJECT_THRESHOLD DM_MEGABYTES(4) // Allocations at least this big get their own mapping, realloc remaps pages instead of copying them. Use 0 to disable.
+    #endif //DM_MEM_LARGE_OBJECT_THRESHOLD
+
+    #ifndef DM_MEM_HUGE_PAGES
+        #define DM_MEM_HUGE_PAGES 0 // Back the arena with 2MB pages where possible. Requires DM_MEM_ARENA_VMEM.
+    #endif //DM_MEM_HUGE_PAGES
+
+    #ifndef DM_MEM_DECOMMIT_THRESHOLD
+        #define DM_MEM_DECOMMIT_THRESHOLD DM_MEGABYTES(1) // Pages of free heap spans at least this big are given back to the OS.
+    #endif //DM_MEM_DECOMMIT_THRESHOLD
+
+    #ifndef DM_MEM_DECOMMIT_LAZY
+        #define DM_MEM_DECOMMIT_LAZY 0 // Use MADV_FREE instead of MADV_DONTNEED where available. Cheaper, but RSS drops only under memory pressure.
+    #endif //DM_MEM_DECOMMIT_LAZY
+
+    #ifndef DM_MEM_TRACK_ZEROED
+        #define DM_MEM_TRACK_ZEROED 1 // Track never used small slots and heap space, so that callocZeroed() skips clearing them. Costs a bit test on small frees.
+    #endif //DM_MEM_TRACK_ZEROED
+
     #define DM_ALLOCATOR_UNDERLYING_IMPL_LIST  0 // Slower - left for testing purposes.
-    #define DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY 1 // Faster - recommended!
+    #define DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY 1 // Fast while the heap is not fragmented, free space lookup is a linear scan.
+    #define DM_ALLOCATOR_UNDERLYING_IMPL_TLSF  2 // Two-level segregated fit, constant time alloc and free - recommended!
 
     #ifndef DM_ALLOCATOR_UNDERLYING_IMPL
-        #define DM_ALLOCATOR_UNDERLYING_IMPL DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY
+        #define DM_ALLOCATOR_UNDERLYING_IMPL DM_ALLOCATOR_UNDERLYING_IMPL_TLSF
     #endif //DM_ALLOCATOR_UNDERLYING_IMPL
 
     #ifndef DM_NATURAL_ALIGNMENT
         #define DM_NATURAL_ALIGNMENT 16
     #endif //DM_NATURAL_ALIGNMENT
 
+    // C-runtime functions used for allocations that do not fit and for the DM_MEM_ARENA_MALLOC arena.
+    // To be overridden when dm::Memory itself replaces malloc(), see src/dmalloc.cpp.
+
+    #ifndef DM_ALLOC_EXTERNAL_MALLOC
+        #define DM_ALLOC_EXTERNAL_MALLOC  ::malloc
+        #define DM_ALLOC_EXTERNAL_REALLOC ::realloc
+        #define DM_ALLOC_EXTERNAL_FREE    ::free
+    #endif //DM_ALLOC_EXTERNAL_MALLOC
+
+    // Per-thread caches of small allocation slots.
+    // Slots are taken from and returned to the shared lists in batches.
+
+    #ifndef DM_ALLOC_THREAD_CACHE
+        #if BX_PLATFORM_OSX || BX_PLATFORM_IOS
+            #define DM_ALLOC_THREAD_CACHE 0 // BX_THREAD is not supported there.
+        #else
+            #define DM_ALLOC_THREAD_CACHE 1
+        #endif // BX_PLATFORM_OSX || BX_PLATFORM_IOS
+    #endif //DM_ALLOC_THREAD_CACHE
+
+    #ifndef DM_ALLOC_THREAD_CACHE_SIZE
+        #define DM_ALLOC_THREAD_CACHE_SIZE 64 // Max number of cached slots per size class.
+    #endif //DM_ALLOC_THREAD_CACHE_SIZE
+
+    #ifndef DM_ALLOC_THREAD_CACHE_BYTES
+        #define DM_ALLOC_THREAD_CACHE_BYTES DM_KILOBYTES(64) // Max number of cached bytes per size class.
+    #endif //DM_ALLOC_THREAD_CACHE_BYTES
+
+    // Scratch stacks of threads other than the one that called dm::allocInit(), used through dm::stackAlloc.
+    // Mapped on first use, handed back to a pool when the thread exits and reused by the next thread.
+
+    #ifndef DM_ALLOC_THREAD_STACKS
+        #if BX_PLATFORM_OSX || BX_PLATFORM_IOS
+            #define DM_ALLOC_THREAD_STACKS 0 // BX_THREAD is not supported there. dm::stackAlloc is then safe to use from a single thread only.
+        #else
+            #define DM_ALLOC_THREAD_STACKS 1
+        #endif // BX_PLATFORM_OSX || BX_PLATFORM_IOS
+    #endif //DM_ALLOC_THREAD_STACKS
+
+    #ifndef DM_ALLOC_THREAD_STACK_SIZE
+        #define DM_ALLOC_THREAD_STACK_SIZE DM_MEGABYTES(8) // Reserved per thread, pages are committed on first touch. Allocations that do not fit go to the heap.
+    #endif //DM_ALLOC_THREAD_STACK_SIZE
+
+    // Heap allocations are spread over multiple independent heaps.
+    // Each thread allocates from its own arena, frees from other threads are deferred to the owner.
+
+    #ifndef DM_ALLOC_HEAP_ARENAS
+        #if BX_PLATFORM_OSX || BX_PLATFORM_IOS
+            #define DM_ALLOC_HEAP_ARENAS 1 // BX_THREAD is not supported there.
+        #else
+            #define DM_ALLOC_HEAP_ARENAS 4 // Arenas other than the first one take a segment each, see DM_MEM_MAX_SEGMENTS.
+        #endif // BX_PLATFORM_OSX || BX_PLATFORM_IOS
+    #endif //DM_ALLOC_HEAP_ARENAS
+
+    // Sampling profiler of dm::mainAlloc allocations, see dm::allocProfileSnapshot().
+    // Call sites are known only when bx is built with BX_CONFIG_ALLOCATOR_DEBUG, all samples go to a single unknown site otherwise.
+
+    #ifndef DM_ALLOC_PROFILE
+        #define DM_ALLOC_PROFILE 0 // Requires BX_THREAD, not supported on OSX and iOS.
+    #endif //DM_ALLOC_PROFILE
+
+    #ifndef DM_ALLOC_PROFILE_SAMPLE_RATE
+        #define DM_ALLOC_PROFILE_SAMPLE_RATE DM_KILOBYTES(256) // Mean bytes allocated by a thread between two samples, intervals are random. Use 0 to record every allocation.
+    #endif //DM_ALLOC_PROFILE_SAMPLE_RATE
+
+    #ifndef DM_ALLOC_PROFILE_MAX_SITES
+        #define DM_ALLOC_PROFILE_MAX_SITES 1024 // Power of two. Samples from further call sites go to the unknown site.
+    #endif //DM_ALLOC_PROFILE_MAX_SITES
+
+    #ifndef DM_ALLOC_PROFILE_MAX_LIVE
+        #define DM_ALLOC_PROFILE_MAX_LIVE 16384 // Power of two. Max number of tracked live samples, further samples are dropped.
+    #endif //DM_ALLOC_PROFILE_MAX_LIVE
+
     #ifndef DM_ALLOC_PRINT_STATS
         #define DM_ALLOC_PRINT_STATS 0
     #endif //DM_ALLOC_PRINT_STATS
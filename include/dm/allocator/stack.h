@@ -13,17 +13,19 @@
 
 struct DynamicStack
 {
-    void init(uint8_t** _stackPtr, uint8_t** _stackLimit)
+    /// '_highWater', if given, is raised to the highest stack pointer ever reached, by any stack sharing it.
+    void init(uint8_t** _stackPtr, uint8_t** _stackLimit, uint8_t** _highWater = NULL)
     {
-        setExternal(_stackPtr, _stackLimit);
+        setExternal(_stackPtr, _stackLimit, _highWater);
 
         this->init();
     }
 
-    void setExternal(uint8_t** _stackPtr, uint8_t** _stackLimit)
+    void setExternal(uint8_t** _stackPtr, uint8_t** _stackLimit, uint8_t** _highWater = NULL)
     {
         m_ptr = _stackPtr;
         m_end = _stackLimit;
+        m_highWater = _highWater;
     }
 
     void setInternal(uint8_t* _stackPtr, uint8_t* _stackLimit)
@@ -33,6 +35,7 @@ struct DynamicStack
 
         m_ptr = &m_internalPtr;
         m_end = &m_internalEnd;
+        m_highWater = NULL;
     }
 
     void setInternal(uint8_t* _stackLimit)
@@ -62,8 +65,17 @@ struct DynamicStack
         return *m_end;
     }
 
+    inline void trackHighWater()
+    {
+        if (NULL != m_highWater && *m_ptr > *m_highWater)
+        {
+            *m_highWater = *m_ptr;
+        }
+    }
+
     uint8_t** m_ptr;
     uint8_t** m_end;
+    uint8_t** m_highWater;
     uint8_t* m_internalPtr;
     uint8_t* m_internalEnd;
 };
@@ -100,6 +112,10 @@ struct FixedStack
         return m_end;
     }
 
+    inline void trackHighWater()
+    {
+    }
+
     uint8_t* m_ptr;
     uint8_t* m_end;
 };
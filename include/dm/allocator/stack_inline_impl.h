@@ -5,49 +5,27 @@
 
 #include "allocator_p.h"
 
-void* alloc(size_t _size)
+/// '_align' must be a power of two, smaller values than DM_NATURAL_ALIGNMENT are rounded up.
+void* alloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
 {
-    uint8_t* curr = getStackPtr();
-
-    // Determine required space for header.
-    const uint8_t* aligned    = (uint8_t*)dm::alignPtrNext(curr, DM_NATURAL_ALIGNMENT);
-    const uint8_t  spaceAvail = uint8_t(aligned-curr);
-    const uint8_t  headerSize = spaceAvail < Header ? uint8_t(HeaderAligned) : spaceAvail;
-
-    // Check for availability.
-    const int64_t advance = _size + headerSize;
-    if (advance > available())
-    {
-        DM_PRINT_STACK("Stack alloc: Stack full. Requested: %llu.%lluMB Available: %llu.%llu", dm::U_UMB(_size), dm::U_UMB(available()));
-        return NULL;
-    }
-
-    // Advance stack.
-    adjustStackPtr(advance);
-
-    // Setup pointer.
-    void* ptr = curr + headerSize;
-    writeSize(ptr, _size);
-
-    // Keep track of last allocation.
-    m_last = ptr;
-
-    DM_PRINT_STACK("Stack alloc: %llu.%lluMB / %llu.%lluMB - (0x%p)", dm::U_UMB(advance), dm::U_UMB(available()), ptr);
-
-    return ptr;
+    return this->allocCapacity(_size, _size, _align);
 }
 
-void* realloc(void* _ptr, size_t _size)
+/// Every allocation keeps its capacity next to its size. Realloc within the capacity never moves,
+/// the last allocation can also grow up to the end of the stack.
+/// Other allocations that outgrow their capacity are moved to the top with twice the capacity, so that
+/// several buffers growing in turns are moved a logarithmic number of times instead of on every call.
+void* realloc(void* _ptr, size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
 {
     if (NULL == _ptr)
     {
-        return this->alloc(_size);
+        return this->alloc(_size, _align);
     }
     else if (_ptr == m_last)
     {
         // Determine difference in size.
-        const size_t allocSize = readSize(_ptr);
-        const int64_t diff = int64_t(_size - allocSize);
+        const size_t capacity = readCapacity(_ptr);
+        const int64_t diff = int64_t(_size - capacity);
 
         // Check availability.
         if (diff > available())
@@ -58,9 +36,11 @@ void* realloc(void* _ptr, size_t _size)
 
         // Reposition stack.
         adjustStackPtr(diff);
+        trackPeak();
 
         // Write new size.
         writeSize(_ptr, _size);
+        writeCapacity(_ptr, _size);
 
         DM_PRINT_STACK("Stack realloc: %llu.%lluMB / %llu.%lluMB - (0x%p - 0x%p)", dm::U_UMB(diff), dm::U_UMB(available()), m_last, getStackPtr());
 
@@ -68,19 +48,30 @@ void* realloc(void* _ptr, size_t _size)
     }
     else if (this->contains(_ptr))
     {
-        DM_PRINT_STACK("Stack realloc: Called on a pointer other than the last one! (0x%p).", _ptr);
+        // Fits in place.
+        const size_t capacity = readCapacity(_ptr);
+        if (_size <= capacity)
+        {
+            writeSize(_ptr, _size);
+            return _ptr;
+        }
+
+        DM_PRINT_STACK("Stack realloc: Pointer other than the last one outgrew its capacity (0x%p).", _ptr);
 
-        // Make a new allocation on the stack.
-        void* newPtr = this->alloc(_size);
+        // Make a new allocation on the stack, with room to grow when possible.
+        void* newPtr = this->allocCapacity(_size, dm::max(_size, 2*capacity), _align);
         if (NULL == newPtr)
         {
-            // Not enugh space on the stack.
-            return NULL;
+            newPtr = this->alloc(_size, _align);
+            if (NULL == newPtr)
+            {
+                // Not enugh space on the stack.
+                return NULL;
+            }
         }
 
         // Copy data.
-        const size_t oldSize = readSize(_ptr);
-        memcpy(newPtr, _ptr, oldSize);
+        memcpy(newPtr, _ptr, readSize(_ptr));
 
         return newPtr;
     }
@@ -92,30 +83,81 @@ void* realloc(void* _ptr, size_t _size)
     }
 }
 
+/// Frames are linked through headers stored in the stack memory, so their number is not limited.
+/// When there is no room left for a header, the frame is only counted and popping it releases nothing.
+/// Frames pushed after it are counted too, so that they are popped first.
 void push()
 {
-    DM_CHECK(m_currFrame < MaxFrames, "Stack::push | Max stack allocations reached!");
+    uint8_t* curr  = getStackPtr();
+    uint8_t* frame = (uint8_t*)dm::alignPtrNext(curr, sizeof(void*));
 
-    m_frames[m_currFrame++] = getStackPtr();
+    const int64_t advance = (frame-curr) + sizeof(Frame);
+    if (0 != m_overflow || advance > available())
+    {
+        ++m_overflow;
+        DM_PRINT_STACK("Stack push: Stack full, frame %d is not tracked.", m_depth+m_overflow);
+        return;
+    }
+
+    Frame* header = (Frame*)frame;
+    header->m_prev = m_frame;
+    header->m_ptr  = curr;
+
+    m_frame = header;
+    ++m_depth;
+
+    setStackPtr(frame + sizeof(Frame));
+    trackPeak();
     m_last = getStackPtr();
 
-    DM_PRINT_STACK("Stack push: > %d \t %llu.%lluMB", m_currFrame, dm::U_UMB(available()));
+    DM_PRINT_STACK("Stack push: > %d \t %llu.%lluMB", m_depth, dm::U_UMB(available()));
 }
 
 void pop()
 {
-    DM_CHECK(m_currFrame > 0, "Stack::pop | Nothing left to pop!");
+    DM_CHECK(m_depth+m_overflow > 0, "Stack::pop | Nothing left to pop!");
 
-    if (m_currFrame > 0)
+    if (0 != m_overflow)
+    {
+        --m_overflow;
+    }
+    else if (0 != m_depth)
     {
-        --m_currFrame;
-        setStackPtr((uint8_t*)m_frames[m_currFrame]);
+        setStackPtr(m_frame->m_ptr);
+        m_frame = m_frame->m_prev;
+        --m_depth;
         m_last = getStackPtr();
 
-        DM_PRINT_STACK("Stack pop:  %d < \t %llu.%lluMB", m_currFrame, dm::U_UMB(available()));
+        DM_PRINT_STACK("Stack pop:  %d < \t %llu.%lluMB", m_depth, dm::U_UMB(available()));
     }
 }
 
+dm::StackMarker getMarker() const
+{
+    dm::StackMarker marker;
+    marker.m_pos      = uintptr_t(getStackPtr());
+    marker.m_frame    = uintptr_t(m_frame);
+    marker.m_depth    = m_depth;
+    marker.m_overflow = m_overflow;
+    return marker;
+}
+
+/// Releases everything allocated after the marker was taken, frames pushed since then included.
+void rewind(const dm::StackMarker& _marker)
+{
+    DM_CHECK(_marker.m_pos <= uintptr_t(getStackPtr()) && _marker.m_depth <= m_depth
+           , "Stack::rewind | Marker is not from this stack or its frame was already popped!"
+           );
+
+    setStackPtr((uint8_t*)_marker.m_pos);
+    m_frame    = (Frame*)_marker.m_frame;
+    m_depth    = _marker.m_depth;
+    m_overflow = _marker.m_overflow;
+    m_last     = getStackPtr();
+
+    DM_PRINT_STACK("Stack rewind: %d \t %llu.%lluMB", m_depth, dm::U_UMB(available()));
+}
+
 bool contains(void* _ptr) const
 {
     return (m_beg <= _ptr && _ptr < getStackPtr());
@@ -131,6 +173,11 @@ void* begin() const
     return m_beg;
 }
 
+void* end() const
+{
+    return getEnd();
+}
+
 int64_t available() const
 {
     return getEnd() - getStackPtr();
@@ -141,6 +188,12 @@ size_t getUsage()
     return getStackPtr() - m_beg;
 }
 
+/// Highest usage since init().
+size_t getPeakUsage() const
+{
+    return m_peak - m_beg;
+}
+
 size_t total()
 {
     return getEnd() - m_beg;
@@ -151,7 +204,7 @@ void printStats()
 {
     const size_t size = getStackPtr() - m_beg;
     printf("Stack:\n");
-    printf("\tPosition: %d, Size: %llu.%lluMB\n\n", m_currFrame, dm::U_UMB(size));
+    printf("\tPosition: %d, Size: %llu.%lluMB\n\n", m_depth+m_overflow, dm::U_UMB(size));
 }
 #endif //DM_ALLOC_PRINT_STATS
 
@@ -162,11 +215,57 @@ static inline size_t readSize(void* _ptr)
 }
 
 private:
+void* allocCapacity(size_t _size, size_t _capacity, size_t _align)
+{
+    uint8_t* curr = getStackPtr();
+
+    // Determine required space for header, it is written right before the aligned pointer.
+    const size_t   align      = _align < DM_NATURAL_ALIGNMENT ? DM_NATURAL_ALIGNMENT : _align;
+    const uint8_t* aligned    = (uint8_t*)dm::alignPtrNext(curr+Header, align);
+    const size_t   headerSize = size_t(aligned-curr);
+
+    // Check for availability.
+    const int64_t advance = _capacity + headerSize;
+    if (advance > available())
+    {
+        DM_PRINT_STACK("Stack alloc: Stack full. Requested: %llu.%lluMB Available: %llu.%llu", dm::U_UMB(_capacity), dm::U_UMB(available()));
+        return NULL;
+    }
+
+    // Advance stack.
+    adjustStackPtr(advance);
+    trackPeak();
+
+    // Setup pointer.
+    void* ptr = curr + headerSize;
+    writeSize(ptr, _size);
+    writeCapacity(ptr, _capacity);
+
+    // Keep track of last allocation.
+    m_last = ptr;
+
+    DM_PRINT_STACK("Stack alloc: %llu.%lluMB / %llu.%lluMB - (0x%p)", dm::U_UMB(advance), dm::U_UMB(available()), ptr);
+
+    return ptr;
+}
+
 void init()
 {
     m_last = getStackPtr();
     m_beg  = getStackPtr();
-    m_currFrame = 0;
+    m_peak = getStackPtr();
+    m_frame    = NULL;
+    m_depth    = 0;
+    m_overflow = 0;
+}
+
+inline void trackPeak()
+{
+    if (getStackPtr() > m_peak)
+    {
+        m_peak = getStackPtr();
+        trackHighWater();
+    }
 }
 
 static inline void writeSize(void* _ptr, size_t _size)
@@ -175,17 +274,34 @@ static inline void writeSize(void* _ptr, size_t _size)
     *_dst = _size;
 }
 
+static inline size_t readCapacity(void* _ptr)
+{
+    size_t* _dst = (size_t*)_ptr - 2;
+    return *_dst;
+}
+
+static inline void writeCapacity(void* _ptr, size_t _capacity)
+{
+    size_t* _dst = (size_t*)_ptr - 2;
+    *_dst = _capacity;
+}
+
 enum
 {
-    MaxFrames = 128,
+    Header = 2*sizeof(size_t), // Capacity and size.
+};
 
-    Header        = sizeof(size_t),
-    HeaderAligned = (((Header-1)/DM_NATURAL_ALIGNMENT)+1)*DM_NATURAL_ALIGNMENT,
+struct Frame
+{
+    Frame*   m_prev;
+    uint8_t* m_ptr; // Stack pointer before push().
 };
 
 void*     m_last;
 uint8_t*  m_beg;
-uint16_t  m_currFrame;
-void*     m_frames[MaxFrames];
+uint8_t*  m_peak;
+Frame*    m_frame;
+uint32_t  m_depth;
+uint32_t  m_overflow;
 
 /* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,688 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_ALLOC_TRACE_H_HEADER_GUARD
+#define DM_ALLOC_TRACE_H_HEADER_GUARD
+
+// Allocation trace recording and replay.
+// TraceRecorder wraps any bx::ReallocatorI and streams its calls to a bx::WriterI. traceReplay() drives an allocator
+// with a recorded trace, so that allocator_config.h can be tuned offline against production traces.
+//
+// Trace layout, little endian:
+//     "DMAT", uint32_t version, uint32_t sizeof(TraceRecord), uint32_t reserved
+//     TraceRecord until the end of the stream.
+//-----
+
+#include <stdint.h>
+#include <stddef.h> // size_t
+
+#include "../../../3rdparty/bx/allocator.h"    // bx::ReallocatorI
+#include "../../../3rdparty/bx/readerwriter.h" // bx::WriterI, bx::ReaderI
+#include "allocator.h"                         // dm::AllocStats, dm::crtAlloc
+
+#include <bx/thread.h> // bx::LwMutex
+
+namespace dm
+{
+    struct TraceOp
+    {
+        enum Enum
+        {
+            Alloc,
+            Free,
+            Realloc, // Keeps the id of the reallocated block. Size 0 frees it.
+
+            Count
+        };
+    };
+
+    struct TraceRecord
+    {
+        uint64_t m_time;      // Nanoseconds since the recorder was created.
+        uint64_t m_size;      // 0 for TraceOp::Free.
+        uint32_t m_id;        // Ids are dense, given in order of allocation, starting with 0.
+        uint16_t m_thread;    // Threads are numbered in order of their first traced call, starting with 1.
+        uint8_t  m_op;        // TraceOp::Enum
+        uint8_t  m_alignLog2; // 0 for natural alignment.
+    };
+
+    /// Forwards to '_alloc' and records every call. Safe to share between threads.
+    /// Frees of blocks that were allocated before the recorder was created are forwarded but not recorded.
+    class TraceRecorder : public bx::ReallocatorI
+    {
+    public:
+        /// '_internal' provides memory for the pointer to id table.
+        TraceRecorder(bx::ReallocatorI* _alloc, bx::WriterI* _writer, bx::ReallocatorI* _internal = dm::crtAlloc);
+        virtual ~TraceRecorder(); // Flushes.
+
+        virtual void* alloc(size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE;
+        virtual void  free(void* _ptr, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE;
+        virtual void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) BX_OVERRIDE;
+
+        void     flush();
+        uint64_t numRecords() const;
+
+    private:
+        enum { BufferSize = 1024 };
+
+        struct Entry
+        {
+            void*    m_ptr;
+            uint32_t m_id;
+        };
+
+        void record(TraceOp::Enum _op, uint32_t _id, size_t _size, size_t _align);
+        void insert(void* _ptr, uint32_t _id);
+        bool remove(void* _ptr, uint32_t& _id);
+        void grow();
+
+        bx::ReallocatorI* m_alloc;
+        bx::WriterI*      m_writer;
+        bx::ReallocatorI* m_internal;
+        bx::LwMutex       m_mutex;
+        uint64_t          m_start;
+        uint64_t          m_numRecords;
+        uint32_t          m_nextId;
+        Entry*            m_entries; // Open addressing, kept at most half full.
+        uint32_t          m_numEntries;
+        uint32_t          m_maxEntries;
+        uint32_t          m_numBuffered;
+        TraceRecord       m_buffer[BufferSize];
+    };
+
+    struct TraceReplayStats
+    {
+        enum
+        {
+            P50,
+            P90,
+            P99,
+            P999,
+            Max,
+
+            NumPercentiles
+        };
+
+        struct Op
+        {
+            uint64_t m_count;
+            uint64_t m_time;                    // Nanoseconds in total.
+            uint64_t m_latency[NumPercentiles]; // Nanoseconds, upper bounds with about 12% precision.
+        };
+
+        Op         m_ops[TraceOp::Count];
+        uint64_t   m_time;          // Nanoseconds spent in the allocator.
+        double     m_opsPerSec;
+        uint64_t   m_failed;        // Allocations that returned NULL.
+        uint64_t   m_peakLiveBytes; // Requested sizes.
+        uint64_t   m_peakRss;       // Bytes, of the whole process since it started. 0 where unknown.
+        AllocStats m_statsAtPeak;   // allocGetStats() when live bytes peaked, describes fragmentation when replaying dm::mainAlloc.
+    };
+
+    /// Reads a whole trace. Returns NULL on an unknown or empty trace, the records are freed with BX_FREE(_alloc, ...).
+    TraceRecord* traceLoad(bx::ReaderI* _reader, uint32_t& _num, bx::ReallocatorI* _alloc = dm::crtAlloc);
+
+    /// Single threaded, in record order, '_alloc' can be any allocator such as dm::mainAlloc, dm::crtAlloc or dm::stackAlloc.
+    /// Blocks still live at the end of the trace are freed, untimed. Returns false if the trace frees an unknown id.
+    bool traceReplay(const TraceRecord* _records, uint32_t _num, bx::ReallocatorI* _alloc, TraceReplayStats& _stats);
+
+    void tracePrintStats(const TraceReplayStats& _stats);
+}
+
+#endif // DM_ALLOC_TRACE_H_HEADER_GUARD
+
+// Trace implementation, include this header in the translation unit that defines DM_ALLOCATOR_IMPL.
+//-----
+
+#if defined(DM_ALLOCATOR_IMPL) && !defined(DM_ALLOC_TRACE_IMPL_GUARD)
+#define DM_ALLOC_TRACE_IMPL_GUARD
+
+#include <stdio.h>  // printf
+#include <string.h> // memset
+
+#include <bx/uint32_t.h> // bx::uint64_cntlz()
+
+#if BX_PLATFORM_WINDOWS
+#   include <windows.h>      // QueryPerformanceCounter()
+#elif BX_PLATFORM_POSIX
+#   include <time.h>         // clock_gettime()
+#   include <sys/resource.h> // getrusage()
+#endif // BX_PLATFORM_WINDOWS
+
+namespace dm
+{
+    static inline uint64_t traceTime()
+    {
+        #if BX_PLATFORM_WINDOWS
+            LARGE_INTEGER freq, counter;
+            QueryPerformanceFrequency(&freq);
+            QueryPerformanceCounter(&counter);
+            return uint64_t(double(counter.QuadPart)*1e9/double(freq.QuadPart));
+        #elif BX_PLATFORM_POSIX
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return uint64_t(now.tv_sec)*UINT64_C(1000000000) + uint64_t(now.tv_nsec);
+        #else
+            return 0;
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    static inline uint64_t tracePeakRss()
+    {
+        #if BX_PLATFORM_OSX || BX_PLATFORM_IOS
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            return uint64_t(usage.ru_maxrss); // Bytes.
+        #elif BX_PLATFORM_POSIX
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            return uint64_t(usage.ru_maxrss)<<10; // Kilobytes.
+        #else
+            return 0;
+        #endif // BX_PLATFORM_OSX || BX_PLATFORM_IOS
+    }
+
+    static inline uint32_t traceHash(const void* _ptr)
+    {
+        // Fibonacci hashing, low bits of allocations are mostly zero.
+        const uint64_t key = uint64_t(uintptr_t(_ptr));
+        return uint32_t((key*UINT64_C(0x9e3779b97f4a7c15))>>32);
+    }
+
+    static volatile uint32_t s_traceNumThreads;
+    static BX_THREAD uint32_t s_traceThread;
+
+    static inline uint16_t traceThread()
+    {
+        if (0 == s_traceThread)
+        {
+            s_traceThread = dm::atomicFetchAndAdd32(&s_traceNumThreads, 1) + 1;
+        }
+
+        return uint16_t(s_traceThread);
+    }
+
+    // TraceRecorder.
+    //-----
+
+    TraceRecorder::TraceRecorder(bx::ReallocatorI* _alloc, bx::WriterI* _writer, bx::ReallocatorI* _internal)
+        : m_alloc(_alloc)
+        , m_writer(_writer)
+        , m_internal(_internal)
+        , m_start(traceTime())
+        , m_numRecords(0)
+        , m_nextId(0)
+        , m_entries(NULL)
+        , m_numEntries(0)
+        , m_maxEntries(0)
+        , m_numBuffered(0)
+    {
+        const uint32_t magic    = BX_MAKEFOURCC('D', 'M', 'A', 'T');
+        const uint32_t version  = 1;
+        const uint32_t size     = sizeof(TraceRecord);
+        const uint32_t reserved = 0;
+        bx::write(m_writer, magic);
+        bx::write(m_writer, version);
+        bx::write(m_writer, size);
+        bx::write(m_writer, reserved);
+
+        grow();
+    }
+
+    TraceRecorder::~TraceRecorder()
+    {
+        flush();
+        BX_FREE(m_internal, m_entries);
+    }
+
+    void* TraceRecorder::alloc(size_t _size, size_t _align, const char* _file, uint32_t _line)
+    {
+        void* ptr = m_alloc->alloc(_size, _align, _file, _line);
+        if (NULL == ptr)
+        {
+            return NULL;
+        }
+
+        // Recorded after the call, the block can not be handed out to another thread before.
+        bx::LwMutexScope lock(m_mutex);
+
+        const uint32_t id = m_nextId++;
+        insert(ptr, id);
+        record(TraceOp::Alloc, id, _size, _align);
+
+        return ptr;
+    }
+
+    void TraceRecorder::free(void* _ptr, size_t _align, const char* _file, uint32_t _line)
+    {
+        if (NULL != _ptr)
+        {
+            // Recorded before the call, for the same reason.
+            bx::LwMutexScope lock(m_mutex);
+
+            uint32_t id;
+            if (remove(_ptr, id))
+            {
+                record(TraceOp::Free, id, 0, _align);
+            }
+        }
+
+        m_alloc->free(_ptr, _align, _file, _line);
+    }
+
+    void* TraceRecorder::realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line)
+    {
+        // The old block is released inside the call, hold the lock so that it is not recorded as reused first.
+        bx::LwMutexScope lock(m_mutex);
+
+        void* ptr = m_alloc->realloc(_ptr, _size, _align, _file, _line);
+        if (NULL == ptr && 0 != _size)
+        {
+            return NULL;
+        }
+
+        if (NULL == _ptr)
+        {
+            const uint32_t id = m_nextId++;
+            insert(ptr, id);
+            record(TraceOp::Alloc, id, _size, _align);
+            return ptr;
+        }
+
+        uint32_t id;
+        if (remove(_ptr, id))
+        {
+            if (NULL != ptr)
+            {
+                insert(ptr, id);
+            }
+            record(TraceOp::Realloc, id, _size, _align);
+        }
+
+        return ptr;
+    }
+
+    void TraceRecorder::flush()
+    {
+        bx::LwMutexScope lock(m_mutex);
+
+        if (0 != m_numBuffered)
+        {
+            bx::write(m_writer, m_buffer, int32_t(m_numBuffered*sizeof(TraceRecord)));
+            m_numBuffered = 0;
+        }
+    }
+
+    uint64_t TraceRecorder::numRecords() const
+    {
+        return m_numRecords;
+    }
+
+    void TraceRecorder::record(TraceOp::Enum _op, uint32_t _id, size_t _size, size_t _align)
+    {
+        TraceRecord& record = m_buffer[m_numBuffered];
+        record.m_time      = traceTime() - m_start;
+        record.m_size      = uint64_t(_size);
+        record.m_id        = _id;
+        record.m_thread    = traceThread();
+        record.m_op        = uint8_t(_op);
+        record.m_alignLog2 = (_align <= 1) ? 0 : uint8_t(63 - bx::uint64_cntlz(uint64_t(_align)));
+        m_numRecords++;
+
+        if (BufferSize == ++m_numBuffered)
+        {
+            bx::write(m_writer, m_buffer, int32_t(sizeof(m_buffer)));
+            m_numBuffered = 0;
+        }
+    }
+
+    void TraceRecorder::insert(void* _ptr, uint32_t _id)
+    {
+        if (m_numEntries >= m_maxEntries/2)
+        {
+            grow();
+        }
+
+        uint32_t idx = traceHash(_ptr) & (m_maxEntries-1);
+        while (NULL != m_entries[idx].m_ptr)
+        {
+            idx = (idx+1) & (m_maxEntries-1);
+        }
+        m_entries[idx].m_ptr = _ptr;
+        m_entries[idx].m_id  = _id;
+        m_numEntries++;
+    }
+
+    bool TraceRecorder::remove(void* _ptr, uint32_t& _id)
+    {
+        const uint32_t mask = m_maxEntries-1;
+
+        uint32_t hole = traceHash(_ptr) & mask;
+        for (; _ptr != m_entries[hole].m_ptr; hole = (hole+1) & mask)
+        {
+            if (NULL == m_entries[hole].m_ptr)
+            {
+                return false;
+            }
+        }
+        _id = m_entries[hole].m_id;
+
+        // Shift following entries of the probe sequence back, so that lookups do not need tombstones.
+        for (uint32_t idx = (hole+1) & mask; NULL != m_entries[idx].m_ptr; idx = (idx+1) & mask)
+        {
+            const uint32_t home = traceHash(m_entries[idx].m_ptr) & mask;
+            const bool movable = (hole <= idx) ? (home <= hole || home > idx) : (home <= hole && home > idx);
+            if (movable)
+            {
+                m_entries[hole] = m_entries[idx];
+                hole = idx;
+            }
+        }
+
+        m_entries[hole].m_ptr = NULL;
+        m_numEntries--;
+
+        return true;
+    }
+
+    void TraceRecorder::grow()
+    {
+        Entry* const   entries    = m_entries;
+        const uint32_t maxEntries = m_maxEntries;
+
+        m_maxEntries = (0 == maxEntries) ? 4096 : maxEntries*2;
+        m_entries    = (Entry*)BX_ALLOC(m_internal, m_maxEntries*sizeof(Entry));
+        m_numEntries = 0;
+        memset(m_entries, 0, m_maxEntries*sizeof(Entry));
+
+        for (uint32_t ii = 0; ii < maxEntries; ++ii)
+        {
+            if (NULL != entries[ii].m_ptr)
+            {
+                insert(entries[ii].m_ptr, entries[ii].m_id);
+            }
+        }
+
+        BX_FREE(m_internal, entries);
+    }
+
+    // Replay.
+    //-----
+
+    struct TraceHistogram
+    {
+        enum
+        {
+            SubBits    = 3, // 8 buckets per power of two.
+            NumBuckets = (64-SubBits+1)<<SubBits,
+        };
+
+        static uint32_t bucket(uint64_t _ns)
+        {
+            if (_ns < (1<<SubBits))
+            {
+                return uint32_t(_ns);
+            }
+
+            const uint32_t log = 63 - uint32_t(bx::uint64_cntlz(_ns));
+            const uint32_t sub = uint32_t(_ns>>(log-SubBits)) & ((1<<SubBits)-1);
+            return ((log-SubBits+1)<<SubBits) + sub;
+        }
+
+        static uint64_t upperBound(uint32_t _bucket)
+        {
+            if (_bucket < (1<<SubBits))
+            {
+                return _bucket;
+            }
+
+            const uint32_t log = (_bucket>>SubBits) + SubBits-1;
+            const uint64_t sub = _bucket & ((1<<SubBits)-1);
+            return (((UINT64_C(1)<<SubBits) + sub + 1)<<(log-SubBits)) - 1;
+        }
+
+        void percentiles(uint64_t _count, uint64_t* _latency) const
+        {
+            static const double s_fractions[TraceReplayStats::Max] = { 0.5, 0.9, 0.99, 0.999 };
+
+            memset(_latency, 0, TraceReplayStats::NumPercentiles*sizeof(uint64_t));
+            if (0 == _count)
+            {
+                return;
+            }
+
+            uint32_t pp  = 0;
+            uint64_t sum = 0;
+            for (uint32_t ii = 0; ii < NumBuckets; ++ii)
+            {
+                if (0 == m_buckets[ii])
+                {
+                    continue;
+                }
+
+                sum += m_buckets[ii];
+                for (; pp < TraceReplayStats::Max && double(sum) >= s_fractions[pp]*double(_count); ++pp)
+                {
+                    _latency[pp] = upperBound(ii);
+                }
+                _latency[TraceReplayStats::Max] = upperBound(ii);
+            }
+        }
+
+        uint64_t m_buckets[NumBuckets];
+    };
+
+    TraceRecord* traceLoad(bx::ReaderI* _reader, uint32_t& _num, bx::ReallocatorI* _alloc)
+    {
+        _num = 0;
+
+        uint32_t header[4];
+        if (int32_t(sizeof(header)) != bx::read(_reader, header, int32_t(sizeof(header)))
+        ||  BX_MAKEFOURCC('D', 'M', 'A', 'T') != header[0]
+        ||  1 != header[1]
+        ||  sizeof(TraceRecord) != header[2])
+        {
+            return NULL;
+        }
+
+        TraceRecord* records = NULL;
+        uint32_t max = 0;
+        for (;;)
+        {
+            if (_num == max)
+            {
+                max = (0 == max) ? 4096 : max*2;
+                records = (TraceRecord*)BX_REALLOC(_alloc, records, max*sizeof(TraceRecord));
+            }
+
+            if (int32_t(sizeof(TraceRecord)) != bx::read(_reader, &records[_num], int32_t(sizeof(TraceRecord))))
+            {
+                break;
+            }
+            _num++;
+        }
+
+        if (0 == _num)
+        {
+            BX_FREE(_alloc, records);
+            return NULL;
+        }
+
+        return records;
+    }
+
+    bool traceReplay(const TraceRecord* _records, uint32_t _num, bx::ReallocatorI* _alloc, TraceReplayStats& _stats)
+    {
+        memset(&_stats, 0, sizeof(TraceReplayStats));
+
+        // First pass finds the number of ids and where live memory peaks.
+        uint32_t numIds = 0;
+        for (uint32_t ii = 0; ii < _num; ++ii)
+        {
+            numIds = dm::max(numIds, _records[ii].m_id+1);
+        }
+
+        void**    ptrs   = (void**)   BX_ALLOC(dm::crtAlloc, numIds*sizeof(void*));
+        uint64_t* sizes  = (uint64_t*)BX_ALLOC(dm::crtAlloc, numIds*sizeof(uint64_t));
+        uint8_t*  aligns = (uint8_t*) BX_ALLOC(dm::crtAlloc, numIds*sizeof(uint8_t)); // Live blocks left at the end are freed with these.
+        memset(sizes, 0, numIds*sizeof(uint64_t));
+
+        uint32_t peak = 0;
+        uint64_t live = 0;
+        for (uint32_t ii = 0; ii < _num; ++ii)
+        {
+            const TraceRecord& record = _records[ii];
+            live += record.m_size - sizes[record.m_id];
+            sizes[record.m_id] = record.m_size;
+
+            if (live > _stats.m_peakLiveBytes)
+            {
+                _stats.m_peakLiveBytes = live;
+                peak = ii;
+            }
+        }
+        memset(ptrs, 0, numIds*sizeof(void*));
+
+        TraceHistogram* histograms = (TraceHistogram*)BX_ALLOC(dm::crtAlloc, TraceOp::Count*sizeof(TraceHistogram));
+        memset(histograms, 0, TraceOp::Count*sizeof(TraceHistogram));
+
+        // Cost of reading the clock, taken out of every measurement.
+        uint64_t overhead = UINT64_MAX;
+        for (uint32_t ii = 0; ii < 64; ++ii)
+        {
+            const uint64_t t0 = traceTime();
+            const uint64_t t1 = traceTime();
+            overhead = dm::min(overhead, t1-t0);
+        }
+
+        bool result = true;
+        for (uint32_t ii = 0; ii < _num; ++ii)
+        {
+            const TraceRecord& record = _records[ii];
+            const size_t align = (0 == record.m_alignLog2) ? 0 : size_t(1)<<record.m_alignLog2;
+            void*& ptr = ptrs[record.m_id];
+
+            uint64_t t0 = 0;
+            uint64_t t1 = 0;
+            if (TraceOp::Alloc == record.m_op)
+            {
+                t0 = traceTime();
+                ptr = _alloc->alloc(size_t(record.m_size), align, NULL, 0);
+                t1 = traceTime();
+
+                aligns[record.m_id] = record.m_alignLog2;
+
+                _stats.m_failed += (NULL == ptr);
+            }
+            else if (TraceOp::Free == record.m_op)
+            {
+                if (NULL == ptr)
+                {
+                    result = false;
+                    continue;
+                }
+
+                t0 = traceTime();
+                _alloc->free(ptr, align, NULL, 0);
+                t1 = traceTime();
+
+                ptr = NULL;
+            }
+            else if (TraceOp::Realloc == record.m_op)
+            {
+                t0 = traceTime();
+                void* newPtr = _alloc->realloc(ptr, size_t(record.m_size), align, NULL, 0);
+                t1 = traceTime();
+
+                if (NULL != newPtr || 0 == record.m_size)
+                {
+                    ptr = newPtr;
+                }
+                _stats.m_failed += (NULL == newPtr && 0 != record.m_size);
+            }
+            else
+            {
+                result = false;
+                continue;
+            }
+
+            const uint64_t time = (t1-t0 > overhead) ? t1-t0-overhead : 0;
+            TraceReplayStats::Op& op = _stats.m_ops[record.m_op];
+            op.m_count++;
+            op.m_time += time;
+            histograms[record.m_op].m_buckets[TraceHistogram::bucket(time)]++;
+
+            if (ii == peak)
+            {
+                allocGetStats(&_stats.m_statsAtPeak);
+            }
+        }
+
+        for (uint32_t ii = 0; ii < numIds; ++ii)
+        {
+            if (NULL != ptrs[ii])
+            {
+                const size_t align = (0 == aligns[ii]) ? 0 : size_t(1)<<aligns[ii];
+                _alloc->free(ptrs[ii], align, NULL, 0);
+            }
+        }
+
+        uint64_t count = 0;
+        for (uint32_t ii = 0; ii < TraceOp::Count; ++ii)
+        {
+            TraceReplayStats::Op& op = _stats.m_ops[ii];
+            histograms[ii].percentiles(op.m_count, op.m_latency);
+
+            _stats.m_time += op.m_time;
+            count += op.m_count;
+        }
+        _stats.m_opsPerSec = (0 == _stats.m_time) ? 0.0 : double(count)*1e9/double(_stats.m_time);
+        _stats.m_peakRss   = tracePeakRss();
+
+        BX_FREE(dm::crtAlloc, histograms);
+        BX_FREE(dm::crtAlloc, aligns);
+        BX_FREE(dm::crtAlloc, sizes);
+        BX_FREE(dm::crtAlloc, ptrs);
+
+        return result;
+    }
+
+    void tracePrintStats(const TraceReplayStats& _stats)
+    {
+        static const char* s_opName[TraceOp::Count] = { "alloc", "free", "realloc" };
+
+        printf("%-8s %12s %10s %8s %8s %8s %8s %10s\n", "op", "count", "avg ns", "p50", "p90", "p99", "p99.9", "max");
+        for (uint32_t ii = 0; ii < TraceOp::Count; ++ii)
+        {
+            const TraceReplayStats::Op& op = _stats.m_ops[ii];
+            printf("%-8s %12llu %10.1f %8llu %8llu %8llu %8llu %10llu\n"
+                  , s_opName[ii]
+                  , (unsigned long long)op.m_count
+                  , (0 == op.m_count) ? 0.0 : double(op.m_time)/double(op.m_count)
+                  , (unsigned long long)op.m_latency[TraceReplayStats::P50]
+                  , (unsigned long long)op.m_latency[TraceReplayStats::P90]
+                  , (unsigned long long)op.m_latency[TraceReplayStats::P99]
+                  , (unsigned long long)op.m_latency[TraceReplayStats::P999]
+                  , (unsigned long long)op.m_latency[TraceReplayStats::Max]
+                  );
+        }
+
+        const AllocStats& peak = _stats.m_statsAtPeak;
+        printf("\nThroughput: %.2f Mops/s (%.3f ms in the allocator)\n", _stats.m_opsPerSec*1e-6, double(_stats.m_time)*1e-6);
+        printf("Failed allocations: %llu\n", (unsigned long long)_stats.m_failed);
+        printf("Peak live: %.2f MB requested, peak RSS %.2f MB\n", double(_stats.m_peakLiveBytes)/1048576.0, double(_stats.m_peakRss)/1048576.0);
+        printf("At peak: heap %.2f MB used / %.2f MB, %u free blocks, fragmentation %.3f\n"
+              , double(peak.m_heapUsed)/1048576.0
+              , double(peak.m_heapSize)/1048576.0
+              , peak.m_heapFreeBlocks
+              , peak.m_heapFragmentation
+              );
+    }
+
+} // namespace dm
+
+#endif // defined(DM_ALLOCATOR_IMPL) && !defined(DM_ALLOC_TRACE_IMPL_GUARD)
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_VMEM_H_HEADER_GUARD
+#define DM_VMEM_H_HEADER_GUARD
+
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
+#include <string.h> // memcpy
+
+#include "../common/common.h"              // DM_INLINE
+#include "../../../3rdparty/bx/platform.h" // BX_PLATFORM_*
+#include "../../../3rdparty/bx/macros.h"   // BX_UNUSED
+
+#if BX_PLATFORM_WINDOWS
+#   include <windows.h>   // VirtualAlloc(), VirtualFree()
+#elif BX_PLATFORM_POSIX
+#   include <sys/mman.h>  // mmap(), munmap(), madvise()
+#   include <unistd.h>    // sysconf()
+#endif // BX_PLATFORM_WINDOWS
+
+// Virtual memory helpers.
+// Reserved memory is readable and writable right away, physical pages are provided by the OS on first touch.
+
+namespace dm
+{
+    struct PageMode
+    {
+        enum Enum
+        {
+            Regular,
+            TransparentHuge, // Regular pages, the OS is asked to back them with huge pages (THP).
+            Huge,            // Explicit huge pages (MAP_HUGETLB / MEM_LARGE_PAGES).
+
+            Count
+        };
+    };
+
+    DM_INLINE const char* pageModeName(PageMode::Enum _mode)
+    {
+        static const char* s_names[PageMode::Count] =
+        {
+            "regular",
+            "transparent huge",
+            "huge",
+        };
+
+        return s_names[_mode];
+    }
+
+    enum
+    {
+        HugePageSize = 2<<20,
+    };
+
+    DM_INLINE size_t vmemPageSize()
+    {
+        #if BX_PLATFORM_WINDOWS
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return size_t(info.dwPageSize);
+        #elif BX_PLATFORM_POSIX
+            return size_t(sysconf(_SC_PAGESIZE));
+        #else
+            return 4096;
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    /// Returns NULL on failure.
+    DM_INLINE void* vmemReserve(size_t _size)
+    {
+        #if BX_PLATFORM_WINDOWS
+            return VirtualAlloc(NULL, _size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        #elif BX_PLATFORM_POSIX
+            #if defined(MAP_NORESERVE)
+                const int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+            #else
+                const int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+            #endif // defined(MAP_NORESERVE)
+
+            void* ptr = mmap(NULL, _size, PROT_READ|PROT_WRITE, flags, -1, 0);
+            return (MAP_FAILED == ptr) ? NULL : ptr;
+        #else
+            BX_UNUSED(_size);
+            return NULL;
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    /// '_align' must be a power of two and a multiple of the page size. Returns NULL on failure.
+    DM_INLINE void* vmemReserveAligned(size_t _size, size_t _align)
+    {
+        #if BX_PLATFORM_WINDOWS
+            // Parts of a reservation can not be released, find an aligned address and reserve exactly there.
+            for (uint32_t ii = 0; ii < 8; ++ii)
+            {
+                void* mem = VirtualAlloc(NULL, _size + _align, MEM_RESERVE, PAGE_NOACCESS);
+                if (NULL == mem)
+                {
+                    return NULL;
+                }
+                VirtualFree(mem, 0, MEM_RELEASE);
+
+                void* aligned = (void*)((uintptr_t(mem) + _align-1) & ~uintptr_t(_align-1));
+                void* ptr = VirtualAlloc(aligned, _size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+                if (NULL != ptr)
+                {
+                    return ptr;
+                }
+            }
+
+            return NULL;
+        #elif BX_PLATFORM_POSIX
+            // Over-reserve and trim.
+            uint8_t* mem = (uint8_t*)vmemReserve(_size + _align);
+            if (NULL == mem)
+            {
+                return NULL;
+            }
+
+            uint8_t* ptr = (uint8_t*)((uintptr_t(mem) + _align-1) & ~uintptr_t(_align-1));
+            const size_t head = size_t(ptr - mem);
+            const size_t tail = _align - head;
+            if (0 != head)
+            {
+                munmap(mem, head);
+            }
+            if (0 != tail)
+            {
+                munmap(ptr + _size, tail);
+            }
+
+            return ptr;
+        #else
+            BX_UNUSED(_size, _align);
+            return NULL;
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    /// Reserves memory aligned to HugePageSize and backed by huge pages where possible.
+    /// '_size' is rounded up to a multiple of HugePageSize. Returns NULL on failure.
+    DM_INLINE void* vmemReserveHuge(size_t& _size, PageMode::Enum& _mode)
+    {
+        const size_t size = (_size + HugePageSize-1) & ~size_t(HugePageSize-1);
+        _size = size;
+
+        #if BX_PLATFORM_WINDOWS
+            const size_t largePageSize = GetLargePageMinimum();
+            if (0 != largePageSize && 0 == (size % largePageSize))
+            {
+                // Requires 'SeLockMemoryPrivilege', fails otherwise.
+                void* ptr = VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+                if (NULL != ptr)
+                {
+                    _mode = PageMode::Huge;
+                    return ptr;
+                }
+            }
+
+            _mode = PageMode::Regular;
+            return vmemReserve(size);
+        #elif BX_PLATFORM_POSIX
+            #if defined(MAP_HUGETLB)
+                // Succeeds only if enough huge pages were preallocated (/proc/sys/vm/nr_hugepages).
+                // No MAP_NORESERVE here, the reservation is what makes it fail early instead of on first touch.
+                void* huge = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+                if (MAP_FAILED != huge)
+                {
+                    _mode = PageMode::Huge;
+                    return huge;
+                }
+            #endif // defined(MAP_HUGETLB)
+
+            void* ptr = vmemReserveAligned(size, HugePageSize);
+            if (NULL == ptr)
+            {
+                return NULL;
+            }
+
+            _mode = PageMode::Regular;
+            #if defined(MADV_HUGEPAGE)
+                if (0 == madvise(ptr, size, MADV_HUGEPAGE))
+                {
+                    _mode = PageMode::TransparentHuge;
+                }
+            #endif // defined(MADV_HUGEPAGE)
+
+            return ptr;
+        #else
+            _mode = PageMode::Regular;
+            return vmemReserve(size);
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    DM_INLINE void vmemRelease(void* _ptr, size_t _size)
+    {
+        #if BX_PLATFORM_WINDOWS
+            BX_UNUSED(_size);
+            VirtualFree(_ptr, 0, MEM_RELEASE);
+        #elif BX_PLATFORM_POSIX
+            munmap(_ptr, _size);
+        #else
+            BX_UNUSED(_ptr, _size);
+        #endif // BX_PLATFORM_WINDOWS
+    }
+
+    /// Resizes a mapping made by vmemReserve(), the mapping may move. Sizes are expected to be multiples of the page size.
+    /// Where supported (mremap), pages are moved by updating page tables, their content is never copied.
+    /// Returns NULL on failure, the original mapping is left intact then.
+    DM_INLINE void* vmemRemap(void* _ptr, size_t _size, size_t _newSize)
+    {
+        #if BX_PLATFORM_LINUX && defined(MREMAP_MAYMOVE)
+            void* ptr = mremap(_ptr, _size, _newSize, MREMAP_MAYMOVE);
+            return (MAP_FAILED == ptr) ? NULL : ptr;
+        #else
+            void* ptr = vmemReserve(_newSize);
+            if (NULL == ptr)
+            {
+                return NULL;
+            }
+
+            memcpy(ptr, _ptr, (_size < _newSize) ? _size : _newSize);
+            vmemRelease(_ptr, _size);
+
+            return ptr;
+        #endif // BX_PLATFORM_LINUX && defined(MREMAP_MAYMOVE)
+    }
+
+    /// Hands physical pages inside [_ptr, _ptr+_size) back to the OS. Partially covered pages are kept.
+    /// For huge page backed memory, '_pageSize' should be HugePageSize, so that huge pages are not split.
+    /// The range stays accessible, its content is undefined on next access.
+    /// Returns the number of bytes given back.
+    DM_INLINE size_t vmemDecommit(void* _ptr, size_t _size, size_t _pageSize)
+    {
+        const uintptr_t mask = uintptr_t(_pageSize-1);
+        const uintptr_t beg  = (uintptr_t(_ptr) + mask) & ~mask;
+        const uintptr_t end  = (uintptr_t(_ptr) + _size) & ~mask;
+        if (beg >= end)
+        {
+            return 0;
+        }
+
+        const size_t size = size_t(end - beg);
+
+        #if BX_PLATFORM_WINDOWS
+            VirtualAlloc((void*)beg, size, MEM_RESET, PAGE_READWRITE);
+        #elif BX_PLATFORM_POSIX
+            #if defined(MADV_FREE) && DM_MEM_DECOMMIT_LAZY
+                madvise((void*)beg, size, MADV_FREE);
+            #else
+                madvise((void*)beg, size, MADV_DONTNEED);
+            #endif // defined(MADV_FREE) && DM_MEM_DECOMMIT_LAZY
+        #endif // BX_PLATFORM_WINDOWS
+
+        return size;
+    }
+
+} // namespace dm
+
+#endif // DM_VMEM_H_HEADER_GUARD
+
+/* vim: set sw=4 ts=4 expandtab: */
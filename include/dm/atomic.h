@@ -0,0 +1,137 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_ATOMIC_H_HEADER_GUARD
+#define DM_ATOMIC_H_HEADER_GUARD
+
+#include <stdint.h>
+
+#include "common/common.h"                // DM_INLINE
+#include "../../3rdparty/bx/platform.h"   // BX_COMPILER_MSVC
+
+#if BX_COMPILER_MSVC
+#   include <intrin.h>
+#   pragma intrinsic(_InterlockedCompareExchange64)
+#   pragma intrinsic(_InterlockedExchangeAdd)
+#   pragma intrinsic(_InterlockedCompareExchangePointer)
+#   pragma intrinsic(_InterlockedExchangePointer)
+#endif // BX_COMPILER_MSVC
+
+// 64-bit and pointer counterparts of bx::atomic*() from bx/cpu.h.
+// All operations are full barriers.
+
+namespace dm
+{
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE uint64_t atomicCompareAndSwap64(volatile uint64_t* _ptr, uint64_t _old, uint64_t _new)
+    {
+        #if BX_COMPILER_MSVC
+            return uint64_t(_InterlockedCompareExchange64((volatile __int64*)_ptr, __int64(_new), __int64(_old)));
+        #else
+            return __sync_val_compare_and_swap(_ptr, _old, _new);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE uint64_t atomicFetchAndAdd64(volatile uint64_t* _ptr, uint64_t _add)
+    {
+        #if BX_COMPILER_MSVC
+            uint64_t oldVal = *_ptr;
+            for (;;)
+            {
+                const uint64_t prev = atomicCompareAndSwap64(_ptr, oldVal, oldVal+_add);
+                if (prev == oldVal)
+                {
+                    return prev;
+                }
+                oldVal = prev;
+            }
+        #else
+            return __sync_fetch_and_add(_ptr, _add);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE uint64_t atomicFetchAndOr64(volatile uint64_t* _ptr, uint64_t _mask)
+    {
+        #if BX_COMPILER_MSVC
+            uint64_t oldVal = *_ptr;
+            for (;;)
+            {
+                const uint64_t prev = atomicCompareAndSwap64(_ptr, oldVal, oldVal|_mask);
+                if (prev == oldVal)
+                {
+                    return prev;
+                }
+                oldVal = prev;
+            }
+        #else
+            return __sync_fetch_and_or(_ptr, _mask);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE uint64_t atomicFetchAndAnd64(volatile uint64_t* _ptr, uint64_t _mask)
+    {
+        #if BX_COMPILER_MSVC
+            uint64_t oldVal = *_ptr;
+            for (;;)
+            {
+                const uint64_t prev = atomicCompareAndSwap64(_ptr, oldVal, oldVal&_mask);
+                if (prev == oldVal)
+                {
+                    return prev;
+                }
+                oldVal = prev;
+            }
+        #else
+            return __sync_fetch_and_and(_ptr, _mask);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE uint32_t atomicFetchAndAdd32(volatile uint32_t* _ptr, uint32_t _add)
+    {
+        #if BX_COMPILER_MSVC
+            return uint32_t(_InterlockedExchangeAdd((volatile long*)_ptr, long(_add)));
+        #else
+            return __sync_fetch_and_add(_ptr, _add);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE void* atomicCompareAndSwapPtr(void* volatile* _ptr, void* _old, void* _new)
+    {
+        #if BX_COMPILER_MSVC
+            return _InterlockedCompareExchangePointer(_ptr, _new, _old);
+        #else
+            return __sync_val_compare_and_swap(_ptr, _old, _new);
+        #endif // BX_COMPILER_MSVC
+    }
+
+    /// Returns the value stored at '_ptr' before the operation.
+    DM_INLINE void* atomicExchangePtr(void* volatile* _ptr, void* _new)
+    {
+        #if BX_COMPILER_MSVC
+            return _InterlockedExchangePointer(_ptr, _new);
+        #else
+            void* oldVal = *_ptr;
+            for (;;)
+            {
+                void* prev = __sync_val_compare_and_swap(_ptr, oldVal, _new);
+                if (prev == oldVal)
+                {
+                    return prev;
+                }
+                oldVal = prev;
+            }
+        #endif // BX_COMPILER_MSVC
+    }
+
+} // namespace dm
+
+#endif // DM_ATOMIC_H_HEADER_GUARD
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -7,6 +7,7 @@
 #define DM_DATASTRUCTURES_H_HEADER_GUARD
 
 #include "datastructures/array.h"
+#include "datastructures/atomicbitarray.h"
 #include "datastructures/bitarray.h"
 #include "datastructures/handlealloc.h"
 #include "datastructures/hashmap.h"
@@ -0,0 +1,452 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_ATOMICBITARRAY_H_HEADER_GUARD
+#define DM_ATOMICBITARRAY_H_HEADER_GUARD
+
+#include <stdint.h> // uint32_t
+#include <string.h> // memset
+
+#include "../common/common.h" // DM_INLINE
+#include "../check.h"         // DM_CHECK
+#include "../atomic.h"        // dm::atomicCompareAndSwap64(), dm::atomicFetchAndAnd64()
+
+#include "../../../3rdparty/bx/uint32_t.h"  // bx::uint64_cnttz(), bx::uint64_cntbits()
+#include "../../../3rdparty/bx/allocator.h" // bx::ReallocatorI
+
+#include "bitarray.h" // dm::markFirstUnsetBit()
+
+#ifndef DM_ATOMICBITARRAY_SUMMARIES
+    #define DM_ATOMICBITARRAY_SUMMARIES 1 // Use 0 to keep no summaries and scan the words linearly from the hint, for comparison.
+#endif //DM_ATOMICBITARRAY_SUMMARIES
+
+namespace dm
+{
+    /// Words taken by the summary levels above 'NumWordsT' words, see AtomicBitArray.
+    template <uint32_t NumWordsT>
+    struct AtomicBitArraySummary
+    {
+        enum
+        {
+            NumWords = ((NumWordsT-1)>>6)+1,
+            value    = NumWords + AtomicBitArraySummary<NumWords>::value,
+        };
+    };
+    template <> struct AtomicBitArraySummary<1> { enum { value = 0 }; };
+
+    /// Compile-time counterpart of AtomicBitArray::sizeFor().
+    /// Usage: AtomicBitArraySize<1024>::value
+    template <uint32_t MaxT>
+    struct AtomicBitArraySize
+    {
+        enum
+        {
+            NumSlots = ((MaxT-1)>>6)+1,
+            value    = (NumSlots + 2*AtomicBitArraySummary<NumSlots>::value)*sizeof(uint64_t),
+        };
+    };
+
+    /// Bit array that can be modified concurrently from multiple threads without locking.
+    /// Bits are claimed and released with atomic operations on 64-bit words.
+    ///
+    /// Two summaries are kept on top of the bits, one bit per word below, 64 words per word above, up to a single top word.
+    /// A 'full' summary bit is set when the word below has all bits set, an 'empty' one when it has none.
+    /// Searches descend from the top word, so they take O(levels) instead of a scan over all words.
+    /// Summaries are updated only when a word becomes or stops being full or empty, after the word itself. A word is
+    /// re-read after its summary bit is set, so a word with room is never hidden. A summary bit can be left clear over
+    /// a word that has none, searches that run into it set it and retry. See DM_ATOMICBITARRAY_SUMMARIES.
+    struct AtomicBitArray
+    {
+        enum
+        {
+            Full,
+            Empty,
+
+            NumSummaries,
+            MaxLevels = 5, // Enough for UINT32_MAX bits.
+        };
+
+        // Uninitialized state, init() needs to be called !
+        AtomicBitArray()
+        {
+            m_bits = NULL;
+        }
+
+        ~AtomicBitArray()
+        {
+            destroy();
+        }
+
+        static inline uint32_t numSlotsFor(uint32_t _max)
+        {
+            return ((_max-1)>>6) + 1;
+        }
+
+        static inline uint32_t sizeFor(uint32_t _max)
+        {
+            uint32_t numWords = numSlotsFor(_max);
+            for (uint32_t words = numWords; words > 1; )
+            {
+                words = ((words-1)>>6) + 1;
+                numWords += NumSummaries*words;
+            }
+
+            return numWords*sizeof(uint64_t);
+        }
+
+        // Allocates memory internally.
+        void init(uint32_t _max, bx::ReallocatorI* _reallocator)
+        {
+            m_reallocator = _reallocator;
+            m_cleanup = true;
+
+            initLevels(_max, BX_ALLOC(_reallocator, sizeFor(_max)));
+            reset();
+        }
+
+        // Uses externally allocated memory.
+        void* init(uint32_t _max, void* _mem)
+        {
+            m_reallocator = NULL;
+            m_cleanup = false;
+
+            initLevels(_max, _mem);
+            reset();
+
+            void* end = (void*)((uint8_t*)_mem + sizeFor(_max));
+            return end;
+        }
+
+        void destroy()
+        {
+            if (m_cleanup && NULL != m_bits)
+            {
+                BX_FREE(m_reallocator, (void*)m_bits);
+                m_bits = NULL;
+            }
+        }
+
+        /// Not thread-safe.
+        void reset()
+        {
+            m_last = 0;
+            memset((void*)m_bits, 0, m_numSlots*sizeof(uint64_t));
+
+            // Bits past max() are permanently set, so they are never handed out.
+            const uint32_t used = m_max&63;
+            if (0 != used)
+            {
+                m_bits[m_numSlots-1] = UINT64_MAX<<used;
+            }
+
+            // All words are empty, none is full. Summary bits past the last word below are set, so they are never picked.
+            uint32_t numBelow = m_numSlots;
+            for (uint32_t level = 0; level < m_numLevels; ++level)
+            {
+                const uint32_t numWords = ((numBelow-1)>>6) + 1;
+                memset((void*)m_summary[Full][level],  0x00, numWords*sizeof(uint64_t));
+                memset((void*)m_summary[Empty][level], 0xff, numWords*sizeof(uint64_t));
+
+                const uint32_t below = numBelow&63;
+                if (0 != below)
+                {
+                    m_summary[Full][level][numWords-1] = UINT64_MAX<<below;
+                }
+
+                numBelow = numWords;
+            }
+        }
+
+        void set(uint32_t _bit)
+        {
+            DM_CHECK(_bit < max(), "atomicBitArraySet | %d, %d", _bit, max());
+
+            const uint32_t bucket = _bit>>6;
+            const uint64_t bit    = UINT64_C(1)<<(_bit&63);
+            const uint64_t prev   = atomicFetchAndOr64(&m_bits[bucket], bit);
+
+            updateSet(bucket, prev, prev|bit);
+        }
+
+        void unset(uint32_t _bit)
+        {
+            DM_CHECK(_bit < max(), "atomicBitArrayUnset | %d, %d", _bit, max());
+
+            const uint32_t bucket = _bit>>6;
+            const uint64_t bit    = UINT64_C(1)<<(_bit&63);
+            const uint64_t prev   = atomicFetchAndAnd64(&m_bits[bucket], ~bit);
+
+            // A full word just got a free bit, point the hint to it.
+            if (UINT64_MAX == prev)
+            {
+                m_last = bucket;
+                summaryClear(Full, 0, bucket);
+            }
+
+            const uint64_t valid = validMask(bucket);
+            if (0 != (prev&valid) && 0 == (prev&~bit&valid))
+            {
+                summarySet(Empty, 0, bucket);
+            }
+        }
+
+        bool isSet(uint32_t _bit) const
+        {
+            DM_CHECK(_bit < max(), "atomicBitArrayIsSet | %d, %d", _bit, max());
+
+            const uint32_t bucket = _bit>>6;
+            const uint64_t bit    = UINT64_C(1)<<(_bit&63);
+            return (0 != (m_bits[bucket] & bit));
+        }
+
+        /// Claims any unset bit, the word under the hint cursor is tried first, the full summary is searched after.
+        /// Returns max() if all bits are set.
+        uint32_t setAny()
+        {
+            const uint32_t begin = m_last;
+
+            for (uint32_t slot = begin; slot != m_numSlots; slot = findWord(Full, begin))
+            {
+                uint64_t bits = m_bits[slot];
+                while (UINT64_MAX != bits)
+                {
+                    const uint64_t bit  = markFirstUnsetBit(bits);
+                    const uint64_t prev = atomicCompareAndSwap64(&m_bits[slot], bits, bits|bit);
+                    if (prev == bits)
+                    {
+                        if (slot != begin)
+                        {
+                            m_last = slot;
+                        }
+
+                        updateSet(slot, prev, prev|bit);
+
+                        const uint32_t pos = uint32_t(bx::uint64_cnttz(bit));
+                        return (slot<<6)+pos;
+                    }
+
+                    // Lost the race, retry on the updated word.
+                    bits = prev;
+                }
+            }
+
+            return max();
+        }
+
+        /// Returns max() if none set.
+        uint32_t getFirstSetBit() const
+        {
+            for (uint32_t slot = findWord(Empty); slot != m_numSlots; slot = findWord(Empty))
+            {
+                const uint64_t bits = m_bits[slot] & validMask(slot);
+                if (0 != bits)
+                {
+                    const uint32_t pos = uint32_t(bx::uint64_cnttz(bits));
+                    return (slot<<6)+pos;
+                }
+            }
+
+            return max();
+        }
+
+        /// Returns max() if none unset.
+        uint32_t getFirstUnsetBit() const
+        {
+            for (uint32_t slot = findWord(Full); slot != m_numSlots; slot = findWord(Full))
+            {
+                const uint64_t bits = m_bits[slot];
+                if (UINT64_MAX != bits)
+                {
+                    const uint64_t sel = markFirstUnsetBit(bits);
+                    const uint32_t pos = uint32_t(bx::uint64_cnttz(sel));
+                    return (slot<<6)+pos;
+                }
+            }
+
+            return max();
+        }
+
+        uint32_t count() const
+        {
+            uint64_t count = 0;
+            for (uint32_t ii = m_numSlots; ii--; )
+            {
+                count += bx::uint64_cntbits(m_bits[ii]);
+            }
+
+            const uint32_t padding = (m_numSlots<<6) - m_max;
+            return uint32_t(count) - padding;
+        }
+
+        uint32_t max() const
+        {
+            return m_max;
+        }
+
+        uint32_t numSlots() const
+        {
+            return m_numSlots;
+        }
+
+    private:
+        void initLevels(uint32_t _max, void* _mem)
+        {
+            m_max = _max;
+            m_numSlots = numSlotsFor(_max);
+            m_bits = (uint64_t*)_mem;
+
+            uint32_t numWords[MaxLevels];
+            m_numLevels = 0;
+            for (uint32_t words = m_numSlots; DM_ATOMICBITARRAY_SUMMARIES && words > 1; )
+            {
+                words = ((words-1)>>6) + 1;
+                numWords[m_numLevels++] = words;
+            }
+
+            volatile uint64_t* ptr = m_bits + m_numSlots;
+            for (uint32_t ii = 0; ii < NumSummaries; ++ii)
+            {
+                for (uint32_t level = 0; level < m_numLevels; ++level)
+                {
+                    m_summary[ii][level] = ptr;
+                    ptr += numWords[level];
+                }
+            }
+        }
+
+        /// Bits past max() in the last word do not count as set.
+        uint64_t validMask(uint32_t _slot) const
+        {
+            const uint32_t used = m_max&63;
+            return (_slot == m_numSlots-1 && 0 != used) ? ~(UINT64_MAX<<used) : UINT64_MAX;
+        }
+
+        /// Summaries after a word changed from '_prev' to '_bits' by setting bits.
+        void updateSet(uint32_t _slot, uint64_t _prev, uint64_t _bits) const
+        {
+            if (UINT64_MAX != _prev && UINT64_MAX == _bits)
+            {
+                summarySet(Full, 0, _slot);
+            }
+
+            if (0 == (_prev&validMask(_slot)))
+            {
+                summaryClear(Empty, 0, _slot);
+            }
+        }
+
+        /// Whether word '_idx' at '_level' below the summary (0 being the bits) is full or empty, as '_summary' tells.
+        bool isMarked(uint32_t _summary, uint32_t _level, uint32_t _idx) const
+        {
+            if (0 != _level)
+            {
+                return (UINT64_MAX == m_summary[_summary][_level-1][_idx]);
+            }
+
+            return (Full == _summary)
+                ? UINT64_MAX == m_bits[_idx]
+                : 0 == (m_bits[_idx]&validMask(_idx))
+                ;
+        }
+
+        /// Marks word '_idx' at '_level', re-reads the word and clears the mark again if it changed meanwhile.
+        void summarySet(uint32_t _summary, uint32_t _level, uint32_t _idx) const
+        {
+            if (_level >= m_numLevels || _level >= MaxLevels) // The latter bounds the recursion for the compiler.
+            {
+                return;
+            }
+
+            const uint64_t bit  = UINT64_C(1)<<(_idx&63);
+            const uint64_t prev = atomicFetchAndOr64(&m_summary[_summary][_level][_idx>>6], bit);
+            if (UINT64_MAX != prev && UINT64_MAX == (prev|bit))
+            {
+                summarySet(_summary, _level+1, _idx>>6);
+            }
+
+            if (!isMarked(_summary, _level, _idx))
+            {
+                summaryClear(_summary, _level, _idx);
+            }
+        }
+
+        void summaryClear(uint32_t _summary, uint32_t _level, uint32_t _idx) const
+        {
+            if (_level >= m_numLevels || _level >= MaxLevels)
+            {
+                return;
+            }
+
+            const uint64_t bit  = UINT64_C(1)<<(_idx&63);
+            const uint64_t prev = atomicFetchAndAnd64(&m_summary[_summary][_level][_idx>>6], ~bit);
+            if (UINT64_MAX == prev)
+            {
+                summaryClear(_summary, _level+1, _idx>>6);
+            }
+        }
+
+        /// Descends '_summary' from the top word. Returns a word that was not full, or not empty, when it was read.
+        /// Returns m_numSlots if there is none. Without summaries the words are scanned from '_begin' on, wrapping around.
+        uint32_t findWord(uint32_t _summary, uint32_t _begin = 0) const
+        {
+            #if !DM_ATOMICBITARRAY_SUMMARIES
+            for (uint32_t ii = 0; ii < m_numSlots; ++ii)
+            {
+                const uint32_t idx = (_begin+ii < m_numSlots) ? _begin+ii : _begin+ii-m_numSlots;
+                if (!isMarked(_summary, 0, idx))
+                {
+                    return idx;
+                }
+            }
+
+            return m_numSlots;
+            #else
+            BX_UNUSED(_begin);
+            for (;;)
+            {
+                uint32_t idx   = 0;
+                uint32_t level = m_numLevels;
+                for (; 0 != level; --level)
+                {
+                    const uint64_t bits = m_summary[_summary][level-1][idx];
+                    if (UINT64_MAX == bits)
+                    {
+                        break;
+                    }
+
+                    idx = (idx<<6) + uint32_t(bx::uint64_cnttz(~bits));
+                }
+
+                if (0 == level && !isMarked(_summary, 0, idx))
+                {
+                    return idx;
+                }
+
+                if (m_numLevels == level)
+                {
+                    return m_numSlots;
+                }
+
+                // Mark left clear over a full word, set it and retry.
+                summarySet(_summary, level, idx);
+            }
+            #endif //!DM_ATOMICBITARRAY_SUMMARIES
+        }
+
+        volatile uint32_t  m_last;
+        uint32_t           m_max;
+        uint32_t           m_numSlots;
+        uint32_t           m_numLevels;
+        volatile uint64_t* m_bits;
+        volatile uint64_t* m_summary[NumSummaries][MaxLevels];
+        bx::ReallocatorI*  m_reallocator;
+        bool               m_cleanup;
+    };
+
+} // namespace dm
+
+#endif // DM_ATOMICBITARRAY_H_HEADER_GUARD
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,41 @@
+--
+-- Copyright 2015 Dario Manesku. All rights reserved.
+-- License: http://www.opensource.org/licenses/BSD-2-Clause
+--
+
+-- libdmalloc.so, drop-in malloc() and operator new replacement on top of dm::Memory, see src/dmalloc.cpp.
+-- Usage: LD_PRELOAD=/path/to/libdmalloc.so ./app
+
+function dmalloc_project(_dmDir, _bxDir)
+
+    project "dmalloc"
+        kind "SharedLib"
+
+        includedirs
+        {
+            path.join(_dmDir, "include"),
+            path.join(_dmDir, "3rdparty"),
+            path.join(_bxDir, "include"),
+        }
+
+        files
+        {
+            path.join(_dmDir, "src/dmalloc.cpp"),
+        }
+
+        configuration { "linux-*" }
+            buildoptions
+            {
+                "-fPIC",
+                "-fvisibility=hidden",
+                "-ftls-model=initial-exec",
+                "-msse4.1",
+            }
+            links
+            {
+                "pthread",
+            }
+
+        configuration {}
+
+end
@@ -0,0 +1,69 @@
+--
+-- Copyright 2015 Dario Manesku. All rights reserved.
+-- License: http://www.opensource.org/licenses/BSD-2-Clause
+--
+
+-- Allocator benchmarks, one console app per file in bench/, see bench/bench.h.
+-- Entries are { project name, source file (defaults to the name), defines }. Builds of the same file with
+-- different defines compare allocator configurations.
+
+local dmBenchmarks =
+{
+    { "bitarray_contention" },
+    { "bitarray_occupancy" },
+    { "bitarray_occupancy_nosummary", "bitarray_occupancy", { "DM_ATOMICBITARRAY_SUMMARIES=0" } },
+    { "arena_startup" },
+    { "arena_startup_malloc", "arena_startup", { "DM_MEM_ARENA=DM_MEM_ARENA_MALLOC" } },
+    { "huge_pages" },
+    { "huge_pages_on", "huge_pages", { "DM_MEM_HUGE_PAGES=1" } },
+    { "heap_arenas" },
+    { "heap_arenas_single", "heap_arenas", { "DM_ALLOC_HEAP_ARENAS=1" } },
+    { "heap_fragmentation" },
+    { "heap_fragmentation_array", "heap_fragmentation", { "DM_ALLOCATOR_UNDERLYING_IMPL=DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY" } },
+    { "aligned_simd" },
+    { "stack_interleaved" },
+    { "stl_workload" },
+    { "heap_churn" },
+    { "heap_churn_array", "heap_churn", { "DM_ALLOCATOR_UNDERLYING_IMPL=DM_ALLOCATOR_UNDERLYING_IMPL_ARRAY" } },
+}
+
+function dmbench_project(_dmDir, _bxDir)
+
+    for _, bench in ipairs(dmBenchmarks) do
+
+    project ("bench_" .. bench[1])
+        kind "ConsoleApp"
+
+        includedirs
+        {
+            path.join(_dmDir, "include"),
+            path.join(_dmDir, "3rdparty"),
+            path.join(_bxDir, "include"),
+        }
+
+        files
+        {
+            path.join(_dmDir, "bench/bench.h"),
+            path.join(_dmDir, "bench", (bench[2] or bench[1]) .. ".cpp"),
+        }
+
+        defines
+        {
+            bench[3] or {},
+        }
+
+        configuration { "linux-* or osx" }
+            buildoptions
+            {
+                "-msse4.1",
+            }
+            links
+            {
+                "pthread",
+            }
+
+        configuration {}
+
+    end
+
+end
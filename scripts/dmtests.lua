@@ -0,0 +1,52 @@
+--
+-- Copyright 2015 Dario Manesku. All rights reserved.
+-- License: http://www.opensource.org/licenses/BSD-2-Clause
+--
+
+-- Allocator tests, one console app per file in tests/. Each one returns non-zero on failure.
+-- Usage: run every test_* binary from the build output directory.
+
+local dmTests =
+{
+    "thread_exit",
+    "aligned_alloc",
+    "profile_sampling",
+    "reloc_compact",
+    "free_sized",
+}
+
+function dmtests_project(_dmDir, _bxDir)
+
+    for _, name in ipairs(dmTests) do
+
+    project ("test_" .. name)
+        kind "ConsoleApp"
+
+        includedirs
+        {
+            path.join(_dmDir, "include"),
+            path.join(_dmDir, "3rdparty"),
+            path.join(_bxDir, "include"),
+        }
+
+        files
+        {
+            path.join(_dmDir, "tests/test.h"),
+            path.join(_dmDir, "tests", name .. ".cpp"),
+        }
+
+        configuration { "linux-* or osx" }
+            buildoptions
+            {
+                "-msse4.1",
+            }
+            links
+            {
+                "pthread",
+            }
+
+        configuration {}
+
+    end
+
+end
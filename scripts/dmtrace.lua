@@ -0,0 +1,38 @@
+--
+-- Copyright 2015 Dario Manesku. All rights reserved.
+-- License: http://www.opensource.org/licenses/BSD-2-Clause
+--
+
+-- dmtrace, replays allocation traces recorded with dm::TraceRecorder, see src/dmtrace.cpp.
+-- Usage: dmtrace <trace file> [main|crt|stack]
+
+function dmtrace_project(_dmDir, _bxDir)
+
+    project "dmtrace"
+        kind "ConsoleApp"
+
+        includedirs
+        {
+            path.join(_dmDir, "include"),
+            path.join(_dmDir, "3rdparty"),
+            path.join(_bxDir, "include"),
+        }
+
+        files
+        {
+            path.join(_dmDir, "src/dmtrace.cpp"),
+        }
+
+        configuration { "linux-* or osx" }
+            buildoptions
+            {
+                "-msse4.1",
+            }
+            links
+            {
+                "pthread",
+            }
+
+        configuration {}
+
+end
@@ -0,0 +1,336 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Drop-in malloc() and operator new replacement on top of dm::Memory, built as libdmalloc.so, see scripts/dmalloc.lua.
+// Usage:
+//     LD_PRELOAD=/path/to/libdmalloc.so ./app
+//
+// Environment:
+//     DMALLOC_SIZE_MB - Arena size in megabytes, DM_MEM_DEFAULT_SIZE otherwise.
+//
+// Linux with glibc only. Allocations that do not fit dm memory fall back to glibc through __libc_malloc() and friends.
+// Has to be built with -ftls-model=initial-exec, the thread caches are accessed from within malloc() and the default
+// TLS model of shared libraries may allocate on first access.
+// Forking while another thread holds one of the heap locks is not handled.
+
+#include <stddef.h> // size_t
+#include <stdlib.h> // getenv(), strtoull()
+#include <errno.h>  // EINVAL, ENOMEM
+#include <new>      // std::bad_alloc, std::get_new_handler()
+
+#include <bx/platform.h>
+
+#if !BX_PLATFORM_LINUX
+#   error "dmalloc is supported on Linux only."
+#endif // !BX_PLATFORM_LINUX
+
+extern "C"
+{
+    void* __libc_malloc(size_t _size);
+    void* __libc_realloc(void* _ptr, size_t _size);
+    void  __libc_free(void* _ptr);
+}
+
+#ifndef CS_CHECK
+#   define CS_CHECK DM_CHECK
+#endif //CS_CHECK
+
+#define DM_ALLOC_EXTERNAL_MALLOC  __libc_malloc
+#define DM_ALLOC_EXTERNAL_REALLOC __libc_realloc
+#define DM_ALLOC_EXTERNAL_FREE    __libc_free
+
+#define DM_MEM_SIZE_FUNC dmallocMemSize
+static size_t dmallocMemSize();
+
+#define DM_ALLOCATOR_IMPL
+#include <dm/allocator/allocator.h>
+
+static size_t dmallocMemSize()
+{
+    const char* env = getenv("DMALLOC_SIZE_MB");
+    return (NULL != env) ? size_t(strtoull(env, NULL, 10))<<20 : DM_MEM_DEFAULT_SIZE;
+}
+
+#define DMALLOC_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace dm
+{
+    // Memory is constructed on first use, it may be needed before static constructors of this library run.
+    static uint8_t s_dmallocStorage[sizeof(Memory)] __attribute__((aligned(64)));
+    static Memory* volatile s_dmalloc;
+    static volatile uint64_t s_dmallocState; // 0 - not initialized, 1 - initializing, 2 - ready.
+
+    // Serves allocations made while Memory is being initialized, such memory is never reclaimed.
+    struct Bootstrap
+    {
+        enum
+        {
+            Size   = DM_KILOBYTES(64),
+            Header = 16, // Allocation size, keeps the natural alignment.
+        };
+
+        static void* alloc(size_t _size)
+        {
+            // Checked before the size is narrowed, 4GB and more would wrap around.
+            if (_size > Size)
+            {
+                return NULL;
+            }
+
+            const uint32_t size = uint32_t(dm::alignSizeNext(_size, DM_NATURAL_ALIGNMENT) + Header);
+            const uint32_t pos  = dm::atomicFetchAndAdd32(&s_pos, size);
+            if (pos + size > Size)
+            {
+                return NULL;
+            }
+
+            uint8_t* mem = &s_mem[pos];
+            *(size_t*)mem = _size;
+            return mem + Header;
+        }
+
+        static bool contains(const void* _ptr)
+        {
+            return (s_mem <= _ptr && _ptr < s_mem + Size);
+        }
+
+        static size_t getSize(const void* _ptr)
+        {
+            return *(const size_t*)((const uint8_t*)_ptr - Header);
+        }
+
+        static uint8_t           s_mem[Size] __attribute__((aligned(DM_NATURAL_ALIGNMENT)));
+        static volatile uint32_t s_pos;
+    };
+    uint8_t           Bootstrap::s_mem[Bootstrap::Size];
+    volatile uint32_t Bootstrap::s_pos;
+
+    static BX_THREAD bool s_dmallocInitThread;
+
+    /// Returns NULL while the calling thread is initializing Memory.
+    static inline Memory* dmalloc()
+    {
+        if (2 == s_dmallocState)
+        {
+            return s_dmalloc;
+        }
+
+        if (s_dmallocInitThread)
+        {
+            return NULL;
+        }
+
+        if (0 == dm::atomicCompareAndSwap64(&s_dmallocState, 0, 1))
+        {
+            s_dmallocInitThread = true;
+
+            Memory* memory = ::new (s_dmallocStorage) Memory();
+            memory->init();
+            s_dmalloc = memory;
+
+            s_dmallocInitThread = false;
+            dm::atomicCompareAndSwap64(&s_dmallocState, 1, 2);
+        }
+
+        while (2 != s_dmallocState)
+        {
+            bx::yield();
+        }
+
+        return s_dmalloc;
+    }
+
+    static inline void* dmallocAlloc(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+    {
+        Memory* memory = dmalloc();
+        if (NULL == memory)
+        {
+            return Bootstrap::alloc(_size);
+        }
+
+        // Zero sized allocations still get a unique pointer.
+        return memory->alignedAlloc((0 == _size) ? 1 : _size, _align);
+    }
+
+    static inline void dmallocFree(void* _ptr)
+    {
+        if (NULL == _ptr || Bootstrap::contains(_ptr))
+        {
+            return;
+        }
+
+        dmalloc()->free(_ptr);
+    }
+
+    static inline void* dmallocNew(size_t _size, size_t _align = DM_NATURAL_ALIGNMENT)
+    {
+        for (;;)
+        {
+            void* ptr = dmallocAlloc(_size, _align);
+            if (NULL != ptr)
+            {
+                return ptr;
+            }
+
+            std::new_handler handler = std::get_new_handler();
+            if (NULL == handler)
+            {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+
+} // namespace dm
+
+// C-runtime.
+//-----
+
+DMALLOC_EXPORT void* malloc(size_t _size)
+{
+    return dm::dmallocAlloc(_size);
+}
+
+DMALLOC_EXPORT void free(void* _ptr)
+{
+    dm::dmallocFree(_ptr);
+}
+
+DMALLOC_EXPORT void cfree(void* _ptr)
+{
+    dm::dmallocFree(_ptr);
+}
+
+DMALLOC_EXPORT void* calloc(size_t _num, size_t _size)
+{
+    const size_t size = _num*_size;
+    if (0 != _size && size/_size != _num)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    dm::Memory* memory = dm::dmalloc();
+    if (NULL != memory)
+    {
+        return memory->callocZeroed((0 == size) ? 1 : size);
+    }
+
+    // Bootstrap memory is zero until handed out and never reused.
+    return dm::Bootstrap::alloc(size);
+}
+
+DMALLOC_EXPORT void* realloc(void* _ptr, size_t _size)
+{
+    if (NULL == _ptr)
+    {
+        return dm::dmallocAlloc(_size);
+    }
+
+    if (0 == _size)
+    {
+        dm::dmallocFree(_ptr);
+        return NULL;
+    }
+
+    if (dm::Bootstrap::contains(_ptr))
+    {
+        void* ptr = dm::dmallocAlloc(_size);
+        if (NULL != ptr)
+        {
+            memcpy(ptr, _ptr, dm::min(dm::Bootstrap::getSize(_ptr), _size));
+        }
+
+        return ptr;
+    }
+
+    return dm::dmalloc()->realloc(_ptr, _size);
+}
+
+DMALLOC_EXPORT void* memalign(size_t _align, size_t _size)
+{
+    return dm::dmallocAlloc(_size, dm::max(_align, size_t(DM_NATURAL_ALIGNMENT)));
+}
+
+DMALLOC_EXPORT void* aligned_alloc(size_t _align, size_t _size)
+{
+    return memalign(_align, _size);
+}
+
+DMALLOC_EXPORT int posix_memalign(void** _ptr, size_t _align, size_t _size)
+{
+    if (0 != (_align & (_align-1)) || 0 != (_align % sizeof(void*)))
+    {
+        return EINVAL;
+    }
+
+    void* ptr = memalign(_align, _size);
+    if (NULL == ptr)
+    {
+        return ENOMEM;
+    }
+
+    *_ptr = ptr;
+    return 0;
+}
+
+DMALLOC_EXPORT void* valloc(size_t _size)
+{
+    return memalign(dm::vmemPageSize(), _size);
+}
+
+DMALLOC_EXPORT void* pvalloc(size_t _size)
+{
+    const size_t pageSize = dm::vmemPageSize();
+    return memalign(pageSize, dm::alignSizeNext(_size, pageSize));
+}
+
+/// Blocks that fell back to glibc report 0.
+DMALLOC_EXPORT size_t malloc_usable_size(void* _ptr)
+{
+    if (NULL == _ptr)
+    {
+        return 0;
+    }
+
+    if (dm::Bootstrap::contains(_ptr))
+    {
+        return dm::Bootstrap::getSize(_ptr);
+    }
+
+    return dm::dmalloc()->getSize(_ptr);
+}
+
+// Operator new/delete.
+//-----
+
+__attribute__((visibility("default"))) void* operator new(size_t _size)                                    { return dm::dmallocNew(_size); }
+__attribute__((visibility("default"))) void* operator new[](size_t _size)                                  { return dm::dmallocNew(_size); }
+__attribute__((visibility("default"))) void* operator new(size_t _size, const std::nothrow_t&) throw()      { return dm::dmallocAlloc(_size); }
+__attribute__((visibility("default"))) void* operator new[](size_t _size, const std::nothrow_t&) throw()    { return dm::dmallocAlloc(_size); }
+__attribute__((visibility("default"))) void  operator delete(void* _ptr) throw()                           { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr) throw()                         { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete(void* _ptr, const std::nothrow_t&) throw()    { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr, const std::nothrow_t&) throw()  { dm::dmallocFree(_ptr); }
+
+#if defined(__cpp_sized_deallocation)
+__attribute__((visibility("default"))) void  operator delete(void* _ptr, size_t) throw()                   { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr, size_t) throw()                 { dm::dmallocFree(_ptr); }
+#endif // defined(__cpp_sized_deallocation)
+
+#if defined(__cpp_aligned_new)
+__attribute__((visibility("default"))) void* operator new(size_t _size, std::align_val_t _align)                                  { return dm::dmallocNew(_size, size_t(_align)); }
+__attribute__((visibility("default"))) void* operator new[](size_t _size, std::align_val_t _align)                                { return dm::dmallocNew(_size, size_t(_align)); }
+__attribute__((visibility("default"))) void* operator new(size_t _size, std::align_val_t _align, const std::nothrow_t&) throw()   { return dm::dmallocAlloc(_size, size_t(_align)); }
+__attribute__((visibility("default"))) void* operator new[](size_t _size, std::align_val_t _align, const std::nothrow_t&) throw() { return dm::dmallocAlloc(_size, size_t(_align)); }
+__attribute__((visibility("default"))) void  operator delete(void* _ptr, std::align_val_t) throw()                                { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr, std::align_val_t) throw()                              { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete(void* _ptr, size_t, std::align_val_t) throw()                        { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr, size_t, std::align_val_t) throw()                      { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete(void* _ptr, std::align_val_t, const std::nothrow_t&) throw()          { dm::dmallocFree(_ptr); }
+__attribute__((visibility("default"))) void  operator delete[](void* _ptr, std::align_val_t, const std::nothrow_t&) throw()        { dm::dmallocFree(_ptr); }
+#endif // defined(__cpp_aligned_new)
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Replays an allocation trace recorded with dm::TraceRecorder and prints throughput, latency percentiles, peak RSS and
+// heap fragmentation, see include/dm/allocator/trace.h and scripts/dmtrace.lua.
+// Usage:
+//     dmtrace <trace file> [main|crt|stack]
+//
+// Tune allocator_config.h, rebuild, and replay the same trace to compare.
+
+#include <stdio.h>  // printf
+#include <string.h> // strcmp
+
+#ifndef CS_CHECK
+#   define CS_CHECK DM_CHECK
+#endif //CS_CHECK
+
+#define DM_ALLOCATOR_IMPL
+#include <dm/allocator/allocator.h>
+#include <dm/allocator/trace.h>
+
+int main(int _argc, const char* _argv[])
+{
+    if (_argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <trace file> [main|crt|stack]\n", _argv[0]);
+        return 1;
+    }
+
+    const char* name = (_argc > 2) ? _argv[2] : "main";
+    bx::ReallocatorI* alloc = NULL;
+    if (0 == strcmp(name, "main"))
+    {
+        alloc = dm::mainAlloc;
+    }
+    else if (0 == strcmp(name, "crt"))
+    {
+        alloc = dm::crtAlloc;
+    }
+    else if (0 == strcmp(name, "stack"))
+    {
+        alloc = dm::stackAlloc;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown allocator '%s'.\n", name);
+        return 1;
+    }
+
+    dm::allocInit();
+
+    bx::CrtFileReader reader;
+    if (0 != reader.open(_argv[1]))
+    {
+        fprintf(stderr, "Could not open '%s'.\n", _argv[1]);
+        return 1;
+    }
+
+    uint32_t num;
+    dm::TraceRecord* records = dm::traceLoad(&reader, num);
+    reader.close();
+
+    if (NULL == records)
+    {
+        fprintf(stderr, "'%s' is not a trace or is empty.\n", _argv[1]);
+        return 1;
+    }
+
+    printf("Replaying %u records on %s.\n\n", num, name);
+
+    dm::TraceReplayStats stats;
+    const bool result = dm::traceReplay(records, num, alloc, stats);
+    dm::tracePrintStats(stats);
+
+    BX_FREE(dm::crtAlloc, records);
+
+    if (!result)
+    {
+        fprintf(stderr, "\nTrace frees blocks it never allocated, results are incomplete.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
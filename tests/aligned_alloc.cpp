@@ -0,0 +1,85 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Aligned allocations from every allocator and tier: small classes, heap, large objects, stacks and static storage.
+// Realloc has to keep both the alignment and the contents.
+
+#include "test.h"
+#include <string.h> // memset()
+
+static const size_t s_aligns[] = { 8, 16, 32, 64, 128, 4096, DM_KILOBYTES(64) };
+static const size_t s_sizes[]  = { 1, 24, 200, 5000, DM_KILOBYTES(100), DM_MEGABYTES(1), DM_MEGABYTES(6) };
+
+static inline bool isAligned(const void* _ptr, size_t _align)
+{
+    return 0 == (uintptr_t(_ptr) & (dm::max(_align, size_t(DM_NATURAL_ALIGNMENT))-1));
+}
+
+static inline bool isFilled(const void* _ptr, size_t _size, uint8_t _value)
+{
+    const uint8_t* bytes = (const uint8_t*)_ptr;
+    return _value == bytes[0] && _value == bytes[_size/2] && _value == bytes[_size-1];
+}
+
+static void testAllocator(bx::ReallocatorI* _alloc, size_t _maxSize, bool _free)
+{
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_aligns); ++ii)
+    {
+        for (uint32_t jj = 0; jj < BX_COUNTOF(s_sizes) && s_sizes[jj] <= _maxSize; ++jj)
+        {
+            const size_t align = s_aligns[ii];
+            const size_t size  = s_sizes[jj];
+
+            void* ptr = BX_ALIGNED_ALLOC(_alloc, size, align);
+            DM_TEST(NULL != ptr);
+            DM_TEST(isAligned(ptr, align));
+            memset(ptr, 0xa5, size);
+
+            const size_t newSize = dm::min(size*3, _maxSize);
+            ptr = BX_ALIGNED_REALLOC(_alloc, ptr, newSize, align);
+            DM_TEST(NULL != ptr);
+            DM_TEST(isAligned(ptr, align));
+            DM_TEST(isFilled(ptr, size, 0xa5));
+            memset(ptr, 0x5a, newSize);
+
+            if (_free)
+            {
+                BX_ALIGNED_FREE(_alloc, ptr, align);
+            }
+        }
+    }
+}
+
+int main()
+{
+    dm::allocInit();
+
+    testAllocator(dm::mainAlloc, DM_MEGABYTES(64), true);
+    testAllocator(dm::crtAlloc,  DM_MEGABYTES(64), true);
+
+    dm::push(dm::stackAlloc);
+    testAllocator(dm::stackAlloc, DM_KILOBYTES(128), false);
+    dm::pop(dm::stackAlloc);
+
+    dm::StackAllocatorI* stack = dm::allocCreateStack(DM_MEGABYTES(8));
+    testAllocator(stack, DM_KILOBYTES(128), false);
+    dm::allocFreeStack(stack);
+
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_aligns); ++ii)
+    {
+        void* ptr = BX_ALIGNED_ALLOC(dm::staticAlloc, 100+ii, s_aligns[ii]);
+        DM_TEST(NULL != ptr);
+        DM_TEST(isAligned(ptr, s_aligns[ii]));
+    }
+
+    // Aligned blocks are sized and freed like any other.
+    void* ptr = BX_ALIGNED_ALLOC(dm::mainAlloc, 5000, 4096);
+    DM_TEST(dm::allocSizeOf(ptr) >= 5000);
+    DM_FREE(dm::mainAlloc, ptr);
+
+    return testResult("aligned_alloc");
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
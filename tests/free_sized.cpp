@@ -0,0 +1,116 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// allocFreeSized() on every tier, from threads on different heap arenas. Half of the blocks are freed by the thread
+// that allocated them, the rest by the next thread, which has to find them outside of its own tiers.
+
+#include "test.h"
+
+#include <pthread.h>
+
+enum
+{
+    NumThreads = 4,
+    NumBlocks  = 64,
+};
+
+static const size_t s_sizes[] = { 48, 3000, DM_KILOBYTES(600), DM_MEGABYTES(2), DM_MEGABYTES(5) };
+
+struct ThreadData
+{
+    void*    m_ptrs[BX_COUNTOF(s_sizes)][NumBlocks];
+    uint32_t m_thread;
+};
+
+static ThreadData s_threads[NumThreads];
+
+static void* allocFunc(void* _data)
+{
+    ThreadData& data = *(ThreadData*)_data;
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_sizes); ++ii)
+    {
+        for (uint32_t jj = 0; jj < NumBlocks; ++jj)
+        {
+            // Some aligned ones, they may come from a bigger class or another tier.
+            const size_t align = (0 == jj%4) ? 64 : DM_NATURAL_ALIGNMENT;
+            data.m_ptrs[ii][jj] = BX_ALIGNED_ALLOC(dm::mainAlloc, s_sizes[ii], align);
+            DM_TEST(NULL != data.m_ptrs[ii][jj]);
+            *(uint32_t*)data.m_ptrs[ii][jj] = jj;
+        }
+    }
+
+    // Own half.
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_sizes); ++ii)
+    {
+        for (uint32_t jj = 0; jj < NumBlocks; jj += 2)
+        {
+            DM_TEST(jj == *(uint32_t*)data.m_ptrs[ii][jj]);
+            dm::allocFreeSized(data.m_ptrs[ii][jj], s_sizes[ii]);
+        }
+    }
+
+    return NULL;
+}
+
+static void* freeFunc(void* _data)
+{
+    ThreadData& data = *(ThreadData*)_data;
+    ThreadData& other = s_threads[(data.m_thread+1)%NumThreads];
+
+    // Gets an arena of its own first.
+    void* ptr = DM_ALLOC(dm::mainAlloc, DM_KILOBYTES(600));
+    dm::allocFreeSized(ptr, DM_KILOBYTES(600));
+
+    for (uint32_t ii = 0; ii < BX_COUNTOF(s_sizes); ++ii)
+    {
+        for (uint32_t jj = 1; jj < NumBlocks; jj += 2)
+        {
+            DM_TEST(jj == *(uint32_t*)other.m_ptrs[ii][jj]);
+            dm::allocFreeSized(other.m_ptrs[ii][jj], s_sizes[ii]);
+        }
+    }
+
+    return NULL;
+}
+
+static void runThreads(void* (*_func)(void*))
+{
+    pthread_t threads[NumThreads];
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        s_threads[ii].m_thread = ii;
+        pthread_create(&threads[ii], NULL, _func, &s_threads[ii]);
+    }
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_join(threads[ii], NULL);
+    }
+}
+
+int main()
+{
+    dm::allocInit();
+
+    dm::AllocStats before;
+    dm::allocGetStats(&before);
+
+    runThreads(allocFunc);
+    runThreads(freeFunc);
+
+    dm::AllocStats after;
+    dm::allocGetStats(&after);
+
+    for (uint32_t ii = 0; ii < after.m_numSmallClasses; ++ii)
+    {
+        DM_TEST(after.m_small[ii].m_used == before.m_small[ii].m_used);
+    }
+    DM_TEST(after.m_heapUsed      == before.m_heapUsed);
+    DM_TEST(after.m_largeObjects  == before.m_largeObjects);
+    DM_TEST(after.m_externalAlloc == after.m_externalFree);
+
+    return testResult("free_sized");
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
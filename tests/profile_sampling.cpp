@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Sampled profile estimates. Two sites that allocate in a fixed pattern, with the sample rate a multiple of its
+// period, both have to be seen. Threads doing a single small allocation must not be sampled each.
+
+#define DM_ALLOC_PROFILE 1
+#define DM_ALLOC_PROFILE_SAMPLE_RATE DM_KILOBYTES(256)
+#include "test.h"
+#include <pthread.h>
+
+enum
+{
+    BlockSize  = 1024,
+    NumPeriods = 100000,
+    NumThreads = 100,
+};
+
+static const char* s_file = "profile_sampling.cpp";
+
+static const dm::AllocSite* findSite(const dm::AllocSite* _sites, uint32_t _num, uint32_t _line)
+{
+    for (uint32_t ii = 0; ii < _num; ++ii)
+    {
+        if (_line == _sites[ii].m_line)
+        {
+            return &_sites[ii];
+        }
+    }
+
+    return NULL;
+}
+
+static void* singleAlloc(void* /*_userData*/)
+{
+    void* ptr = dm::mainAlloc->alloc(64, 0, s_file, 3);
+    dm::mainAlloc->free(ptr, 0, s_file, 3);
+    return NULL;
+}
+
+int main()
+{
+    dm::allocInit();
+
+    for (uint32_t ii = 0; ii < NumPeriods; ++ii)
+    {
+        void* aa = dm::mainAlloc->alloc(BlockSize, 0, s_file, 1);
+        void* bb = dm::mainAlloc->alloc(BlockSize, 0, s_file, 2);
+        dm::mainAlloc->free(aa, 0, s_file, 1);
+        dm::mainAlloc->free(bb, 0, s_file, 2);
+    }
+
+    pthread_t threads[NumThreads];
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_create(&threads[ii], NULL, singleAlloc, NULL);
+    }
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_join(threads[ii], NULL);
+    }
+
+    static dm::AllocSite sites[DM_ALLOC_PROFILE_MAX_SITES];
+    const uint32_t num = dm::allocProfileSnapshot(sites, DM_ALLOC_PROFILE_MAX_SITES);
+
+    // About 400 samples per site, the estimate is within a few percent.
+    const int64_t expected = int64_t(NumPeriods)*BlockSize;
+    for (uint32_t line = 1; line <= 2; ++line)
+    {
+        const dm::AllocSite* site = findSite(sites, num, line);
+        DM_TEST(NULL != site);
+        if (NULL != site)
+        {
+            DM_TEST(site->m_allocBytes > expected*4/5 && site->m_allocBytes < expected*6/5);
+            DM_TEST(0 == site->m_liveBytes);
+        }
+    }
+
+    // 6400 bytes in total, a sample or two at most. Sampling every first allocation gives 100.
+    const dm::AllocSite* site = findSite(sites, num, 3);
+    DM_TEST(NULL == site || site->m_allocBytes < int64_t(10*DM_ALLOC_PROFILE_SAMPLE_RATE));
+
+    return testResult("profile_sampling");
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Relocatable allocations shared between threads on different heap arenas while another thread keeps compacting.
+// Handles move between threads through a shared pool, so most of them are freed by a thread that did not allocate
+// them. Plain heap blocks are churned the same way to leave gaps for compaction.
+
+#include "test.h"
+
+#include <pthread.h>
+#include <string.h> // memset()
+
+enum
+{
+    NumThreads = 8,
+    NumSlots   = 1024,
+    NumOps     = 100000,
+    MinSize    = 64,
+    MaxSize    = DM_KILOBYTES(16),
+};
+
+static dm::RelocHandle   s_handles[NumSlots];
+static void*             s_blocks[NumSlots];
+static volatile uint32_t s_running;
+static volatile uint32_t s_done;
+
+static inline uint32_t rand32(uint32_t& _state)
+{
+    _state ^= _state<<13;
+    _state ^= _state>>17;
+    _state ^= _state<<5;
+    return _state;
+}
+
+static inline uint8_t pattern(uint32_t _size)
+{
+    return uint8_t(_size*31 + 7);
+}
+
+/// Pins, checks the size and pattern written at allocation, unpins.
+static void verify(dm::RelocHandle _handle)
+{
+    const uint8_t* ptr = (const uint8_t*)dm::allocPin(_handle);
+    const uint32_t size = *(const uint32_t*)ptr;
+    DM_TEST(size >= MinSize && size < MaxSize);
+    if (size >= MinSize && size < MaxSize)
+    {
+        DM_TEST(pattern(size) == ptr[sizeof(uint32_t)]);
+        DM_TEST(pattern(size) == ptr[size/2]);
+        DM_TEST(pattern(size) == ptr[size-1]);
+    }
+    dm::allocUnpin(_handle);
+}
+
+static void relocOp(uint32_t& _rand)
+{
+    dm::RelocHandle* slot = &s_handles[rand32(_rand)%NumSlots];
+    dm::RelocHandle handle = (dm::RelocHandle)dm::atomicExchangePtr((void* volatile*)slot, NULL);
+
+    if (NULL != handle)
+    {
+        verify(handle);
+        if (0 == (rand32(_rand)&1)
+        ||  NULL != dm::atomicCompareAndSwapPtr((void* volatile*)slot, NULL, handle))
+        {
+            dm::allocFreeRelocatable(handle);
+        }
+        return;
+    }
+
+    const uint32_t size = MinSize + rand32(_rand)%(MaxSize-MinSize);
+    handle = dm::allocRelocatable(size);
+    DM_TEST(NULL != handle);
+    if (NULL == handle)
+    {
+        return;
+    }
+
+    uint8_t* ptr = (uint8_t*)dm::allocPin(handle);
+    memset(ptr, pattern(size), size);
+    *(uint32_t*)ptr = size;
+    dm::allocUnpin(handle);
+
+    if (NULL != dm::atomicCompareAndSwapPtr((void* volatile*)slot, NULL, handle))
+    {
+        dm::allocFreeRelocatable(handle);
+    }
+}
+
+static void blockOp(uint32_t& _rand)
+{
+    void** slot = &s_blocks[rand32(_rand)%NumSlots];
+    void* ptr = dm::atomicExchangePtr((void* volatile*)slot, NULL);
+
+    if (NULL != ptr)
+    {
+        DM_FREE(dm::mainAlloc, ptr);
+        return;
+    }
+
+    ptr = DM_ALLOC(dm::mainAlloc, DM_KILOBYTES(8) + rand32(_rand)%DM_KILOBYTES(56));
+    if (NULL != dm::atomicCompareAndSwapPtr((void* volatile*)slot, NULL, ptr))
+    {
+        DM_FREE(dm::mainAlloc, ptr);
+    }
+}
+
+static void* workerFunc(void* _arg)
+{
+    uint32_t rand = 0x9e3779b9u + uint32_t(uintptr_t(_arg));
+    for (uint32_t ii = 0; ii < NumOps; ++ii)
+    {
+        if (0 == (rand32(rand)&3))
+        {
+            blockOp(rand);
+        }
+        else
+        {
+            relocOp(rand);
+        }
+    }
+
+    dm::atomicFetchAndAdd32(&s_done, 1);
+    return NULL;
+}
+
+static void* compactFunc(void* _moved)
+{
+    uint64_t& moved = *(uint64_t*)_moved;
+    // Back to back, so that frees from other threads land while compaction holds the heap.
+    while (0 != s_running)
+    {
+        moved += dm::allocCompact(DM_MEGABYTES(256), 1000);
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    dm::allocInit();
+
+    dm::AllocStats before;
+    dm::allocGetStats(&before);
+
+    s_running = 1;
+    uint64_t moved = 0;
+    pthread_t compactor;
+    pthread_create(&compactor, NULL, compactFunc, &moved);
+
+    pthread_t workers[NumThreads];
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_create(&workers[ii], NULL, workerFunc, (void*)uintptr_t(ii));
+    }
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_join(workers[ii], NULL);
+    }
+
+    s_running = 0;
+    pthread_join(compactor, NULL);
+
+    for (uint32_t ii = 0; ii < NumSlots; ++ii)
+    {
+        if (NULL != s_handles[ii])
+        {
+            verify(s_handles[ii]);
+            dm::allocFreeRelocatable(s_handles[ii]);
+        }
+        if (NULL != s_blocks[ii])
+        {
+            DM_FREE(dm::mainAlloc, s_blocks[ii]);
+        }
+    }
+
+    moved += dm::allocCompact(DM_MEGABYTES(1));
+
+    dm::AllocStats after;
+    dm::allocGetStats(&after);
+
+    DM_TEST(NumThreads == s_done);
+    DM_TEST(0 != moved);
+    DM_TEST(after.m_heapUsed <= before.m_heapUsed);
+
+    return testResult("reloc_compact");
+}
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+#ifndef DM_TEST_H_HEADER_GUARD
+#define DM_TEST_H_HEADER_GUARD
+
+// Shared by the allocator tests, see scripts/dmtests.lua.
+// Every test is a program of its own, so that it gets a fresh dm::Memory. It returns non-zero on failure.
+
+#include <stdio.h>  // fprintf()
+#include <stdint.h> // uint32_t
+
+#ifndef CS_CHECK
+#   define CS_CHECK DM_CHECK
+#endif //CS_CHECK
+
+#define DM_ALLOCATOR_IMPL
+#include <dm/allocator/allocator.h>
+
+static volatile uint32_t s_testFailures;
+
+#define DM_TEST(_cond)                                                              \
+    do                                                                              \
+    {                                                                               \
+        if (!(_cond))                                                               \
+        {                                                                           \
+            fprintf(stderr, "%s(%d): Test failed: %s\n", __FILE__, __LINE__, #_cond); \
+            dm::atomicFetchAndAdd32(&s_testFailures, 1);                            \
+        }                                                                           \
+    } while (0)
+
+static inline int testResult(const char* _name)
+{
+    fprintf(stderr, "%s: %s\n", _name, (0 == s_testFailures) ? "OK" : "FAILED");
+    return (0 == s_testFailures) ? 0 : 1;
+}
+
+/// Slots of the small class that holds '_size' bytes, in use or cached by threads.
+static inline uint32_t testSmallUsed(const dm::AllocStats& _stats, uint32_t _size)
+{
+    for (uint32_t ii = 0; ii < _stats.m_numSmallClasses; ++ii)
+    {
+        if (_stats.m_small[ii].m_size >= _size)
+        {
+            return _stats.m_small[ii].m_used;
+        }
+    }
+
+    return 0;
+}
+
+#endif // DM_TEST_H_HEADER_GUARD
+
+/* vim: set sw=4 ts=4 expandtab: */
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2015 Dario Manesku. All rights reserved.
+ * License: http://www.opensource.org/licenses/BSD-2-Clause
+ */
+
+// Thread caches and scratch stacks are handed back when threads exit, also when TLS destructors that run after
+// the allocator's exit hook allocate again.
+
+#include "test.h"
+
+#include <pthread.h>
+
+enum
+{
+    NumThreads = 200,
+    SmallSize  = 64,
+};
+
+static pthread_key_t s_lateKey;
+
+static void useMemory()
+{
+    void* ptr = DM_ALLOC(dm::mainAlloc, SmallSize);
+    DM_TEST(NULL != ptr);
+    DM_FREE(dm::mainAlloc, ptr);
+
+    dm::push(dm::stackAlloc);
+    void* tmp = DM_ALLOC(dm::stackAlloc, 256);
+    DM_TEST(NULL != tmp);
+    dm::pop(dm::stackAlloc);
+}
+
+// Created after allocInit(), runs after the allocator's exit hook.
+static void lateDestructor(void* /*_value*/)
+{
+    useMemory();
+}
+
+static void* threadFunc(void* _arg)
+{
+    if (NULL != _arg)
+    {
+        pthread_setspecific(s_lateKey, (void*)1);
+    }
+
+    void* ptrs[16];
+    for (uint32_t ii = 0; ii < 16; ++ii)
+    {
+        ptrs[ii] = DM_ALLOC(dm::mainAlloc, SmallSize);
+    }
+    for (uint32_t ii = 0; ii < 16; ++ii)
+    {
+        DM_FREE(dm::mainAlloc, ptrs[ii]);
+    }
+
+    useMemory();
+
+    return NULL;
+}
+
+static void runThreads(bool _lateDestructor)
+{
+    dm::AllocStats before;
+    dm::allocGetStats(&before);
+
+    for (uint32_t ii = 0; ii < NumThreads; ++ii)
+    {
+        pthread_t thread;
+        pthread_create(&thread, NULL, threadFunc, _lateDestructor ? (void*)1 : NULL);
+        pthread_join(thread, NULL);
+    }
+
+    dm::AllocStats after;
+    dm::allocGetStats(&after);
+
+    DM_TEST(testSmallUsed(before, SmallSize) == testSmallUsed(after, SmallSize));
+    DM_TEST(after.m_numStacks <= before.m_numStacks + 1); // Exited threads hand their stacks back to the pool.
+    DM_TEST(before.m_heapUsed == after.m_heapUsed);
+}
+
+int main()
+{
+    dm::allocInit();
+    pthread_key_create(&s_lateKey, lateDestructor);
+
+    runThreads(false);
+    runThreads(true);
+
+    return testResult("thread_exit");
+}
+
+/* vim: set sw=4 ts=4 expandtab: */